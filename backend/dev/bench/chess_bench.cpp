@@ -0,0 +1,316 @@
+// Chess core: first checks it on positions from random games (each legal
+// move survives UCI and SAN both ways, make/unmake puts everything back,
+// the Zobrist key make() keeps is the one worked out from scratch, FEN round
+// trips, illegal moves are turned down) and games ended by the rules, then
+// times what the server does per move: find the client's move among the
+// legal ones, make it and see if the game is over, next to generating every
+// legal move and parsing SAN.
+//
+// usage: chess_bench [games]
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+#include "src/chess/history.h"
+#include "src/chess/notation.h"
+#include "src/chess/position.h"
+
+using Clock = std::chrono::steady_clock;
+
+static void check(bool ok, const char *what, const chess::Position &p)
+{
+    if (!ok) {
+        fprintf(stderr, "chess: %s in %s\n", what, p.fen().c_str());
+        exit(1);
+    }
+}
+
+struct Sample {
+    chess::Position position;
+    chess::Move move; // a legal one
+    // what a client sent, legal or not
+    chess::Square from, to;
+    chess::PieceType promotion;
+};
+
+// up to 200 plies of random legal moves each, every position on the way
+static std::vector<Sample> random_games(int games)
+{
+    std::mt19937 rng(11);
+    std::vector<Sample> samples;
+
+    for (int g = 0; g < games; g++) {
+        chess::Position p;
+        for (int ply = 0; ply < 200; ply++) {
+            chess::MoveList moves;
+            p.legal_moves(moves);
+            if (moves.size() == 0)
+                break;
+            auto move = moves.moves[rng() % moves.size()];
+
+            // a third of what clients send is made up
+            Sample s{.position = p, .move = move};
+            bool made_up = rng() % 3 == 0;
+            s.from = made_up ? rng() % 64 : move.from();
+            s.to = made_up ? rng() % 64 : move.to();
+            s.promotion = made_up ? chess::NoPiece : move.promotion();
+            samples.push_back(s);
+
+            chess::Undo undo;
+            p.make(move, undo);
+        }
+    }
+    return samples;
+}
+
+static void check_samples(const std::vector<Sample> &samples)
+{
+    for (auto &s : samples) {
+        auto p = s.position;
+        std::string fen = p.fen();
+        uint64_t key = p.key();
+        chess::Position parsed;
+        check(parsed.set_fen(fen) && parsed.fen() == fen, "FEN round trip",
+              p);
+        check(parsed.key() == key, "key", p);
+
+        chess::MoveList moves;
+        p.legal_moves(moves);
+        for (auto move : moves) {
+            chess::Move found;
+            check(chess::parse_uci(p, chess::uci(move), found) &&
+                      found == move,
+                  "UCI round trip", p);
+            check(chess::parse_san(p, chess::san(p, move), found) &&
+                      found == move,
+                  "SAN round trip", p);
+
+            chess::Undo undo;
+            p.make(move, undo);
+            // set_fen() turns down a king left in check
+            check(parsed.set_fen(p.fen()), "make", p);
+            check(parsed.key() == p.key(), "key after make", p);
+            p.unmake(move, undo);
+            check(p.fen() == fen && p.key() == key, "unmake", p);
+        }
+
+        // exactly the legal moves are found
+        chess::Move found;
+        bool legal = false;
+        for (auto move : moves) {
+            legal |= move.from() == s.from && move.to() == s.to &&
+                     move.promotion() == s.promotion;
+        }
+        check(p.find_move(s.from, s.to, s.promotion, found) == legal,
+              "find_move", p);
+    }
+
+    // a few that random games don't get to often
+    struct {
+        const char *fen, *san, *uci;
+        bool legal;
+    } cases[] = {
+        {chess::Position::START_FEN, "Nf3", "g1f3", true},
+        {chess::Position::START_FEN, "e5", "e2e5", false},
+        {"r3k2r/8/8/8/8/8/8/R3K2R w KQkq - 0 1", "O-O-O", "e1c1", true},
+        {"r3k2r/8/8/8/8/8/8/R3K2R w KQkq - 0 1", "O-O", "e1g1", true},
+        // the king would cross f1
+        {"r3kr2/8/8/8/8/8/8/R3K2R w KQq - 0 1", "O-O", "e1g1", false},
+        {"4k3/8/8/3pP3/8/8/8/4K3 w - d6 0 2", "exd6", "e5d6", true},
+        // taking en passant would uncover the king
+        {"8/8/8/K2pP2r/8/8/8/4k3 w - d6 0 2", "exd6", "e5d6", false},
+        {"4k3/1P6/8/8/8/8/8/4K3 w - - 0 1", "b8=Q+", "b7b8q", true},
+        {"4k3/1P6/8/8/8/8/8/4K3 w - - 0 1", "b8=N", "b7b8n", true},
+        {"4k3/1P6/8/8/8/8/8/4K3 w - - 0 1", "b8", "b7b8", false},
+        {"k7/8/8/8/8/8/8/1R1R2K1 w - - 0 1", "Rdc1", "d1c1", true},
+        {"6k1/5ppp/8/8/8/8/8/R5K1 w - - 0 1", "Ra8#", "a1a8", true},
+    };
+    for (auto &c : cases) {
+        chess::Position p;
+        check(p.set_fen(c.fen), "set_fen", p);
+        chess::Move a, b;
+        bool san_ok = chess::parse_san(p, c.san, a);
+        bool uci_ok = chess::parse_uci(p, c.uci, b);
+        check(san_ok == c.legal && uci_ok == c.legal, c.san, p);
+        if (c.legal)
+            check(a == b && chess::san(p, a) == c.san, c.san, p);
+    }
+    // the "=" is often left out
+    chess::Position p;
+    chess::Move m;
+    p.set_fen("4k3/1P6/8/8/8/8/8/4K3 w - - 0 1");
+    check(chess::parse_san(p, "b8N", m) && chess::uci(m) == "b7b8n", "b8N",
+          p);
+    // either rook
+    p.set_fen("k7/8/8/8/8/8/8/1R1R2K1 w - - 0 1");
+    check(!chess::parse_san(p, "Rc1", m), "ambiguous Rc1", p);
+
+    const char *bad_fens[] = {
+        "",
+        "8/8/8/8/8/8/8/8 w - - 0 1",
+        "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR x KQkq - 0 1",
+        "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBN w KQkq - 0 1",
+        "rnbqkbnr/pppppppp/9/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+        "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq e4 0 1",
+        "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1 x",
+        // the side that just moved is in check
+        "4k3/8/8/8/8/8/8/4K2r b - - 0 1",
+        "P3k3/8/8/8/8/8/8/4K3 w - - 0 1",
+    };
+    for (auto fen : bad_fens) {
+        chess::Position p;
+        check(!p.set_fen(fen), "bad FEN accepted", p);
+        check(p.fen() == chess::Position::START_FEN, "bad FEN changed it",
+              p);
+    }
+}
+
+// plays `moves` (UCI) from `fen`, the game has to end with `result` on the
+// last one and not before
+static void check_result(const char *fen, const char *moves,
+                         chess::Result result)
+{
+    chess::Position p;
+    chess::History history;
+    check(p.set_fen(fen), "set_fen", p);
+    history.push(p);
+
+    std::string_view rest = moves;
+    auto got = chess::result(p, history);
+    while (!rest.empty()) {
+        check(got == chess::Ongoing, "game over too early", p);
+        size_t end = std::min(rest.find(' '), rest.size());
+        chess::Move move;
+        check(chess::parse_uci(p, rest.substr(0, end), move), moves, p);
+        rest.remove_prefix(std::min(end + 1, rest.size()));
+
+        chess::Undo undo;
+        p.make(move, undo);
+        history.push(p);
+        got = chess::result(p, history);
+    }
+    check(got == result, moves, p);
+}
+
+static void check_results()
+{
+    using chess::Position;
+    // the knights go out and back twice, the start is there a third time
+    check_result(Position::START_FEN,
+                 "g1f3 g8f6 f3g1 f6g8 g1f3 g8f6 f3g1 f6g8", chess::Repetition);
+    // not the same position, the first time white could castle
+    check_result("r3k3/8/8/8/8/8/8/4K2R w K - 0 1",
+                 "h1h2 a8a7 h2h1 a7a8 h1h2 a8a7 h2h1 a7a8", chess::Ongoing);
+    // but the one after the rook's first move is
+    check_result("r3k3/8/8/8/8/8/8/4K2R w K - 0 1",
+                 "h1h2 a8a7 h2h1 a7a8 h1h2 a8a7 h2h1 a7a8 h1h2",
+                 chess::Repetition);
+    // a double push nothing can take on leaves no en passant square
+    check_result(Position::START_FEN,
+                 "e2e4 g8f6 g1f3 f6g8 f3g1 g8f6 g1f3 f6g8 f3g1",
+                 chess::Repetition);
+    check_result("4k3/8/8/8/8/8/8/R3K3 w - - 99 80", "a1a2",
+                 chess::FiftyMoves);
+    // mate on the hundredth half move is still mate
+    check_result("6k1/5ppp/8/8/8/8/8/R5K1 w - - 99 80", "a1a8",
+                 chess::Checkmate);
+    check_result(Position::START_FEN, "f2f3 e7e5 g2g4 d8h4",
+                 chess::Checkmate);
+    check_result("k7/8/8/1Q6/8/8/8/4K3 w - - 0 1", "b5b6", chess::Stalemate);
+    check_result("4k3/8/8/8/8/8/3q4/4K3 w - - 0 1", "e1d2",
+                 chess::InsufficientMaterial);
+    check_result("4k3/8/8/8/8/8/3n4/2B1K3 w - - 0 1", "c1d2",
+                 chess::InsufficientMaterial);
+    // bishops on squares of both colors can mate
+    check_result("4k3/8/8/8/8/8/3r4/2B1KB2 w - - 0 1", "c1d2",
+                 chess::Ongoing);
+    check_result("4k3/8/8/8/8/8/3r4/2B1K1B1 w - - 0 1", "c1d2",
+                 chess::InsufficientMaterial);
+}
+
+template <typename F>
+static double ns_per_op(const std::vector<Sample> &samples, F f)
+{
+    // enough rounds to get past a few ms
+    size_t rounds = std::max<size_t>(1, 2000000 / samples.size());
+    volatile uint64_t sink = 0;
+
+    auto start = Clock::now();
+    for (size_t r = 0; r < rounds; r++) {
+        for (auto &s : samples) {
+            sink = sink + f(s);
+        }
+    }
+    auto elapsed = Clock::now() - start;
+
+    return std::chrono::duration<double, std::nano>(elapsed).count() /
+           (rounds * samples.size());
+}
+
+int main(int argc, char **argv)
+{
+    int games = argc > 1 ? atoi(argv[1]) : 200;
+
+    auto samples = random_games(games);
+    check_samples(samples);
+    check_results();
+    printf("checks passed, %zu positions\n", samples.size());
+
+    printf("%-38s %8.1f ns\n", "find_move (a third illegal)",
+           ns_per_op(samples, [](const Sample &s) {
+               chess::Move m;
+               return s.position.find_move(s.from, s.to, s.promotion, m);
+           }));
+    printf("%-38s %8.1f ns\n", "find_move + make (what a move costs)",
+           ns_per_op(samples, [](const Sample &s) {
+               auto p = s.position;
+               chess::Move m;
+               chess::Undo undo;
+               if (!p.find_move(s.move.from(), s.move.to(),
+                                s.move.promotion(), m))
+                   return 0;
+               p.make(m, undo);
+               return int(p.halfmove_clock());
+           }));
+    printf("%-38s %8.1f ns\n", "History::push + result",
+           ns_per_op(samples, [](const Sample &s) {
+               chess::History history;
+               history.push(s.position);
+               return int(chess::result(s.position, history));
+           }));
+    printf("%-38s %8.1f ns\n", "copying a position (in the above)",
+           ns_per_op(samples, [](const Sample &s) {
+               auto p = s.position;
+               return int(p.halfmove_clock());
+           }));
+    printf("%-38s %8.1f ns\n", "every legal move",
+           ns_per_op(samples, [](const Sample &s) {
+               chess::MoveList moves;
+               s.position.legal_moves(moves);
+               return int(moves.size());
+           }));
+    printf("%-38s %8.1f ns\n", "make + unmake",
+           ns_per_op(samples, [](const Sample &s) {
+               auto p = s.position;
+               chess::Undo undo;
+               p.make(s.move, undo);
+               p.unmake(s.move, undo);
+               return int(p.halfmove_clock());
+           }));
+
+    std::vector<std::string> sans;
+    for (auto &s : samples) {
+        sans.push_back(chess::san(s.position, s.move));
+    }
+    size_t i = 0;
+    printf("%-38s %8.1f ns\n", "parse_san",
+           ns_per_op(samples, [&](const Sample &s) {
+               chess::Move m;
+               bool ok = chess::parse_san(s.position, sans[i], m);
+               i = (i + 1) % sans.size();
+               return int(ok);
+           }));
+    return 0;
+}
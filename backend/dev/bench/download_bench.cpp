@@ -0,0 +1,182 @@
+// N concurrent clients downloading the same (large) file over and over, to
+// compare the in-memory and the sendfile paths. Start the server with
+// --sendfile-threshold=0 and with a threshold above the file size, and pass
+// its pid to also get its memory usage. Its per IP limits have to be off
+// (--no-limit), all the clients come from one address.
+//
+// usage: download_bench --path=/assets/big.wasm [--port=9034] [--clients=100]
+//                       [--seconds=5] [--pid=SERVER_PID]
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <netdb.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+static std::atomic<bool> running{true};
+static std::atomic<uint64_t> downloads{0};
+static std::atomic<uint64_t> failed{0};
+static std::atomic<uint64_t> body_bytes{0};
+
+// reads one response, counting the body without keeping it. `extra` holds
+// bytes that were read past the end of the previous response
+static bool download(int fd, std::string &extra)
+{
+    static thread_local char chunk[256 * 1024];
+    std::string head = std::move(extra);
+    extra.clear();
+
+    size_t end;
+    while ((end = head.find("\r\n\r\n")) == std::string::npos) {
+        ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+        if (n <= 0)
+            return false;
+        head.append(chunk, n);
+    }
+
+    auto cl = head.find("Content-Length: ");
+    if (cl == std::string::npos || cl > end)
+        return false;
+    size_t remaining = strtoull(head.c_str() + cl + 16, nullptr, 10);
+
+    size_t have = head.size() - (end + 4);
+    if (have > remaining) {
+        extra = head.substr(end + 4 + remaining);
+        have = remaining;
+    }
+    body_bytes += have;
+    remaining -= have;
+
+    while (remaining > 0) {
+        ssize_t n = recv(fd, chunk, std::min(remaining, sizeof(chunk)), 0);
+        if (n <= 0)
+            return false;
+        remaining -= n;
+        body_bytes += n;
+    }
+
+    return true;
+}
+
+static void client(const std::string &path, const addrinfo *addr)
+{
+    std::string request = "GET " + path + " HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    std::string extra;
+    int fd = -1;
+
+    while (running) {
+        if (fd == -1) {
+            fd = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+            if (fd == -1 || connect(fd, addr->ai_addr, addr->ai_addrlen) == -1) {
+                failed++;
+                if (fd != -1)
+                    close(fd);
+                fd = -1;
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                continue;
+            }
+            extra.clear();
+        }
+
+        if (send(fd, request.data(), request.size(), MSG_NOSIGNAL) !=
+                (ssize_t)request.size() ||
+            !download(fd, extra)) {
+            // also happens when the server hits its keep-alive request limit
+            close(fd);
+            fd = -1;
+            if (running)
+                failed++;
+            continue;
+        }
+        downloads++;
+    }
+
+    if (fd != -1)
+        close(fd);
+}
+
+// VmRSS / VmHWM from /proc/<pid>/status, in kB
+static long proc_status_kb(int pid, const char *field)
+{
+    std::ifstream status("/proc/" + std::to_string(pid) + "/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.rfind(field, 0) == 0)
+            return atol(line.c_str() + strlen(field) + 1);
+    }
+    return -1;
+}
+
+int main(int argc, char **argv)
+{
+    std::string port = "9034", path;
+    int clients = 100, seconds = 5, pid = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--port=", 7) == 0)
+            port = argv[i] + 7;
+        else if (strncmp(argv[i], "--path=", 7) == 0)
+            path = argv[i] + 7;
+        else if (strncmp(argv[i], "--clients=", 10) == 0)
+            clients = atoi(argv[i] + 10);
+        else if (strncmp(argv[i], "--seconds=", 10) == 0)
+            seconds = atoi(argv[i] + 10);
+        else if (strncmp(argv[i], "--pid=", 6) == 0)
+            pid = atoi(argv[i] + 6);
+        else {
+            path.clear();
+            break;
+        }
+    }
+
+    if (path.empty()) {
+        fprintf(stderr,
+                "usage: %s --path=/assets/big.wasm [--port=9034] "
+                "[--clients=100] [--seconds=5] [--pid=SERVER_PID]\n",
+                argv[0]);
+        return 1;
+    }
+
+    addrinfo hints = {}, *addr;
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo("127.0.0.1", port.c_str(), &hints, &addr) != 0) {
+        perror("getaddrinfo");
+        return 1;
+    }
+
+    long rss_before = pid ? proc_status_kb(pid, "VmRSS:") : -1;
+    long rss_peak = rss_before;
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < clients; i++) {
+        threads.emplace_back(client, std::cref(path), addr);
+    }
+
+    for (int s = 0; s < seconds * 10; s++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        if (pid)
+            rss_peak = std::max(rss_peak, proc_status_kb(pid, "VmRSS:"));
+    }
+    running = false;
+    // each client finishes the download it is in the middle of
+    for (auto &t : threads) {
+        t.join();
+    }
+    freeaddrinfo(addr);
+
+    printf("%d clients: %llu downloads, %llu failed, %.1f MB/s\n", clients,
+           (unsigned long long)downloads.load(),
+           (unsigned long long)failed.load(),
+           body_bytes.load() / (double)seconds / 1e6);
+    if (pid) {
+        printf("server RSS: %ld kB before, %ld kB peak during the run\n",
+               rss_before, rss_peak);
+    }
+}
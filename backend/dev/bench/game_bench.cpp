@@ -0,0 +1,699 @@
+// Game server load test: N games at once, two websocket players each.
+//
+// Every game is set up through the server (white creates, black joins with
+// the code it got back), which gives games/sec. Then the games play: white
+// moves every --interval-ms, black answers as soon as the move arrives, and
+// the time from a move being written to it reaching the opponent is the move
+// latency. Both players of a game live in the same worker process, so both
+// ends of that measurement read the same clock.
+//
+// --spectators=N adds N spectators per worker, spread over its first
+// --watched games, and measures how long moves take to reach them too.
+// --slow=M of them never read: the server has to shed them (skip moves,
+// resync them, eventually drop them) without the others noticing. What the
+// server's fan-out did is printed from its stats page at the end, start the
+// server with --stats=/_stats for it.
+//
+// --clock=300+2 plays the games with clocks (base + increment in seconds).
+// The server has to keep them and watch for flags: a game whose player runs
+// out of time stops there, the flags are counted.
+//
+// Games that end on the board stop too: mate, or a draw the server calls
+// (threefold repetition, fifty moves, not enough to mate with), which
+// random moves get to often. The players see it coming with the same rules,
+// the server's End messages are counted.
+//
+// Each worker process holds games/procs games, the open file limit is per
+// process and every player is a socket. All of them connect from one
+// address, start the server with --no-limit.
+//
+// usage: game_bench [--port=9034] [--games=1000] [--procs=1]
+//                   [--seconds=10] [--interval-ms=1000]
+//                   [--encoding=binary|json] [--spectators=0] [--watched=1]
+//                   [--slow=0] [--clock=300+2]
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <random>
+#include <string>
+#include <vector>
+#include <netdb.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <nlohmann/json.hpp>
+#include "src/protocol.h"
+#include "src/utils.h"
+#include "src/chess/history.h"
+#include "src/chess/position.h"
+
+using Clock = std::chrono::steady_clock;
+using json = nlohmann::json;
+
+struct Options {
+    std::string port = "9034";
+    int games = 1000;
+    int procs = 1;
+    int seconds = 10;
+    int interval_ms = 1000;
+    proto::Encoding encoding = proto::Encoding::Binary;
+    int spectators = 0; // per worker
+    int watched = 1;
+    int slow = 0;
+    proto::TimeControl clock; // none
+};
+
+// what a worker reports back, in memory shared with the parent
+static const size_t MAX_SAMPLES = 4 << 20;
+
+struct Report {
+    int games_ready;
+    double setup_seconds;
+    uint64_t moves;
+    uint64_t errors;
+    uint64_t flags;
+    uint64_t ended; // on the board
+    size_t samples;
+    uint32_t latency_us[MAX_SAMPLES];
+    // moves reaching spectators, and the snapshots that replaced the ones
+    // they missed
+    uint64_t resyncs;
+    size_t spectator_samples;
+    uint32_t spectator_latency_us[MAX_SAMPLES];
+};
+
+static int64_t now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               Clock::now().time_since_epoch())
+        .count();
+}
+
+struct Player {
+    int fd;
+    int game;
+    proto::Color color;
+    std::string in;
+    bool spectator = false;
+    int seen = 0;      // spectators: moves of the game so far
+    int snapshots = 0; // spectators: Snapshot messages
+};
+
+// how far back a spectator's latency can be looked up
+static const int PLIES_KEPT = 256;
+
+struct Game {
+    proto::GameCode code = 0;
+    int joined = 0;        // Joined messages seen, 2 = on
+    int64_t move_sent = 0; // when the move in flight was written
+    int ply = 0;
+    chess::Position position;        // the server checks every move
+    chess::History history;           // and ends the game like this does
+    int64_t sent_at[PLIES_KEPT] = {}; // when each move was written, by ply
+    std::vector<int> spectators;      // indexes into Worker::players
+};
+
+class Worker {
+    const Options &opt;
+    int epfd;
+    // 2 per game (white, black), then the spectators
+    std::vector<Player> players;
+    std::vector<Game> games;
+    std::deque<std::pair<int64_t, int>> due; // (when, game), in time order
+    Report *report;
+    std::mt19937 rng;
+    int ready = 0;
+    int64_t setup_start = 0;
+
+    bool send_message(Player &p, const proto::ClientMessage &msg);
+    void handle(Player &p, std::string_view payload);
+    bool read(Player &p);
+    void move(int game);
+
+  public:
+    Worker(const Options &opt, Report *report)
+        : opt(opt), report(report), rng(getpid())
+    {
+    }
+    bool connect_all(const addrinfo *addr, int games);
+    void run();
+};
+
+// blocking connect and handshake, the socket goes non-blocking afterwards.
+// A small receive buffer makes a client that doesn't read back up quickly
+static int open_player(const addrinfo *addr, proto::Encoding encoding,
+                       int rcvbuf = 0)
+{
+    int fd = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+    if (fd == -1)
+        return -1;
+    if (rcvbuf > 0)
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    if (connect(fd, addr->ai_addr, addr->ai_addrlen) == -1) {
+        close(fd);
+        return -1;
+    }
+
+    int yes = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+
+    std::string req = "GET /ws HTTP/1.1\r\n"
+                      "Host: localhost\r\n"
+                      "Upgrade: websocket\r\n"
+                      "Connection: Upgrade\r\n"
+                      "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+                      "Sec-WebSocket-Version: 13\r\n"
+                      "Sec-WebSocket-Protocol: ";
+    req += encoding == proto::Encoding::Binary ? proto::BINARY_PROTOCOL
+                                               : proto::JSON_PROTOCOL;
+    req += "\r\n\r\n";
+
+    if (send(fd, req.data(), req.size(), 0) != ssize_t(req.size())) {
+        close(fd);
+        return -1;
+    }
+
+    // the server doesn't say anything until we do, so the response is all
+    // there is to read
+    std::string res;
+    char buf[1024];
+    while (res.find("\r\n\r\n") == std::string::npos) {
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        if (n <= 0) {
+            close(fd);
+            return -1;
+        }
+        res.append(buf, n);
+    }
+    if (res.compare(0, 12, "HTTP/1.1 101") != 0) {
+        close(fd);
+        return -1;
+    }
+
+    utils::set_nonblocking(fd);
+    return fd;
+}
+
+bool Worker::connect_all(const addrinfo *addr, int games)
+{
+    this->epfd = epoll_create1(0);
+    this->games.resize(games);
+    for (auto &g : this->games) {
+        g.history.push(g.position);
+    }
+
+    for (int i = 0; i < 2 * games; i++) {
+        int fd = open_player(addr, this->opt.encoding);
+        if (fd == -1) {
+            fprintf(stderr, "unable to connect player %d\n", i);
+            return false;
+        }
+
+        this->players.push_back(Player{
+            .fd = fd,
+            .game = i / 2,
+            .color = i % 2 ? proto::Color::Black : proto::Color::White,
+        });
+
+        epoll_event ev = {};
+        ev.events = EPOLLIN;
+        ev.data.u32 = i;
+        epoll_ctl(this->epfd, EPOLL_CTL_ADD, fd, &ev);
+    }
+
+    int watched = std::clamp(this->opt.watched, 1, games);
+    for (int i = 0; i < this->opt.spectators; i++) {
+        bool slow = i < this->opt.slow;
+        int fd = open_player(addr, this->opt.encoding, slow ? 4096 : 0);
+        if (fd == -1) {
+            fprintf(stderr, "unable to connect spectator %d\n", i);
+            return false;
+        }
+
+        int index = this->players.size();
+        this->players.push_back(
+            Player{.fd = fd, .game = i % watched, .spectator = true});
+        this->games[i % watched].spectators.push_back(index);
+
+        // the slow ones are never read
+        if (slow)
+            continue;
+        epoll_event ev = {};
+        ev.events = EPOLLIN;
+        ev.data.u32 = index;
+        epoll_ctl(this->epfd, EPOLL_CTL_ADD, fd, &ev);
+    }
+    return true;
+}
+
+// one masked frame (with an all zero key, it's a benchmark), small enough
+// to always fit in the socket buffer
+bool Worker::send_message(Player &p, const proto::ClientMessage &msg)
+{
+    std::string payload = this->opt.encoding == proto::Encoding::Binary
+                              ? proto::encode_binary(msg)
+                              : proto::encode_json(msg);
+    auto opcode = this->opt.encoding == proto::Encoding::Binary ? 0x2 : 0x1;
+
+    std::string frame = {char(0x80 | opcode), char(0x80 | payload.size()),
+                         0, 0, 0, 0};
+    frame += payload;
+
+    return send(p.fd, frame.data(), frame.size(), MSG_NOSIGNAL) ==
+           ssize_t(frame.size());
+}
+
+void Worker::move(int game)
+{
+    auto &g = this->games[game];
+    auto &p = this->players[2 * game + g.ply % 2];
+
+    // random legal moves until the game is over
+    if (chess::result(g.position, g.history) != chess::Ongoing)
+        return;
+    chess::MoveList moves;
+    g.position.legal_moves(moves);
+    auto move = moves.moves[this->rng() % moves.size()];
+    chess::Undo undo;
+    g.position.make(move, undo);
+    g.history.push(g.position);
+
+    proto::ClientMessage msg;
+    msg.type = proto::Type::Move;
+    // promotions are numbered the same
+    auto promo = move.is_promotion() ? proto::Promotion(move.promotion())
+                                     : proto::Promotion::None;
+    msg.move = {.from = uint8_t(move.from()),
+                .to = uint8_t(move.to()),
+                .promo = promo};
+
+    g.move_sent = now_ns();
+    g.sent_at[g.ply % PLIES_KEPT] = g.move_sent;
+    g.ply++;
+    if (!this->send_message(p, msg))
+        this->report->errors++;
+}
+
+void Worker::handle(Player &p, std::string_view payload)
+{
+    proto::Event event;
+    proto::GameCode code = 0;
+    uint64_t seq = 0; // of a Move, or the moves in a Snapshot
+
+    // the bench's side of decoding isn't what's measured, JSON goes through
+    // nlohmann
+    if (this->opt.encoding == proto::Encoding::Binary) {
+        if (payload.empty())
+            return;
+        event = static_cast<proto::Event>(payload[0]);
+        auto rest = payload.substr(1);
+        if (event == proto::Event::Created ||
+            event == proto::Event::Snapshot)
+            proto::get_varint(rest, code);
+        if (event == proto::Event::Snapshot)
+            proto::get_varint(rest, seq);
+        if (event == proto::Event::Move && rest.size() > 2) {
+            rest.remove_prefix(2);
+            proto::get_varint(rest, seq);
+        }
+    }
+    else {
+        json j = json::parse(payload, nullptr, false);
+        event = static_cast<proto::Event>(j.value("type", 6));
+        if (event == proto::Event::Created)
+            proto::parse_game_code(j.value("payload", ""), code);
+        if (event == proto::Event::Snapshot || event == proto::Event::Move)
+            seq = j.value("seq", 0);
+    }
+
+    auto &g = this->games[p.game];
+
+    if (p.spectator) {
+        auto r = this->report;
+        if (event == proto::Event::Snapshot) {
+            // the first one is the game so far, later ones replace moves
+            // that were skipped
+            if (p.snapshots++ > 0)
+                r->resyncs++;
+            p.seen = seq;
+        }
+        else if (event == proto::Event::Move) {
+            // every move, once and in order
+            if (seq != uint64_t(p.seen) + 1)
+                r->errors++;
+            // moves older than what's kept don't get a sample
+            if (g.ply - p.seen < PLIES_KEPT &&
+                r->spectator_samples < MAX_SAMPLES) {
+                auto us = (now_ns() - g.sent_at[p.seen % PLIES_KEPT]) / 1000;
+                r->spectator_latency_us[r->spectator_samples++] = us;
+            }
+            p.seen++;
+        }
+        else if (event == proto::Event::Error) {
+            r->errors++;
+        }
+        return;
+    }
+
+    switch (event) {
+    case proto::Event::Created: {
+        g.code = code;
+        proto::ClientMessage join;
+        join.type = proto::Type::Join;
+        join.game = code;
+        if (!this->send_message(this->players[2 * p.game + 1], join))
+            this->report->errors++;
+
+        proto::ClientMessage spectate;
+        spectate.type = proto::Type::Spectate;
+        spectate.game = code;
+        for (int s : g.spectators) {
+            if (!this->send_message(this->players[s], spectate))
+                this->report->errors++;
+        }
+        break;
+    }
+
+    case proto::Event::Joined:
+        // both players hear it, the game is on after the second
+        if (++g.joined == 2 && ++this->ready == int(this->games.size())) {
+            auto now = now_ns();
+            this->report->setup_seconds = (now - this->setup_start) / 1e9;
+
+            // spread the first moves over one interval
+            std::vector<std::pair<int64_t, int>> start;
+            for (int i = 0; i < int(this->games.size()); i++) {
+                int64_t ms = this->rng() % this->opt.interval_ms;
+                start.push_back({now + ms * 1000000, i});
+            }
+            std::sort(start.begin(), start.end());
+            this->due.assign(start.begin(), start.end());
+        }
+        break;
+
+    case proto::Event::Move: {
+        auto us = (now_ns() - g.move_sent) / 1000;
+        auto r = this->report;
+        if (r->samples < MAX_SAMPLES)
+            r->latency_us[r->samples++] = us;
+        r->moves++;
+
+        // black answers right away, white waits for its next turn
+        if (p.color == proto::Color::Black) {
+            this->move(p.game);
+        }
+        else {
+            this->due.push_back(
+                {now_ns() + int64_t(this->opt.interval_ms) * 1000000, p.game});
+        }
+        break;
+    }
+
+    case proto::Event::Flag:
+        // both players hear it, count it once
+        if (p.color == proto::Color::White)
+            this->report->flags++;
+        break;
+
+    case proto::Event::End:
+        if (p.color == proto::Color::White)
+            this->report->ended++;
+        break;
+
+    default:
+        this->report->errors++;
+        break;
+    }
+}
+
+// false once the server closed the connection
+bool Worker::read(Player &p)
+{
+    char buf[16384];
+
+    while (true) {
+        ssize_t n = recv(p.fd, buf, sizeof(buf), 0);
+        if (n == 0)
+            return false;
+        if (n == -1)
+            break;
+        p.in.append(buf, n);
+    }
+
+    // server frames: unmasked, never fragmented here
+    size_t pos = 0;
+    while (p.in.size() - pos >= 2) {
+        auto h = reinterpret_cast<const unsigned char *>(p.in.data() + pos);
+        size_t len = h[1] & 0x7F, header = 2;
+        if (len == 126) {
+            if (p.in.size() - pos < 4)
+                break;
+            len = (h[2] << 8) | h[3];
+            header = 4;
+        }
+        if (p.in.size() - pos < header + len)
+            break;
+
+        // the server pings whoever has been quiet, spectators always are
+        if ((h[0] & 0x0F) == 0x9) {
+            const char pong[] = {char(0x8A), char(0x80), 0, 0, 0, 0};
+            send(p.fd, pong, sizeof(pong), MSG_NOSIGNAL);
+        }
+        else {
+            this->handle(p, std::string_view(p.in).substr(pos + header, len));
+        }
+        pos += header + len;
+    }
+    p.in.erase(0, pos);
+    return true;
+}
+
+void Worker::run()
+{
+    this->setup_start = now_ns();
+    for (int i = 0; i < int(this->games.size()); i++) {
+        proto::ClientMessage create;
+        create.type = proto::Type::Create;
+        create.time_control = this->opt.clock;
+        if (!this->send_message(this->players[2 * i], create))
+            this->report->errors++;
+    }
+
+    int64_t end = 0;
+    epoll_event events[256];
+
+    while (end == 0 || now_ns() < end) {
+        if (end == 0 && !this->due.empty()) {
+            end = now_ns() + int64_t(this->opt.seconds) * 1000000000;
+        }
+
+        int timeout = 100;
+        if (!this->due.empty()) {
+            timeout = std::clamp<int64_t>(
+                (this->due.front().first - now_ns()) / 1000000, 0, 100);
+        }
+
+        int n = epoll_wait(this->epfd, events, 256, timeout);
+        for (int i = 0; i < n; i++) {
+            auto &p = this->players[events[i].data.u32];
+            if (!this->read(p)) {
+                fprintf(stderr, "server closed a connection\n");
+                return;
+            }
+        }
+
+        auto now = now_ns();
+        while (!this->due.empty() && this->due.front().first <= now) {
+            int game = this->due.front().second;
+            this->due.pop_front();
+            this->move(game);
+        }
+    }
+
+    this->report->games_ready = this->ready;
+}
+
+// the body of the server's stats page
+static std::string fetch_stats(const addrinfo *addr)
+{
+    int fd = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+    if (fd == -1 || connect(fd, addr->ai_addr, addr->ai_addrlen) == -1)
+        return "unavailable";
+
+    std::string req = "GET /_stats HTTP/1.1\r\n"
+                      "Host: localhost\r\n"
+                      "Connection: close\r\n\r\n";
+    send(fd, req.data(), req.size(), 0);
+
+    std::string res;
+    char buf[4096];
+    ssize_t n;
+    while ((n = recv(fd, buf, sizeof(buf), 0)) > 0)
+        res.append(buf, n);
+    close(fd);
+
+    auto body = res.find("\r\n\r\n");
+    return body == std::string::npos ? "unavailable" : res.substr(body + 4);
+}
+
+static double percentile(std::vector<uint32_t> &v, double p)
+{
+    if (v.empty())
+        return 0;
+    size_t i = std::min(v.size() - 1, size_t(p * v.size()));
+    std::nth_element(v.begin(), v.begin() + i, v.end());
+    return v[i];
+}
+
+int main(int argc, char **argv)
+{
+    Options opt;
+
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--port=", 7) == 0) {
+            opt.port = argv[i] + 7;
+        }
+        else if (strncmp(argv[i], "--games=", 8) == 0) {
+            opt.games = atoi(argv[i] + 8);
+        }
+        else if (strncmp(argv[i], "--procs=", 8) == 0) {
+            opt.procs = std::max(1, atoi(argv[i] + 8));
+        }
+        else if (strncmp(argv[i], "--seconds=", 10) == 0) {
+            opt.seconds = atoi(argv[i] + 10);
+        }
+        else if (strncmp(argv[i], "--interval-ms=", 14) == 0) {
+            opt.interval_ms = std::max(1, atoi(argv[i] + 14));
+        }
+        else if (strcmp(argv[i], "--encoding=json") == 0) {
+            opt.encoding = proto::Encoding::Json;
+        }
+        else if (strcmp(argv[i], "--encoding=binary") == 0) {
+            opt.encoding = proto::Encoding::Binary;
+        }
+        else if (strncmp(argv[i], "--spectators=", 13) == 0) {
+            opt.spectators = atoi(argv[i] + 13);
+        }
+        else if (strncmp(argv[i], "--watched=", 10) == 0) {
+            opt.watched = atoi(argv[i] + 10);
+        }
+        else if (strncmp(argv[i], "--slow=", 7) == 0) {
+            opt.slow = atoi(argv[i] + 7);
+        }
+        else if (strncmp(argv[i], "--clock=", 8) == 0) {
+            if (!proto::parse_time_control(argv[i] + 8, opt.clock)) {
+                fprintf(stderr, "bad time control: %s\n", argv[i] + 8);
+                return 1;
+            }
+        }
+        else {
+            fprintf(stderr,
+                    "usage: %s [--port=9034] [--games=1000] [--procs=1] "
+                    "[--seconds=10] [--interval-ms=1000] "
+                    "[--encoding=binary|json] [--spectators=0] "
+                    "[--watched=1] [--slow=0] [--clock=300+2]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+
+    addrinfo hints = {}, *addr;
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo("127.0.0.1", opt.port.c_str(), &hints, &addr) != 0) {
+        fprintf(stderr, "getaddrinfo failed\n");
+        return 1;
+    }
+
+    auto reports = static_cast<Report *>(
+        mmap(nullptr, sizeof(Report) * opt.procs, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_ANONYMOUS, -1, 0));
+    if (reports == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+
+    printf("%d games (%d players) in %d process%s, a move every %d ms per "
+           "game, %s\n",
+           opt.games, 2 * opt.games, opt.procs, opt.procs > 1 ? "es" : "",
+           opt.interval_ms,
+           opt.encoding == proto::Encoding::Binary ? "binary" : "json");
+
+    for (int w = 0; w < opt.procs; w++) {
+        if (fork() == 0) {
+            int games = opt.games / opt.procs + (w < opt.games % opt.procs);
+            Worker worker(opt, &reports[w]);
+            if (!worker.connect_all(addr, games))
+                _exit(1);
+            worker.run();
+            _exit(0);
+        }
+    }
+
+    bool ok = true;
+    for (int w = 0; w < opt.procs; w++) {
+        int status;
+        wait(&status);
+        ok = ok && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    }
+    if (!ok) {
+        fprintf(stderr, "a worker failed\n");
+        return 1;
+    }
+
+    int ready = 0;
+    double setup = 0;
+    uint64_t moves = 0, errors = 0, resyncs = 0, flags = 0, ended = 0;
+    std::vector<uint32_t> latency, spectator_latency;
+    for (int w = 0; w < opt.procs; w++) {
+        auto &r = reports[w];
+        ready += r.games_ready;
+        setup = std::max(setup, r.setup_seconds);
+        moves += r.moves;
+        errors += r.errors;
+        flags += r.flags;
+        ended += r.ended;
+        resyncs += r.resyncs;
+        latency.insert(latency.end(), r.latency_us, r.latency_us + r.samples);
+        spectator_latency.insert(spectator_latency.end(),
+                                 r.spectator_latency_us,
+                                 r.spectator_latency_us + r.spectator_samples);
+    }
+
+    printf("games set up: %d in %.3f s, %.0f games/s\n", ready, setup,
+           ready / setup);
+    printf("moves:        %lu, %.0f moves/s, %lu errors\n", moves,
+           double(moves) / opt.seconds, errors);
+    printf("games over:   %lu, mate or a draw by the rules\n", ended);
+    if (opt.clock.base_ms > 0) {
+        printf("clocks:       %s, %lu flags\n",
+               proto::time_control_str(opt.clock).c_str(), flags);
+    }
+    printf("move latency: p50 %.0f us, p99 %.0f us, p99.9 %.0f us, max %.0f "
+           "us\n",
+           percentile(latency, 0.5), percentile(latency, 0.99),
+           percentile(latency, 0.999), percentile(latency, 1.0));
+
+    if (opt.spectators > 0) {
+        printf("spectators:   %d per process, %zu moves received, %lu "
+               "resyncs\n",
+               opt.spectators, spectator_latency.size(), resyncs);
+        printf("spectator latency: p50 %.0f us, p99 %.0f us, p99.9 %.0f us, "
+               "max %.0f us\n",
+               percentile(spectator_latency, 0.5),
+               percentile(spectator_latency, 0.99),
+               percentile(spectator_latency, 0.999),
+               percentile(spectator_latency, 1.0));
+        printf("server: %s\n", fetch_stats(addr).c_str());
+    }
+
+    freeaddrinfo(addr);
+    return 0;
+}
@@ -0,0 +1,124 @@
+// Game rooms: first checks who gets a seat (a seat left in the middle of a
+// game goes to whoever joins next, a game that's over takes nobody), then
+// times what a game costs under the lock: create, join, a few moves, both
+// players leaving.
+//
+// usage: games_bench [--check-only]
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include "src/games.h"
+
+using Clock = std::chrono::steady_clock;
+using proto::Color;
+using proto::Error;
+
+static PlayerRef player(uint32_t index)
+{
+    return PlayerRef{.reactor = 0, .conn = SlabId{.index = index}};
+}
+
+// squares are numbered a1 = 0, b1 = 1 .. h8 = 63
+static Error play(Games &games, proto::GameCode code, Color color,
+                  uint8_t from, uint8_t to, proto::Result &result)
+{
+    PlayerRef opponent;
+    std::vector<int> watchers;
+    uint64_t seq;
+    GameClock clock;
+    return games.move(code, color, proto::Move{.from = from, .to = to}, 0, 0,
+                      opponent, watchers, seq, clock, result);
+}
+
+static bool check()
+{
+    bool ok = true;
+    auto expect = [&ok](bool cond, const char *what) {
+        if (!cond) {
+            printf("WRONG: %s\n", what);
+            ok = false;
+        }
+    };
+
+    Games games(10, 10);
+    proto::GameCode code;
+    Color color;
+    PlayerRef opponent;
+    std::vector<int> watchers;
+    Catchup catchup;
+    proto::Result result;
+
+    games.create(player(1), {}, code);
+    expect(games.join(code, player(2), color, opponent, watchers,
+                      proto::Encoding::Json, 0, catchup) == Error::None &&
+               color == Color::Black && opponent.conn.index == 1,
+           "joining a new game");
+    expect(games.join(code, player(3), color, opponent, watchers,
+                      proto::Encoding::Json, 0, catchup) == Error::GameFull,
+           "joining a full game");
+
+    // black drops out after 1. f3, whoever joins next takes over
+    play(games, code, Color::White, 13, 21, result);
+    games.leave(code, Color::Black, opponent, watchers);
+    expect(games.join(code, player(4), color, opponent, watchers,
+                      proto::Encoding::Json, 0, catchup) == Error::None &&
+               color == Color::Black && opponent.conn.index == 1 &&
+               catchup.snapshot,
+           "taking a seat left in the middle of a game");
+
+    // 1. f3 e5 2. g4 Qh4#, white walks away from the board
+    play(games, code, Color::Black, 52, 36, result);
+    play(games, code, Color::White, 14, 30, result);
+    expect(play(games, code, Color::Black, 59, 31, result) == Error::None &&
+               result == proto::Result::Checkmate,
+           "fool's mate ending the game");
+    games.leave(code, Color::White, opponent, watchers);
+    expect(games.join(code, player(5), color, opponent, watchers,
+                      proto::Encoding::Json, 0, catchup) == Error::GameOver,
+           "taking a seat in a game that's over");
+    return ok;
+}
+
+int main(int argc, char **argv)
+{
+    bool check_only = argc > 1 && strcmp(argv[1], "--check-only") == 0;
+
+    if (!check()) {
+        return 1;
+    }
+    printf("checks passed\n");
+    if (check_only) {
+        return 0;
+    }
+
+    Games games(SIZE_MAX, SIZE_MAX);
+    std::vector<int> watchers;
+    size_t rounds = 200000;
+
+    auto start = Clock::now();
+    for (size_t i = 0; i < rounds; i++) {
+        proto::GameCode code;
+        Color color;
+        PlayerRef opponent;
+        Catchup catchup;
+        proto::Result result;
+
+        games.create(player(1), {}, code);
+        games.join(code, player(2), color, opponent, watchers,
+                   proto::Encoding::Json, 0, catchup);
+        // 1. e4 e5 2. Nf3 Nc6
+        play(games, code, Color::White, 12, 28, result);
+        play(games, code, Color::Black, 52, 36, result);
+        play(games, code, Color::White, 6, 21, result);
+        play(games, code, Color::Black, 57, 42, result);
+        games.leave(code, Color::White, opponent, watchers);
+        games.leave(code, Color::Black, opponent, watchers);
+    }
+    double elapsed =
+        std::chrono::duration<double>(Clock::now() - start).count();
+
+    printf("a game of 4 moves: %.2f us, %zu rooms left\n",
+           elapsed * 1e6 / rounds, games.size());
+    return 0;
+}
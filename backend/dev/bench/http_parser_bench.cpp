@@ -0,0 +1,143 @@
+// HTTP request parsing: first checks what the parser turns down (and with
+// which status) on requests built to get past it, and that a request fed a
+// byte at a time parses like one that arrived whole, then times it on a
+// typical browser request.
+//
+// usage: http_parser_bench [--check-only]
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include "src/http_parser.h"
+
+using Clock = std::chrono::steady_clock;
+
+// what parse() says once everything has arrived, with the error status
+static HttpParser::Status parse(const std::string &data, int &error)
+{
+    HttpParser parser;
+    http_request req;
+    auto status = parser.parse(data.data(), data.size(), req);
+    error = parser.error();
+    return status;
+}
+
+static const char BROWSER_REQUEST[] =
+    "GET /assets/index-4f2a9c.js HTTP/1.1\r\n"
+    "Host: localhost:9034\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:131.0) Gecko/20100101 "
+    "Firefox/131.0\r\n"
+    "Accept: */*\r\n"
+    "Accept-Language: en-US,en;q=0.5\r\n"
+    "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+    "Connection: keep-alive\r\n"
+    "Referer: http://localhost:9034/\r\n"
+    "If-None-Match: \"5e1a-18f2c3d4e5f\"\r\n"
+    "\r\n";
+
+static bool check()
+{
+    using Status = HttpParser::Status;
+    bool ok = true;
+
+    struct {
+        const char *what;
+        std::string request;
+        Status status;
+        int error; // with Status::Error
+    } cases[] = {
+        {"a GET", BROWSER_REQUEST, Status::Complete, 0},
+        {"a body",
+         "POST / HTTP/1.1\r\nContent-Length: 5\r\n\r\nhello",
+         Status::Complete, 0},
+        {"a body still on its way",
+         "POST / HTTP/1.1\r\nContent-Length: 6\r\n\r\nhello",
+         Status::Incomplete, 0},
+        // body_start + this would wrap around and pass the size check
+        {"Content-Length near SIZE_MAX",
+         "POST / HTTP/1.1\r\nContent-Length: 18446744073709551615\r\n\r\n",
+         Status::Error, 413},
+        {"Content-Length past SIZE_MAX",
+         "POST / HTTP/1.1\r\nContent-Length: 99999999999999999999\r\n\r\n",
+         Status::Error, 400},
+        {"a body bigger than allowed",
+         "POST / HTTP/1.1\r\nContent-Length: 16384\r\n\r\n", Status::Error,
+         413},
+        {"two Content-Lengths that agree",
+         "POST / HTTP/1.1\r\nContent-Length: 5\r\nContent-Length: 5\r\n\r\n"
+         "hello",
+         Status::Complete, 0},
+        {"two Content-Lengths that don't",
+         "POST / HTTP/1.1\r\nContent-Length: 5\r\nContent-Length: 0\r\n\r\n"
+         "hello",
+         Status::Error, 400},
+        {"a chunked body",
+         "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n",
+         Status::Error, 501},
+        {"a folded header", "GET / HTTP/1.1\r\nA: b\r\n c\r\n\r\n",
+         Status::Error, 400},
+        {"no version", "GET /\r\n\r\n", Status::Error, 400},
+    };
+    for (auto &c : cases) {
+        int error;
+        auto status = parse(c.request, error);
+        if (status != c.status ||
+            (status == Status::Error && error != c.error)) {
+            printf("WRONG: %s (status %d, error %d)\n", c.what, int(status),
+                   error);
+            ok = false;
+        }
+    }
+
+    // a byte at a time, handed everything so far each time like the
+    // reactor does
+    std::string request = BROWSER_REQUEST;
+    HttpParser parser;
+    http_request req;
+    for (size_t len = 1; len <= request.size(); len++) {
+        auto status = parser.parse(request.data(), len, req);
+        if (status != (len < request.size() ? Status::Incomplete
+                                            : Status::Complete)) {
+            printf("WRONG: split after %zu bytes\n", len);
+            ok = false;
+            break;
+        }
+    }
+    if (req.path != "/assets/index-4f2a9c.js" || req.header_count != 8 ||
+        req.header("accept-encoding") != "gzip, deflate, br, zstd") {
+        printf("WRONG: the request parsed a byte at a time\n");
+        ok = false;
+    }
+    return ok;
+}
+
+int main(int argc, char **argv)
+{
+    bool check_only = argc > 1 && strcmp(argv[1], "--check-only") == 0;
+
+    if (!check()) {
+        return 1;
+    }
+    printf("checks passed\n");
+    if (check_only) {
+        return 0;
+    }
+
+    HttpParser parser;
+    http_request req;
+    size_t len = strlen(BROWSER_REQUEST), rounds = 2000000, parsed = 0;
+
+    auto start = Clock::now();
+    for (size_t i = 0; i < rounds; i++) {
+        parser.reset();
+        parsed += parser.parse(BROWSER_REQUEST, len, req) ==
+                  HttpParser::Status::Complete;
+    }
+    double elapsed =
+        std::chrono::duration<double>(Clock::now() - start).count();
+
+    printf("%zu byte request: %.1f ns, %.2f GB/s%s\n", len,
+           elapsed * 1e9 / rounds, len * rounds / elapsed / 1e9,
+           parsed == rounds ? "" : "  (FAILED)");
+    return 0;
+}
@@ -0,0 +1,353 @@
+// Per IP limiter: correctness checks on a virtual clock, then the cost of a
+// connect/message check, from one thread and from several hammering it at
+// once (the reactors share one Limiter).
+//
+// --flood runs against a server (started *with* its limits): --attackers
+// source addresses 127.0.1.x reconnect as fast as they can, while one
+// well-behaved client from 127.0.0.2 keeps requesting --path over a
+// keep-alive connection. It prints how many of the attackers' connections
+// got an answer, and the latency the legitimate client saw.
+//
+// usage: limit_bench [--threads=4] [--ips=100000]
+//        limit_bench --flood [--port=9034] [--attackers=16] [--seconds=5]
+//                    [--path=/]
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "src/limiter.h"
+
+using Clock = std::chrono::steady_clock;
+
+static void check(bool ok, const char *what)
+{
+    if (!ok) {
+        fprintf(stderr, "limiter: %s\n", what);
+        exit(1);
+    }
+}
+
+static uint32_t ip(int a, int b, int c, int d)
+{
+    return htonl(a << 24 | b << 16 | c << 8 | d);
+}
+
+static void check_limits()
+{
+    Limits limits{.connections = 3,
+                  .connect_rate = 2,
+                  .connect_burst = 4,
+                  .message_rate = 10,
+                  .message_burst = 5,
+                  .ban_ms = 1000};
+    int64_t now = 1000000;
+
+    {
+        // the 4th connection at once bans, for ban_ms, whatever it does
+        Limiter limiter(limits);
+        auto a = ip(10, 0, 0, 1);
+        for (int i = 0; i < 3; i++) {
+            check(limiter.connect(a, now), "connection under the limit");
+        }
+        check(!limiter.connect(a, now), "connection over the limit");
+        check(limiter.banned(a, now), "not banned over the limit");
+        limiter.disconnect(a);
+        check(!limiter.connect(a, now + 999), "banned IP connected");
+        check(!limiter.message(a, now + 999), "banned IP sent a message");
+        check(limiter.connect(a, now + 1000), "ban didn't end");
+        check(!limiter.banned(ip(10, 0, 0, 2), now), "stranger banned");
+    }
+
+    {
+        // reconnecting: a burst of 4, then 2 a second, refused but no ban
+        Limiter limiter(limits);
+        auto a = ip(10, 0, 0, 1);
+        int accepted = 0;
+        for (int64_t t = now; t < now + 10000; t += 10) {
+            if (limiter.connect(a, t)) {
+                accepted++;
+                limiter.disconnect(a);
+            }
+        }
+        check(accepted >= 4 + 19 && accepted <= 4 + 20, "connect rate");
+        check(!limiter.banned(a, now + 10000), "connect rate banned");
+        check(limiter.rejected_connections > 0, "nothing rejected");
+    }
+
+    {
+        // messages: a burst of 5, 10 a second after that, faster bans
+        Limiter limiter(limits);
+        auto a = ip(10, 0, 0, 1);
+        check(limiter.connect(a, now), "connect");
+        for (int i = 0; i < 5; i++) {
+            check(limiter.message(a, now), "message in the burst");
+        }
+        check(!limiter.message(a, now), "message over the burst");
+        check(limiter.banned(a, now), "message flood not banned");
+        check(!limiter.connect(a, now + 500), "banned IP connected");
+
+        int64_t t = now + 1000;
+        for (int i = 0; i < 100; i++, t += 100) {
+            check(limiter.message(a, t), "message at the rate");
+        }
+        check(limiter.bans == 1, "bans");
+    }
+
+    {
+        // a flood of one-off IPs is forgotten once their buckets are full
+        // again, the one with a connection open stays
+        Limiter limiter(limits);
+        auto keep = ip(10, 0, 0, 1);
+        check(limiter.connect(keep, now), "connect");
+        for (uint32_t i = 0; i < 1000000; i++) {
+            auto other = htonl(0x0b000000 + i);
+            limiter.connect(other, now);
+            limiter.disconnect(other);
+        }
+        check(limiter.size() > 1000000 / 2, "flood not remembered");
+
+        // new IPs make the tables rebuild and drop what's idle
+        int64_t later = now + 10000;
+        for (uint32_t i = 0; i < 1000000; i++) {
+            auto other = htonl(0x0c000000 + i);
+            limiter.connect(other, later);
+            limiter.disconnect(other);
+        }
+        check(limiter.size() < 1500000, "idle IPs kept");
+        check(limiter.message(keep, later), "connected IP forgotten");
+        limiter.disconnect(keep);
+    }
+}
+
+static void bench_single(int ips)
+{
+    Limiter limiter(Limits{});
+    std::vector<uint32_t> addrs;
+    for (int i = 0; i < ips; i++) {
+        addrs.push_back(htonl(0x0a000000 + i));
+    }
+    int64_t now = 1000000;
+    for (auto a : addrs) {
+        limiter.connect(a, now);
+    }
+
+    const int N = 5000000;
+    std::mt19937 rng(1);
+    uint64_t ok = 0;
+    auto start = Clock::now();
+    for (int i = 0; i < N; i++) {
+        // 1000 checks per virtual ms, under the rate for most IPs
+        ok += limiter.message(addrs[rng() % ips], now + i / 1000);
+    }
+    auto elapsed = Clock::now() - start;
+
+    printf("message(), 1 thread, %d IPs: %.1f ns/op (%.1f%% allowed)\n", ips,
+           std::chrono::duration<double, std::nano>(elapsed).count() / N,
+           100.0 * ok / N);
+
+    start = Clock::now();
+    for (int i = 0; i < N; i++) {
+        auto a = addrs[rng() % ips];
+        if (limiter.connect(a, now + i / 1000))
+            limiter.disconnect(a);
+    }
+    elapsed = Clock::now() - start;
+    printf("connect()+disconnect(), 1 thread: %.1f ns/op\n",
+           std::chrono::duration<double, std::nano>(elapsed).count() / N);
+}
+
+static void bench_threads(int threads, int ips)
+{
+    Limiter limiter(Limits{});
+    const int N = 2000000;
+    std::vector<std::thread> workers;
+
+    auto start = Clock::now();
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back([&, t] {
+            std::mt19937 rng(t);
+            int64_t now = 1000000;
+            for (int i = 0; i < N; i++) {
+                auto a = htonl(0x0a000000 + rng() % ips);
+                if (limiter.connect(a, now + i / 1000)) {
+                    limiter.message(a, now + i / 1000);
+                    limiter.disconnect(a);
+                }
+            }
+        });
+    }
+    for (auto &w : workers) {
+        w.join();
+    }
+    auto elapsed = Clock::now() - start;
+
+    printf("connect+message+disconnect, %d threads: %.1f ns/op wall, "
+           "%zu IPs tracked\n",
+           threads,
+           std::chrono::duration<double, std::nano>(elapsed).count() /
+               (N * (double)threads),
+           limiter.size());
+}
+
+static std::atomic<bool> running{true};
+static std::atomic<uint64_t> answered{0};
+static std::atomic<uint64_t> refused{0};
+
+// a connection from `source`, -1 if it couldn't be made
+static int connect_from(uint32_t source, int port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == -1)
+        return -1;
+
+    sockaddr_in from{.sin_family = AF_INET, .sin_addr = {source}};
+    sockaddr_in to{.sin_family = AF_INET,
+                   .sin_port = htons(port),
+                   .sin_addr = {htonl(INADDR_LOOPBACK)}};
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(fd, (sockaddr *)&from, sizeof(from)) == -1 ||
+        connect(fd, (sockaddr *)&to, sizeof(to)) == -1) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// one request, true if a response (its first bytes) came back
+static bool request(int fd, const std::string &req)
+{
+    char buf[16384];
+    if (send(fd, req.data(), req.size(), MSG_NOSIGNAL) != (ssize_t)req.size())
+        return false;
+    return recv(fd, buf, sizeof(buf), 0) > 0;
+}
+
+static void attacker(int n, int port, const std::string &path)
+{
+    auto source = ip(127, 0, 1, 1 + n);
+    auto req = "GET " + path +
+               " HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n";
+
+    while (running) {
+        int fd = connect_from(source, port);
+        if (fd == -1) {
+            refused++;
+            continue;
+        }
+        if (request(fd, req))
+            answered++;
+        else
+            refused++;
+        close(fd);
+    }
+}
+
+static void flood(int port, int attackers, int seconds,
+                  const std::string &path)
+{
+    std::vector<std::thread> threads;
+    for (int i = 0; i < attackers; i++) {
+        threads.emplace_back(attacker, i, port, path);
+    }
+
+    // the legitimate client, paced well under the limits
+    auto req = "GET " + path + " HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    std::vector<double> latencies;
+    int failures = 0;
+    int fd = -1;
+    auto end = Clock::now() + std::chrono::seconds(seconds);
+    while (Clock::now() < end) {
+        if (fd == -1)
+            fd = connect_from(ip(127, 0, 0, 2), port);
+
+        auto start = Clock::now();
+        if (fd != -1 && request(fd, req)) {
+            latencies.push_back(
+                std::chrono::duration<double, std::micro>(Clock::now() - start)
+                    .count());
+        }
+        else {
+            failures++;
+            if (fd != -1)
+                close(fd);
+            fd = -1;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    running = false;
+    for (auto &t : threads) {
+        t.join();
+    }
+    if (fd != -1)
+        close(fd);
+
+    printf("attackers: %.0f answered/s, %.0f refused/s (%d IPs)\n",
+           answered / (double)seconds, refused / (double)seconds, attackers);
+
+    if (latencies.empty()) {
+        printf("legitimate client: no responses, %d failures\n", failures);
+        return;
+    }
+    std::sort(latencies.begin(), latencies.end());
+    auto at = [&](double p) {
+        return latencies[std::min(latencies.size() - 1,
+                                  size_t(p * latencies.size()))];
+    };
+    printf("legitimate client: %zu requests, %d failures, p50 %.0f us, "
+           "p99 %.0f us, max %.0f us\n",
+           latencies.size(), failures, at(0.5), at(0.99), latencies.back());
+}
+
+int main(int argc, char **argv)
+{
+    int threads = 4;
+    int ips = 100000;
+    bool flooding = false;
+    int port = 9034;
+    int attackers = 16;
+    int seconds = 5;
+    std::string path = "/";
+
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--threads=", 10) == 0)
+            threads = atoi(argv[i] + 10);
+        else if (strncmp(argv[i], "--ips=", 6) == 0)
+            ips = atoi(argv[i] + 6);
+        else if (strcmp(argv[i], "--flood") == 0)
+            flooding = true;
+        else if (strncmp(argv[i], "--port=", 7) == 0)
+            port = atoi(argv[i] + 7);
+        else if (strncmp(argv[i], "--attackers=", 12) == 0)
+            attackers = atoi(argv[i] + 12);
+        else if (strncmp(argv[i], "--seconds=", 10) == 0)
+            seconds = atoi(argv[i] + 10);
+        else if (strncmp(argv[i], "--path=", 7) == 0)
+            path = argv[i] + 7;
+        else {
+            fprintf(stderr, "unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    if (flooding) {
+        flood(port, attackers, seconds, path);
+        return 0;
+    }
+
+    check_limits();
+    printf("checks passed\n");
+    bench_single(ips);
+    bench_threads(threads, ips);
+    return 0;
+}
@@ -0,0 +1,287 @@
+// Closed-loop load generator for the server, run it against a server started
+// with --threads=1,2,4... to see how throughput scales with reactors (and
+// --no-limit, every client connects from the same address).
+//
+// usage: load_bench [--port=9034] [--paths=/,/assets/a.js] [--clients=8]
+//                   [--seconds=5] [--mode=close|keepalive|pipeline]
+//                   [--revisit]
+//
+// every client loads the whole set of paths (one "page load") over and over:
+//   close      a new connection per request
+//   keepalive  one persistent connection, one request at a time
+//   pipeline   one persistent connection, all the requests of a page load
+//              are written at once and the responses read back in order
+//
+// --revisit makes every page load after a client's first one conditional
+// (If-None-Match with the ETags it got), like a returning visitor with a
+// warm browser cache
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include <netdb.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+enum class Mode { Close, KeepAlive, Pipeline };
+
+struct Options {
+    std::string port = "9034";
+    std::vector<std::string> paths = {"/"};
+    int clients = 8;
+    int seconds = 5;
+    Mode mode = Mode::Close;
+    bool revisit = false;
+};
+
+static std::atomic<bool> running{true};
+static std::atomic<uint64_t> completed{0};
+static std::atomic<uint64_t> page_loads{0};
+static std::atomic<uint64_t> failed{0};
+static std::atomic<uint64_t> connects{0};
+static std::atomic<uint64_t> bytes_read{0};
+
+static int connect_to(const addrinfo *addr)
+{
+    int fd = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+    if (fd == -1)
+        return -1;
+
+    if (connect(fd, addr->ai_addr, addr->ai_addrlen) == -1) {
+        close(fd);
+        return -1;
+    }
+    connects++;
+    return fd;
+}
+
+// reads responses off a connection, keeping whatever belongs to the next one
+struct ResponseReader {
+    std::string buf;
+    std::string etag; // of the last response, empty if it had none
+
+    // false if the connection broke before the whole response arrived,
+    // *closing is set when the server said it will close the connection
+    bool read(int fd, bool *closing)
+    {
+        char chunk[16384];
+
+        while (true) {
+            size_t end = this->buf.find("\r\n\r\n");
+
+            if (end != std::string::npos) {
+                size_t content_length = 0;
+                auto cl = this->buf.find("Content-Length: ");
+                if (cl != std::string::npos && cl < end) {
+                    content_length =
+                        strtoull(this->buf.c_str() + cl + 16, nullptr, 10);
+                }
+
+                size_t total = end + 4 + content_length;
+                if (this->buf.size() >= total) {
+                    auto conn = this->buf.find("Connection: close");
+                    *closing = conn != std::string::npos && conn < end;
+
+                    this->etag.clear();
+                    auto etag = this->buf.find("ETag: ");
+                    if (etag != std::string::npos && etag < end) {
+                        etag += 6;
+                        this->etag = this->buf.substr(
+                            etag, this->buf.find("\r\n", etag) - etag);
+                    }
+
+                    bytes_read += total;
+                    this->buf.erase(0, total);
+                    return true;
+                }
+            }
+
+            ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+            if (n <= 0)
+                return false;
+            this->buf.append(chunk, n);
+        }
+    }
+};
+
+static std::string make_request(const std::string &path, bool keep_alive,
+                                const std::string &etag = "")
+{
+    return "GET " + path + " HTTP/1.1\r\nHost: localhost\r\n" +
+           (keep_alive ? "" : "Connection: close\r\n") +
+           (etag.empty() ? "" : "If-None-Match: " + etag + "\r\n") + "\r\n";
+}
+
+static bool send_str(int fd, const std::string &s)
+{
+    return send(fd, s.data(), s.size(), MSG_NOSIGNAL) == (ssize_t)s.size();
+}
+
+static void client(const Options &opts, const addrinfo *addr)
+{
+    bool keep_alive = opts.mode != Mode::Close;
+    std::string pipelined;
+    std::vector<std::string> requests;
+    for (auto &p : opts.paths) {
+        requests.push_back(make_request(p, keep_alive));
+        pipelined += requests.back();
+    }
+
+    ResponseReader reader;
+    int fd = -1;
+    std::vector<std::string> etags(requests.size());
+    bool primed = !opts.revisit;
+
+    while (running) {
+        bool ok = true;
+
+        if (opts.mode == Mode::Pipeline) {
+            if (fd == -1)
+                fd = connect_to(addr);
+
+            ok = fd != -1 && send_str(fd, pipelined);
+            for (size_t i = 0; ok && i < requests.size(); i++) {
+                bool closing = false;
+                ok = reader.read(fd, &closing);
+                if (ok) {
+                    completed++;
+                    etags[i] = reader.etag;
+                }
+                // the server hit its request limit, whatever is left of the
+                // page load was dropped
+                if (closing)
+                    ok = false;
+            }
+        }
+        else {
+            for (size_t i = 0; ok && i < requests.size(); i++) {
+                if (fd == -1)
+                    fd = connect_to(addr);
+
+                bool closing = false;
+                ok = fd != -1 && send_str(fd, requests[i]) &&
+                     reader.read(fd, &closing);
+                if (ok) {
+                    completed++;
+                    etags[i] = reader.etag;
+                }
+
+                if (!keep_alive || closing) {
+                    close(fd);
+                    fd = -1;
+                    reader.buf.clear();
+                }
+            }
+        }
+
+        if (ok) {
+            page_loads++;
+
+            // from now on only ask whether things changed
+            if (!primed) {
+                pipelined.clear();
+                for (size_t i = 0; i < requests.size(); i++) {
+                    requests[i] =
+                        make_request(opts.paths[i], keep_alive, etags[i]);
+                    pipelined += requests[i];
+                }
+                primed = true;
+            }
+        }
+        else {
+            failed++;
+            if (fd != -1)
+                close(fd);
+            fd = -1;
+            reader.buf.clear();
+        }
+    }
+
+    if (fd != -1)
+        close(fd);
+}
+
+static std::vector<std::string> split_paths(const char *s)
+{
+    std::vector<std::string> paths;
+    std::string cur;
+    for (; *s; s++) {
+        if (*s == ',') {
+            paths.push_back(cur);
+            cur.clear();
+        }
+        else {
+            cur += *s;
+        }
+    }
+    if (!cur.empty())
+        paths.push_back(cur);
+    return paths;
+}
+
+int main(int argc, char **argv)
+{
+    Options opts;
+
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--port=", 7) == 0)
+            opts.port = argv[i] + 7;
+        else if (strncmp(argv[i], "--paths=", 8) == 0)
+            opts.paths = split_paths(argv[i] + 8);
+        else if (strncmp(argv[i], "--clients=", 10) == 0)
+            opts.clients = atoi(argv[i] + 10);
+        else if (strncmp(argv[i], "--seconds=", 10) == 0)
+            opts.seconds = atoi(argv[i] + 10);
+        else if (strcmp(argv[i], "--mode=close") == 0)
+            opts.mode = Mode::Close;
+        else if (strcmp(argv[i], "--mode=keepalive") == 0)
+            opts.mode = Mode::KeepAlive;
+        else if (strcmp(argv[i], "--mode=pipeline") == 0)
+            opts.mode = Mode::Pipeline;
+        else if (strcmp(argv[i], "--revisit") == 0)
+            opts.revisit = true;
+        else {
+            fprintf(stderr,
+                    "usage: %s [--port=9034] [--paths=/,/assets/a.js] "
+                    "[--clients=8] [--seconds=5] "
+                    "[--mode=close|keepalive|pipeline] [--revisit]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+
+    addrinfo hints = {}, *addr;
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo("127.0.0.1", opts.port.c_str(), &hints, &addr) != 0) {
+        perror("getaddrinfo");
+        return 1;
+    }
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < opts.clients; i++) {
+        threads.emplace_back(client, std::cref(opts), addr);
+    }
+
+    std::this_thread::sleep_for(std::chrono::seconds(opts.seconds));
+    running = false;
+    for (auto &t : threads) {
+        t.join();
+    }
+    freeaddrinfo(addr);
+
+    double secs = opts.seconds;
+    printf("%llu requests (%.0f req/s), %.0f page loads/s, %llu connections, "
+           "%llu failed, %.1f MB/s\n",
+           (unsigned long long)completed.load(), completed.load() / secs,
+           page_loads.load() / secs, (unsigned long long)connects.load(),
+           (unsigned long long)failed.load(), bytes_read.load() / secs / 1e6);
+    if (page_loads > 0) {
+        printf("%.0f bytes received per page load\n",
+               bytes_read.load() / (double)page_loads.load());
+    }
+}
@@ -0,0 +1,277 @@
+// Perft: counts the leaf nodes of the move tree of the standard test
+// positions (the start, Kiwipete, positions 3 to 6 of the chessprogramming
+// wiki) to a fixed depth and fails unless every count is the known one.
+// Any bug in move generation or make/unmake shows up as a wrong count, and
+// nodes/sec is the move generator's speed, so it doubles as a regression
+// gate: it exits with 1 on a wrong count, or when --min-mnps is given and
+// the total rate is below it.
+//
+// By default the last ply is bulk counted (the size of the legal move list,
+// nothing is made), --no-bulk makes every leaf move too. --hash=MB keeps
+// subtree counts in a table shared by the threads (by the position's
+// Zobrist key, transpositions are counted once), --threads=N splits the
+// root moves between N threads. --deep goes one ply further everywhere
+// (minutes rather than seconds).
+//
+// --fen and --depth count another position instead, --divide prints the
+// count under each root move, to compare with another engine's.
+//
+// usage: perft [--deep] [--threads=1] [--hash=0] [--no-bulk]
+//              [--min-mnps=0]
+//        perft --fen=<fen> --depth=<n> [--divide] [--threads=1] [--hash=0]
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include "src/chess/notation.h"
+#include "src/chess/position.h"
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+    bool bulk = true;
+    int threads = 1;
+    size_t hash_mb = 0;
+    bool divide = false;
+};
+
+// Subtree counts by position and depth, shared by the threads without a
+// lock: an entry is written as two words, the key xor'ed with the data and
+// the data, so a torn one doesn't check out and is just a miss.
+class HashTable {
+    struct Entry {
+        std::atomic<uint64_t> check{0};
+        std::atomic<uint64_t> data{0}; // count << 8 | depth
+    };
+
+    std::vector<Entry> entries;
+    uint64_t mask = 0;
+
+  public:
+    explicit HashTable(size_t mb)
+    {
+        size_t count = 1;
+        while (count * 2 * sizeof(Entry) <= mb << 20)
+            count *= 2;
+        this->entries = std::vector<Entry>(mb ? count : 0);
+        this->mask = count - 1;
+    }
+
+    bool enabled() const
+    {
+        return !this->entries.empty();
+    }
+
+    bool probe(uint64_t key, int depth, uint64_t &count) const
+    {
+        auto &e = this->entries[key & this->mask];
+        uint64_t data = e.data.load(std::memory_order_relaxed);
+        uint64_t check = e.check.load(std::memory_order_relaxed);
+        if ((check ^ data) != key || int(data & 0xff) != depth)
+            return false;
+        count = data >> 8;
+        return true;
+    }
+
+    void store(uint64_t key, int depth, uint64_t count)
+    {
+        auto &e = this->entries[key & this->mask];
+        uint64_t data = count << 8 | depth;
+        e.check.store(key ^ data, std::memory_order_relaxed);
+        e.data.store(data, std::memory_order_relaxed);
+    }
+};
+
+static uint64_t perft(chess::Position &p, int depth, const Options &opt,
+                      HashTable &hash)
+{
+    if (depth == 0)
+        return 1;
+    chess::MoveList moves;
+    p.legal_moves(moves);
+    if (depth == 1 && opt.bulk)
+        return moves.size();
+
+    uint64_t key = 0, count = 0;
+    if (hash.enabled() && depth >= 2) {
+        key = p.key();
+        if (hash.probe(key, depth, count))
+            return count;
+    }
+
+    for (auto move : moves) {
+        chess::Undo undo;
+        p.make(move, undo);
+        count += perft(p, depth - 1, opt, hash);
+        p.unmake(move, undo);
+    }
+
+    if (hash.enabled() && depth >= 2)
+        hash.store(key, depth, count);
+    return count;
+}
+
+// the root moves go to whichever thread is free next, `counts` by root move
+static uint64_t split(const chess::Position &root, int depth,
+                      const Options &opt, HashTable &hash,
+                      chess::MoveList &moves, std::vector<uint64_t> &counts)
+{
+    root.legal_moves(moves);
+    counts.assign(moves.size(), 0);
+    if (depth == 0)
+        return 1;
+
+    std::atomic<size_t> next{0};
+    auto work = [&]() {
+        for (size_t i; (i = next++) < moves.size();) {
+            auto p = root;
+            chess::Undo undo;
+            p.make(moves.moves[i], undo);
+            counts[i] = perft(p, depth - 1, opt, hash);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int t = 1; t < opt.threads; t++) {
+        threads.emplace_back(work);
+    }
+    work();
+    for (auto &t : threads) {
+        t.join();
+    }
+
+    uint64_t total = 0;
+    for (auto c : counts) {
+        total += c;
+    }
+    return total;
+}
+
+struct Case {
+    const char *name;
+    const char *fen;
+    int depth;
+    // by depth, from 1
+    std::vector<uint64_t> counts;
+};
+
+static const Case CASES[] = {
+    {"start", chess::Position::START_FEN, 5,
+     {20, 400, 8902, 197281, 4865609, 119060324}},
+    {"kiwipete",
+     "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+     4,
+     {48, 2039, 97862, 4085603, 193690690}},
+    {"position 3", "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1", 5,
+     {14, 191, 2812, 43238, 674624, 11030083}},
+    {"position 4",
+     "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1", 4,
+     {6, 264, 9467, 422333, 15833292}},
+    {"position 5",
+     "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8", 4,
+     {44, 1486, 62379, 2103487, 89941194}},
+    {"position 6",
+     "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - "
+     "0 10",
+     4,
+     {46, 2079, 89890, 3894594, 164075551}},
+};
+
+int main(int argc, char **argv)
+{
+    Options opt;
+    bool deep = false;
+    double min_mnps = 0;
+    const char *fen = nullptr;
+    int depth = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--deep") == 0)
+            deep = true;
+        else if (strncmp(argv[i], "--threads=", 10) == 0)
+            opt.threads = std::max(1, atoi(argv[i] + 10));
+        else if (strncmp(argv[i], "--hash=", 7) == 0)
+            opt.hash_mb = atoi(argv[i] + 7);
+        else if (strcmp(argv[i], "--no-bulk") == 0)
+            opt.bulk = false;
+        else if (strncmp(argv[i], "--min-mnps=", 11) == 0)
+            min_mnps = atof(argv[i] + 11);
+        else if (strncmp(argv[i], "--fen=", 6) == 0)
+            fen = argv[i] + 6;
+        else if (strncmp(argv[i], "--depth=", 8) == 0)
+            depth = atoi(argv[i] + 8);
+        else if (strcmp(argv[i], "--divide") == 0)
+            opt.divide = true;
+        else {
+            fprintf(stderr, "unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    std::vector<Case> cases(std::begin(CASES), std::end(CASES));
+    if (fen != nullptr)
+        cases = {{"fen", fen, std::max(depth, 1), {}}};
+    HashTable hash(opt.hash_mb);
+
+    printf("%d thread%s, %s, hash %zu MB\n", opt.threads,
+           opt.threads == 1 ? "" : "s",
+           opt.bulk ? "bulk counting" : "every leaf made", opt.hash_mb);
+
+    bool ok = true;
+    uint64_t total_nodes = 0;
+    double total_seconds = 0;
+    for (auto &c : cases) {
+        chess::Position root;
+        if (!root.set_fen(c.fen)) {
+            fprintf(stderr, "bad FEN: %s\n", c.fen);
+            return 1;
+        }
+        // as deep as there's a known count for
+        int d = c.depth + deep;
+        if (!c.counts.empty())
+            d = std::min<int>(d, c.counts.size());
+
+        chess::MoveList moves;
+        std::vector<uint64_t> counts;
+        auto start = Clock::now();
+        uint64_t nodes = split(root, d, opt, hash, moves, counts);
+        double seconds =
+            std::chrono::duration<double>(Clock::now() - start).count();
+        total_nodes += nodes;
+        total_seconds += seconds;
+
+        if (opt.divide) {
+            for (size_t i = 0; i < moves.size(); i++) {
+                printf("  %s %lu\n", chess::uci(moves.moves[i]).c_str(),
+                       counts[i]);
+            }
+        }
+
+        const char *verdict = "";
+        if (!c.counts.empty()) {
+            bool right = nodes == c.counts[d - 1];
+            verdict = right ? "ok" : "WRONG";
+            ok &= right;
+        }
+        printf("%-10s depth %d %12lu nodes %8.3f s %8.1f Mnps  %s\n", c.name,
+               d, nodes, seconds, nodes / seconds / 1e6, verdict);
+    }
+
+    double mnps = total_nodes / total_seconds / 1e6;
+    printf("total %lu nodes in %.3f s, %.1f Mnps\n", total_nodes,
+           total_seconds, mnps);
+    if (!ok) {
+        fprintf(stderr, "perft: wrong node count\n");
+        return 1;
+    }
+    if (mnps < min_mnps) {
+        fprintf(stderr, "perft: %.1f Mnps, below %.1f\n", mnps, min_mnps);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,139 @@
+// Compares the cost of one event loop wakeup between the poll and epoll
+// backends when most of the registered connections are idle.
+//
+// usage: poller_bench [rounds] [active]
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+#include <unistd.h>
+#include <sys/resource.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+#include "src/poller.h"
+
+struct IdleFd {
+    int read_end;
+    int write_end;
+};
+
+static bool make_fd(IdleFd &out)
+{
+#ifdef __linux__
+    int fd = eventfd(0, EFD_NONBLOCK);
+    out = {fd, fd};
+    return fd != -1;
+#else
+    int p[2];
+    if (pipe(p) == -1)
+        return false;
+    out = {p[0], p[1]};
+    return true;
+#endif
+}
+
+static void close_fd(IdleFd &f)
+{
+    close(f.read_end);
+    if (f.write_end != f.read_end)
+        close(f.write_end);
+}
+
+static void wake(IdleFd &f)
+{
+    uint64_t one = 1;
+    if (write(f.write_end, &one, sizeof(one)) == -1) {
+        perror("write");
+    }
+}
+
+static void drain(int fd)
+{
+    uint64_t buf[8];
+    while (read(fd, buf, sizeof(buf)) > 0) {
+    }
+}
+
+static size_t raise_fd_limit()
+{
+    rlimit lim;
+    getrlimit(RLIMIT_NOFILE, &lim);
+    lim.rlim_cur = lim.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &lim);
+    getrlimit(RLIMIT_NOFILE, &lim);
+    return lim.rlim_cur;
+}
+
+// returns the average time of one wait() + dispatch in microseconds
+static double run(PollerType type, std::vector<IdleFd> &fds, int rounds,
+                  int active)
+{
+    auto p = Poller::create(type);
+    for (size_t i = 0; i < fds.size(); i++) {
+        p->add(fds[i].read_end, poller::READ, i);
+    }
+
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<size_t> pick(0, fds.size() - 1);
+    std::vector<PollEvent> events;
+    std::chrono::nanoseconds total{0};
+
+    for (int r = 0; r < rounds; r++) {
+        for (int a = 0; a < active; a++) {
+            wake(fds[pick(rng)]);
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        p->wait(events, -1);
+        for (auto &ev : events) {
+            drain(fds[ev.token].read_end);
+        }
+        total += std::chrono::steady_clock::now() - start;
+    }
+
+    for (auto &f : fds) {
+        p->remove(f.read_end);
+    }
+
+    return std::chrono::duration<double, std::micro>(total).count() / rounds;
+}
+
+int main(int argc, char **argv)
+{
+    int rounds = argc > 1 ? atoi(argv[1]) : 2000;
+    int active = argc > 2 ? atoi(argv[2]) : 8;
+    size_t limit = raise_fd_limit();
+
+    printf("%-12s %-8s %-18s %-18s\n", "connections", "active",
+           "poll us/wakeup", "epoll us/wakeup");
+
+    for (size_t n : {1000, 10000, 50000}) {
+        // leave some room for stdio, the epoll fd and friends
+        if (n + 64 > limit) {
+            printf("%-12zu skipped, RLIMIT_NOFILE is %zu\n", n, limit);
+            continue;
+        }
+
+        std::vector<IdleFd> fds(n);
+        for (auto &f : fds) {
+            if (!make_fd(f)) {
+                perror("eventfd");
+                return 1;
+            }
+        }
+
+        double poll_us = run(PollerType::Poll, fds, rounds, active);
+#ifdef __linux__
+        double epoll_us = run(PollerType::Epoll, fds, rounds, active);
+        printf("%-12zu %-8d %-18.2f %-18.2f\n", n, active, poll_us, epoll_us);
+#else
+        printf("%-12zu %-8d %-18.2f %-18s\n", n, active, poll_us, "n/a");
+#endif
+
+        for (auto &f : fds) {
+            close_fd(f);
+        }
+    }
+}
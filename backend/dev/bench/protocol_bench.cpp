@@ -0,0 +1,321 @@
+// Game protocol decoding: the JSON DOM path (nlohmann), the hand written JSON
+// scanner and the binary encoding, on moves, chat messages and a realistic
+// mix (mostly moves, some joins / leaves / chat, like a busy server sees).
+// Everything is checked to decode back to what went in, and the two JSON
+// decoders to agree on malformed or unusual input, then each is timed in a
+// loop on one core, counting heap allocations.
+//
+// usage: protocol_bench [--seconds=N] [--check-only]
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+#include "src/protocol.h"
+
+using Clock = std::chrono::steady_clock;
+
+static std::atomic<size_t> allocations{0};
+
+void *operator new(size_t n)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void *p = malloc(n))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+    free(p);
+}
+
+enum class Mix { Moves, Chat, Mixed };
+
+static const char *const CHAT_LINES[] = {
+    "gg",
+    "good game, well played",
+    "that knight fork was brutal, didn't see it coming at all",
+    "rematch? I'll take black this time",
+};
+
+static std::vector<proto::ClientMessage> make_messages(Mix mix, size_t n)
+{
+    std::mt19937 rng(42);
+    std::vector<proto::ClientMessage> msgs;
+
+    for (size_t i = 0; i < n; i++) {
+        proto::ClientMessage m;
+        int pick = mix == Mix::Moves  ? 0
+                   : mix == Mix::Chat ? 95
+                                      : rng() % 100;
+
+        if (pick < 85) {
+            m.type = proto::Type::Move;
+            m.move = {.from = uint8_t(rng() % 64), .to = uint8_t(rng() % 64)};
+            if (rng() % 50 == 0)
+                m.move.promo = proto::Promotion::Queen;
+        }
+        else if (pick < 95) {
+            static const proto::Type types[] = {
+                proto::Type::Join, proto::Type::Leave, proto::Type::Spectate,
+                proto::Type::Sync};
+            m.type = types[rng() % 4];
+            m.game = rng() % 2176782336; // 6 base 36 digits
+            if (m.type == proto::Type::Sync)
+                m.seq = rng() % 200;
+        }
+        else if (pick < 99) {
+            m.type = proto::Type::Chat;
+            m.text = CHAT_LINES[rng() % 4];
+        }
+        else {
+            m.type = proto::Type::Create;
+            // every other one with clocks, whole seconds like JSON has them
+            if (rng() % 2) {
+                m.time_control.base_ms = (1 + rng() % 3600) * 1000;
+                m.time_control.increment_ms = rng() % 30 * 1000;
+            }
+        }
+        msgs.push_back(m);
+    }
+
+    return msgs;
+}
+
+static bool same(const proto::ClientMessage &a, const proto::ClientMessage &b)
+{
+    if (a.type != b.type)
+        return false;
+
+    switch (a.type) {
+    case proto::Type::Join:
+    case proto::Type::Leave:
+    case proto::Type::Spectate:
+        return a.game == b.game;
+    case proto::Type::Chat:
+        return a.text == b.text;
+    case proto::Type::Move:
+        return a.move.pack() == b.move.pack();
+    case proto::Type::Sync:
+        return a.game == b.game && a.seq == b.seq;
+    case proto::Type::Create:
+        return a.time_control.base_ms == b.time_control.base_ms &&
+               a.time_control.increment_ms == b.time_control.increment_ms;
+    default:
+        return true;
+    }
+}
+
+static bool check(const std::vector<proto::ClientMessage> &msgs)
+{
+    bool ok = true;
+
+    for (auto &m : msgs) {
+        std::string json = proto::encode_json(m);
+        std::string binary = proto::encode_binary(m);
+        proto::ClientMessage fast, dom, bin;
+
+        if (!proto::decode_json(json, fast) || !same(m, fast) ||
+            !proto::decode_json_dom(json, dom) || !same(m, dom)) {
+            printf("MISMATCH (json): %s\n", json.c_str());
+            ok = false;
+        }
+        if (!proto::decode_binary(binary, bin) || !same(m, bin)) {
+            printf("MISMATCH (binary): %s\n", json.c_str());
+            ok = false;
+        }
+    }
+
+    // the scanner must accept and reject exactly what the DOM parser does,
+    // whether it handles the input itself or hands it over
+    const char *tricky_json[] = {
+        "",
+        "[]",
+        "{}",
+        "{\"type\":6}",
+        "{\"type\":-1}",
+        "{\"type\":05}",
+        "{\"type\":5.0,\"payload\":\"e2e4\"}",
+        "{\"type\":5}",
+        "{\"type\":5,\"payload\":\"e2e9\"}",
+        "{\"type\":5,\"payload\":\"e7e8k\"}",
+        "{\"type\":5,\"payload\":\"e2e4\"} x",
+        "{\"type\":5,\"payload\":\"e2e4\",}",
+        "{\"type\":1,\"payload\":\"ab-cd\"}",
+        "{\"type\":1,\"payload\":12}",
+        "{\"type\":0,\"payload\":12}",
+        "{\"type\":0,\"payload\":\"300+2\"}",
+        "{\"type\":0,\"payload\":\"0+0\"}",
+        "{\"type\":0,\"payload\":\"abc\"}",
+        "{\"type\":0,\"payload\":\"1+\"}",
+        "{\"type\":0,\"payload\":\"+1\"}",
+        "{\"type\":0,\"payload\":\"1234567+0\"}",
+        " {\n\"payload\" : \"e7e8q\" ,\t\"type\" : 5 } ",
+        "{\"type\":5,\"payload\":\"e2e4\",\"id\":3}",
+        "{\"type\":5,\"type\":4,\"payload\":\"e2e4\"}",
+        "{\"type\":4,\"payload\":\"say \\\"hi\\\"\"}",
+        "{\"type\":4,\"payload\":\"caf\\u00e9\"}",
+        "{\"type\":4,\"payload\":\"caf\xc3\xa9\"}",
+        "{\"type\":4,\"payload\":\"caf\xc3\"}",
+        "{\"type\":4,\"payload\":\"\xed\xa0\x80\"}",
+        "{\"type\":4,\"payload\":\"tab\there\"}",
+        "{\"type\":6,\"payload\":\"abc\",\"seq\":12}",
+        "{\"seq\":0,\"type\":6,\"payload\":\"abc\"}",
+        "{\"type\":6,\"payload\":\"abc\"}",
+        "{\"type\":6,\"payload\":\"abc\",\"seq\":-1}",
+        "{\"type\":6,\"payload\":\"abc\",\"seq\":012}",
+        "{\"type\":6,\"payload\":\"abc\",\"seq\":1e3}",
+        "{\"type\":6,\"payload\":\"abc\",\"seq\":99999999999999999999}",
+        "{\"type\":6,\"payload\":\"abc\",\"seq\":1,\"seq\":2}",
+        "{\"type\":5,\"payload\":\"e2e4\",\"seq\":7}",
+        "{\"type\":7}",
+    };
+    for (auto s : tricky_json) {
+        proto::ClientMessage fast, dom;
+        bool a = proto::decode_json(s, fast);
+        bool b = proto::decode_json_dom(s, dom);
+        if (a != b || (a && !same(fast, dom))) {
+            printf("DISAGREE: %s (scanner %d, dom %d)\n", s, a, b);
+            ok = false;
+        }
+    }
+
+    // both have to turn these down, not just agree
+    const char *bad_json[] = {
+        "{\"type\":0,\"payload\":5}",
+        "{\"type\":0,\"payload\":null}",
+        "{\"type\":0,\"payload\":[\"300+2\"]}",
+        "{\"type\":1,\"payload\":12}",
+    };
+    for (auto s : bad_json) {
+        proto::ClientMessage fast, dom;
+        bool a = proto::decode_json(s, fast);
+        bool b = proto::decode_json_dom(s, dom);
+        if (a || b) {
+            printf("ACCEPTED: %s (scanner %d, dom %d)\n", s, a, b);
+            ok = false;
+        }
+    }
+
+    const std::string bad_binary[] = {
+        "",
+        std::string("\x06", 1),
+        std::string("\x06\x05", 2),
+        std::string("\x07", 1),
+        std::string("\x00\x00", 2),
+        std::string("\x00\xe0\xa7\x12\x00\x00", 6),
+        std::string("\x00\x80\x80\x80\x80\x10\x00", 7),
+        std::string("\x01\x80", 2),
+        std::string("\x05\x00", 2),
+        std::string("\x05\x00\x0f", 3),
+        std::string("\x05\x00\x00\x00", 4),
+        std::string("\x04\xc3", 2),
+    };
+    for (auto &s : bad_binary) {
+        proto::ClientMessage m;
+        if (proto::decode_binary(s, m)) {
+            printf("ACCEPTED (binary): %zu bytes\n", s.size());
+            ok = false;
+        }
+    }
+
+    return ok;
+}
+
+template <typename Decode>
+static void run(const char *name, const std::vector<std::string> &encoded,
+                double seconds, Decode decode)
+{
+    size_t bytes = 0;
+    for (auto &e : encoded) {
+        bytes += e.size();
+    }
+
+    proto::ClientMessage m;
+    size_t decoded = 0, rounds = 0;
+    size_t allocs_before = allocations.load();
+    auto start = Clock::now();
+    auto deadline = start + std::chrono::duration<double>(seconds);
+
+    do {
+        for (auto &e : encoded) {
+            decoded += decode(e, m);
+        }
+        rounds++;
+    } while (Clock::now() < deadline);
+
+    double elapsed =
+        std::chrono::duration<double>(Clock::now() - start).count();
+    double msgs = double(rounds * encoded.size());
+    double allocs = (allocations.load() - allocs_before) / msgs;
+
+    printf("  %-9s %6.1f bytes/msg  %11.0f msgs/s  %7.1f ns/msg  %5.2f "
+           "allocs/msg%s\n",
+           name, double(bytes) / encoded.size(), msgs / elapsed,
+           elapsed * 1e9 / msgs, allocs,
+           decoded == rounds * encoded.size() ? "" : "  (FAILED)");
+}
+
+int main(int argc, char **argv)
+{
+    double seconds = 2;
+    bool check_only = false;
+
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--seconds=", 10) == 0) {
+            seconds = atof(argv[i] + 10);
+        }
+        else if (strcmp(argv[i], "--check-only") == 0) {
+            check_only = true;
+        }
+        else {
+            fprintf(stderr, "usage: %s [--seconds=N] [--check-only]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+
+    const std::pair<const char *, Mix> mixes[] = {
+        {"moves", Mix::Moves}, {"chat", Mix::Chat}, {"mixed", Mix::Mixed}};
+
+    for (auto &[name, mix] : mixes) {
+        if (!check(make_messages(mix, 10000))) {
+            return 1;
+        }
+    }
+    printf("every encoding round trips, both JSON decoders agree\n");
+
+    if (check_only) {
+        return 0;
+    }
+
+    printf("\ndecoding on one core:\n");
+    for (auto &[name, mix] : mixes) {
+        auto msgs = make_messages(mix, 10000);
+
+        std::vector<std::string> json, binary;
+        for (auto &m : msgs) {
+            json.push_back(proto::encode_json(m));
+            binary.push_back(proto::encode_binary(m));
+        }
+
+        printf("%s\n", name);
+        run("json-dom", json, seconds, [](const std::string &e, auto &m) {
+            return proto::decode_json_dom(e, m);
+        });
+        run("json", json, seconds, [](const std::string &e, auto &m) {
+            return proto::decode_json(e, m);
+        });
+        run("binary", binary, seconds, [](const std::string &e, auto &m) {
+            return proto::decode_binary(e, m);
+        });
+    }
+}
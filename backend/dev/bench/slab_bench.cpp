@@ -0,0 +1,123 @@
+// Connection table churn: keeps `live` connections open and then performs
+// 100k disconnect + connect pairs, comparing the generational slab used by the
+// reactor with the vector + erase table it replaced and a fd keyed hash map.
+//
+// usage: slab_bench [live] [churn]
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "src/reactor.h"
+
+using Clock = std::chrono::steady_clock;
+
+static Connection make_conn(int fd)
+{
+    return Connection{.fd = fd, .ip_addr = "127.0.0.1"};
+}
+
+static double slab(int live, int churn)
+{
+    Slab<Connection> table;
+    std::vector<ConnId> open;
+    std::mt19937 rng(1);
+    int next_fd = 0;
+
+    for (int i = 0; i < live; i++) {
+        open.push_back(table.insert(make_conn(next_fd++)));
+    }
+
+    ConnId stale = open[0];
+
+    auto start = Clock::now();
+    for (int i = 0; i < churn; i++) {
+        size_t victim = rng() % open.size();
+        table.remove(open[victim]);
+        open[victim] = table.insert(make_conn(next_fd++));
+    }
+    auto elapsed = Clock::now() - start;
+
+    // a handle to a closed connection must not resolve to whoever reused
+    // its slot
+    if (table.size() != (size_t)live ||
+        (open[0] != stale && table.get(stale) != nullptr)) {
+        fprintf(stderr, "slab: stale handle or size mismatch\n");
+        exit(1);
+    }
+
+    return std::chrono::duration<double, std::nano>(elapsed).count() / churn;
+}
+
+static double hash_map(int live, int churn)
+{
+    std::unordered_map<int, Connection> table;
+    std::vector<int> open;
+    std::mt19937 rng(1);
+    int next_fd = 0;
+
+    for (int i = 0; i < live; i++) {
+        table[next_fd] = make_conn(next_fd);
+        open.push_back(next_fd++);
+    }
+
+    auto start = Clock::now();
+    for (int i = 0; i < churn; i++) {
+        size_t victim = rng() % open.size();
+        table.erase(open[victim]);
+        table[next_fd] = make_conn(next_fd);
+        open[victim] = next_fd++;
+    }
+    auto elapsed = Clock::now() - start;
+
+    return std::chrono::duration<double, std::nano>(elapsed).count() / churn;
+}
+
+// what Server::cleanup used to do: find the connection in a vector and erase
+// it, shifting everything after it
+static double vector_erase(int live, int churn)
+{
+    std::vector<Connection> table;
+    std::vector<int> open;
+    std::mt19937 rng(1);
+    int next_fd = 0;
+
+    for (int i = 0; i < live; i++) {
+        table.push_back(make_conn(next_fd));
+        open.push_back(next_fd++);
+    }
+
+    auto start = Clock::now();
+    for (int i = 0; i < churn; i++) {
+        size_t victim = rng() % open.size();
+        int fd = open[victim];
+        auto it = std::find_if(table.begin(), table.end(),
+                               [fd](const Connection &c) { return c.fd == fd; });
+        table.erase(it);
+        table.push_back(make_conn(next_fd));
+        open[victim] = next_fd++;
+    }
+    auto elapsed = Clock::now() - start;
+
+    return std::chrono::duration<double, std::nano>(elapsed).count() / churn;
+}
+
+int main(int argc, char **argv)
+{
+    int churn = argc > 2 ? atoi(argv[2]) : 100000;
+    std::vector<int> sizes = {1000, 10000, 50000};
+    if (argc > 1)
+        sizes = {atoi(argv[1])};
+
+    printf("%-8s %-10s %-14s %-14s %-14s\n", "live", "churn", "slab ns/op",
+           "map ns/op", "vector ns/op");
+
+    for (int live : sizes) {
+        printf("%-8d %-10d %-14.1f %-14.1f %-14.1f\n", live, churn,
+               slab(live, churn), hash_map(live, churn),
+               vector_erase(live, churn));
+    }
+}
@@ -0,0 +1,219 @@
+// Timer wheel: first checks it on a virtual clock (every timer goes off
+// once, at the first advance() past its deadline, cancelled ones never, and
+// next_timeout() is never late), then times what a reactor does with it
+// per connection event (re-arm one timer, cancel one and arm another, run
+// the expiries) with 1k to 1M timers armed, next to a std::set ordered by
+// deadline.
+//
+// usage: timer_bench [ops]
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <set>
+#include <utility>
+#include <vector>
+#include "src/timer_wheel.h"
+
+using Clock = std::chrono::steady_clock;
+
+static void check(bool ok, const char *what)
+{
+    if (!ok) {
+        fprintf(stderr, "timer wheel: %s\n", what);
+        exit(1);
+    }
+}
+
+struct Expected {
+    TimerWheel::TimerId id = TimerWheel::NONE;
+    int64_t deadline = 0;
+    int round = 0; // when it was last armed
+    bool armed = false;
+};
+
+// deadlines from right now to past the overflow list, most of them close
+static int64_t random_delay(std::mt19937_64 &rng)
+{
+    switch (rng() % 8) {
+    case 0:
+        return 0;
+    case 1:
+        return rng() % 64;
+    case 2:
+        return rng() % 4096;
+    case 3:
+        return rng() % (int64_t(1) << 24);
+    case 4:
+        return (int64_t(1) << 24) + rng() % (int64_t(1) << 26);
+    default:
+        return rng() % 60000;
+    }
+}
+
+static void check_virtual_clock()
+{
+    std::mt19937_64 rng(7);
+    // not a round number, cascades don't line up with the start
+    int64_t now = 1000000007;
+    TimerWheel wheel(now);
+    std::vector<Expected> timers(20000);
+    std::vector<uint64_t> expired;
+    size_t armed = 0;
+
+    for (int round = 0; round < 200000; round++) {
+        // poke at a few timers, like connections coming and going
+        for (int i = 0; i < 4; i++) {
+            uint64_t token = rng() % timers.size();
+            auto &t = timers[token];
+            int64_t deadline = now + random_delay(rng);
+
+            if (!t.armed) {
+                t.id = wheel.arm(deadline, token);
+                t.armed = true;
+                armed++;
+            }
+            else if (rng() % 3 == 0) {
+                wheel.cancel(t.id);
+                t.armed = false;
+                armed--;
+            }
+            else {
+                wheel.rearm(t.id, deadline);
+            }
+            t.deadline = deadline;
+            t.round = round;
+        }
+        check(wheel.size() == armed, "size");
+
+        // sleep as long as it says, or get woken up earlier
+        int64_t timeout = wheel.next_timeout(now);
+        check((timeout == -1) == (armed == 0), "next_timeout with nothing");
+        int64_t prev = now;
+        bool woken = timeout == -1 || rng() % 4 == 0;
+        now += woken ? rng() % 100 : timeout;
+
+        expired.clear();
+        wheel.advance(now, expired);
+        for (auto token : expired) {
+            auto &t = timers[token];
+            check(t.armed, "cancelled timer went off");
+            check(t.deadline <= now, "timer went off early");
+            // due at the last advance() but still there
+            check(t.round == round || t.deadline > prev,
+                  "timer went off late");
+            // asleep for the whole timeout, the first thing due is what
+            // woke us up
+            check(woken || t.deadline == now || t.deadline <= prev,
+                  "next_timeout() too long");
+            t.armed = false;
+            armed--;
+        }
+    }
+
+    // whatever is left, at most 2^26 ms away, goes off on time
+    while (armed > 0) {
+        int64_t timeout = wheel.next_timeout(now);
+        check(timeout >= 0, "armed timers but no timeout");
+        int64_t prev = now;
+        now += timeout;
+        expired.clear();
+        wheel.advance(now, expired);
+        for (auto token : expired) {
+            auto &t = timers[token];
+            check(t.armed && t.deadline <= now && t.deadline > prev,
+                  "timer off schedule while draining");
+            t.armed = false;
+            armed--;
+        }
+    }
+    for (auto &t : timers) {
+        check(!t.armed, "a timer never went off");
+    }
+}
+
+// per event, a connection's deadline moves by its timeout. Deadlines are in
+// the near future like the server's (15 s to a minute)
+static double wheel_ops(int live, int ops)
+{
+    std::mt19937_64 rng(1);
+    int64_t now = 1000000;
+    TimerWheel wheel(now);
+    std::vector<TimerWheel::TimerId> ids(live);
+    std::vector<uint64_t> expired;
+    for (int i = 0; i < live; i++) {
+        ids[i] = wheel.arm(now + 15000 + rng() % 45000, i);
+    }
+
+    auto start = Clock::now();
+    for (int i = 0; i < ops; i++) {
+        uint64_t token = rng() % live;
+        if (i % 2) {
+            wheel.rearm(ids[token], now + 15000 + rng() % 45000);
+        }
+        else {
+            wheel.cancel(ids[token]);
+            ids[token] = wheel.arm(now + 15000 + rng() % 45000, token);
+        }
+        // a ms every 100 events
+        if (i % 100 == 0) {
+            now++;
+            expired.clear();
+            wheel.advance(now, expired);
+            // the reactor would have looked at these, pinged them...
+            for (auto token : expired) {
+                ids[token] = wheel.arm(now + 15000 + rng() % 45000, token);
+            }
+        }
+    }
+    auto elapsed = Clock::now() - start;
+
+    return std::chrono::duration<double, std::nano>(elapsed).count() / ops;
+}
+
+static double set_ops(int live, int ops)
+{
+    std::mt19937_64 rng(1);
+    int64_t now = 1000000;
+    std::set<std::pair<int64_t, uint64_t>> timers;
+    std::vector<int64_t> deadlines(live);
+    for (int i = 0; i < live; i++) {
+        deadlines[i] = now + 15000 + rng() % 45000;
+        timers.insert({deadlines[i], i});
+    }
+
+    auto start = Clock::now();
+    for (int i = 0; i < ops; i++) {
+        uint64_t token = rng() % live;
+        timers.erase({deadlines[token], token});
+        deadlines[token] = now + 15000 + rng() % 45000;
+        timers.insert({deadlines[token], token});
+        if (i % 100 == 0) {
+            now++;
+            while (!timers.empty() && timers.begin()->first <= now) {
+                uint64_t token = timers.begin()->second;
+                timers.erase(timers.begin());
+                deadlines[token] = now + 15000 + rng() % 45000;
+                timers.insert({deadlines[token], token});
+            }
+        }
+    }
+    auto elapsed = Clock::now() - start;
+
+    return std::chrono::duration<double, std::nano>(elapsed).count() / ops;
+}
+
+int main(int argc, char **argv)
+{
+    int ops = argc > 1 ? atoi(argv[1]) : 5000000;
+
+    check_virtual_clock();
+    printf("virtual clock checks passed\n");
+
+    printf("%10s %14s %14s\n", "timers", "wheel ns/op", "std::set ns/op");
+    for (int live : {1000, 10000, 100000, 1000000}) {
+        printf("%10d %14.1f %14.1f\n", live, wheel_ops(live, ops),
+               set_ops(live, ops));
+    }
+    return 0;
+}
@@ -0,0 +1,109 @@
+// WebSocket unmasking: every implementation this CPU supports, checked
+// against the plain byte loop and then timed over payload sizes from a
+// small chat message to a max sized one.
+//
+// usage: unmask_bench [--check-only]
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+#include "src/unmask.h"
+
+using Clock = std::chrono::steady_clock;
+
+// random lengths, keys, key offsets and misaligned starts, the result has to
+// match the reference byte for byte
+static bool check(const std::vector<ws::UnmaskImpl> &impls)
+{
+    std::mt19937 rng(42);
+    std::vector<unsigned char> input(4096 + 64), expected, actual;
+    bool ok = true;
+
+    for (int round = 0; round < 20000; round++) {
+        size_t len = rng() % (round < 10000 ? 130 : 4096);
+        size_t align = rng() % 64;
+        size_t key_offset = rng() % 4;
+        unsigned char key[4] = {(unsigned char)rng(), (unsigned char)rng(),
+                                (unsigned char)rng(), (unsigned char)rng()};
+
+        for (auto &b : input) {
+            b = rng();
+        }
+
+        expected = input;
+        impls[0].fn(expected.data() + align, len, key, key_offset);
+
+        for (size_t i = 1; i < impls.size(); i++) {
+            actual = input;
+            impls[i].fn(actual.data() + align, len, key, key_offset);
+
+            // also catches writes outside of [align, align + len)
+            if (actual != expected) {
+                printf("MISMATCH: %s, len %zu, align %zu, key offset %zu\n",
+                       impls[i].name, len, align, key_offset);
+                ok = false;
+            }
+        }
+
+        actual = input;
+        ws::unmask(actual.data() + align, len, key, key_offset);
+        if (actual != expected) {
+            printf("MISMATCH: ws::unmask, len %zu, align %zu, key offset "
+                   "%zu\n",
+                   len, align, key_offset);
+            ok = false;
+        }
+    }
+
+    return ok;
+}
+
+int main(int argc, char **argv)
+{
+    auto impls = ws::unmask_impls();
+
+    if (!check(impls)) {
+        return 1;
+    }
+    printf("all %zu implementations match the byte loop\n", impls.size());
+
+    if (argc > 1 && strcmp(argv[1], "--check-only") == 0) {
+        return 0;
+    }
+
+    const size_t sizes[] = {8, 32, 125, 512, 4096, 16384, 65536};
+    const unsigned char key[4] = {0x12, 0x34, 0x56, 0x78};
+
+    printf("\n%8s", "bytes");
+    for (auto &impl : impls) {
+        printf("  %16s", impl.name);
+    }
+    printf("   (ns per call / GB/s)\n");
+
+    for (size_t size : sizes) {
+        // +1: a payload right after a 2 + 4 byte header is never aligned
+        std::vector<unsigned char> buf(size + 1, 0xAB);
+        unsigned char *data = buf.data() + 1;
+
+        // roughly 256 MB through each implementation
+        size_t iterations = std::max<size_t>(1000, (256 << 20) / size);
+
+        printf("%8zu", size);
+        for (auto &impl : impls) {
+            auto start = Clock::now();
+            for (size_t i = 0; i < iterations; i++) {
+                impl.fn(data, size, key, i % 4);
+                // keep the compiler from folding calls together
+                asm volatile("" : : "r"(data) : "memory");
+            }
+            double ns =
+                std::chrono::duration<double, std::nano>(Clock::now() - start)
+                    .count() /
+                iterations;
+
+            printf("  %7.1f / %6.2f", ns, size / ns);
+        }
+        printf("\n");
+    }
+}
@@ -0,0 +1,473 @@
+#include <cctype>
+#include <cerrno>
+#include <fcntl.h>
+#include <filesystem>
+#include <mutex>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+#include "openssl/evp.h"
+#include "asset_cache.h"
+#include "http.h"
+#include "utils.h"
+#include "spdlog/spdlog.h"
+
+namespace fs = std::filesystem;
+
+// "x.gz" -> "x", empty if `path` isn't named like a compressed variant
+static string variant_base(const string &path)
+{
+    for (const char *ext : {".gz", ".br"}) {
+        if (path.size() > 3 && path.ends_with(ext))
+            return path.substr(0, path.size() - 3);
+    }
+    return "";
+}
+
+static bool compressible(const string &mime)
+{
+    return mime.starts_with("text/") || mime == "application/javascript" ||
+           mime == "application/json" || mime == "application/wasm" ||
+           mime == "image/svg+xml";
+}
+
+static bool read_all(int fd, size_t size, string &out)
+{
+    out.resize(size);
+    size_t done = 0;
+
+    while (done < size) {
+        ssize_t n = pread(fd, out.data() + done, size - done, done);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        done += n;
+    }
+    return true;
+}
+
+// strong validator, the first 64 bits of a SHA-1 of what goes on the wire
+static string content_etag(const Asset &asset)
+{
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int len = 0;
+    EVP_MD_CTX *ctx = EVP_MD_CTX_new();
+    EVP_DigestInit_ex(ctx, EVP_sha1(), nullptr);
+
+    if (asset.fd == -1) {
+        EVP_DigestUpdate(ctx, asset.body.data(), asset.body.size());
+    }
+    else {
+        char chunk[64 * 1024];
+        off_t offset = 0;
+        ssize_t n;
+        while ((n = pread(asset.fd, chunk, sizeof(chunk), offset)) > 0) {
+            EVP_DigestUpdate(ctx, chunk, n);
+            offset += n;
+        }
+    }
+
+    EVP_DigestFinal_ex(ctx, digest, &len);
+    EVP_MD_CTX_free(ctx);
+
+    static const char hex[] = "0123456789abcdef";
+    string etag = "\"";
+    for (int i = 0; i < 8; i++) {
+        etag += hex[digest[i] >> 4];
+        etag += hex[digest[i] & 0xf];
+    }
+    return etag + "\"";
+}
+
+// vite names what it puts in assets/ "<name>-<8 char hash>.<ext>", a new
+// build gets a new name so the old one can be cached forever. The hash has to
+// have a digit or a capital in it, "my-settings.js" isn't one
+static bool content_hashed(const string &path)
+{
+    auto slash = path.rfind('/');
+    if (slash == string::npos || path.find("/assets/") == string::npos)
+        return false;
+
+    auto name = std::string_view(path).substr(slash + 1);
+    auto stem = name.substr(0, name.find('.'));
+    if (stem.size() < 10 || stem[stem.size() - 9] != '-')
+        return false;
+
+    bool mixed = false;
+    for (char c : stem.substr(stem.size() - 8)) {
+        if (!isalnum((unsigned char)c) && c != '_' && c != '-')
+            return false;
+        mixed |= isdigit((unsigned char)c) || isupper((unsigned char)c);
+    }
+    return mixed;
+}
+
+// `path` is the file the asset was loaded for, i.e. the uncompressed one
+static void build_headers(Asset &asset, const string &path,
+                          const string &encoding, bool vary)
+{
+    asset.etag = content_etag(asset);
+
+    string cache_control = content_hashed(path)
+                               ? "Cache-Control: public, max-age=31536000, "
+                                 "immutable"
+                               : "Cache-Control: no-cache";
+
+    for (int status : {200, 304}) {
+        for (bool keep_alive : {true, false}) {
+            http_builder builder;
+            builder.status(status);
+
+            // a 304 has no body, and leaves out the headers describing it
+            if (status == 200) {
+                builder.header("Content-Type: " + asset.mime)
+                    .header("Content-Length: " + std::to_string(asset.size));
+
+                if (!encoding.empty()) {
+                    builder.header("Content-Encoding: " + encoding);
+                }
+            }
+
+            builder.header("ETag: " + asset.etag)
+                .header("Last-Modified: " + utils::http_date(asset.mtime))
+                .header(cache_control);
+
+            // caches in between have to keep the variants apart
+            if (vary) {
+                builder.header("Vary: Accept-Encoding");
+            }
+            builder.header(keep_alive ? "Connection: keep-alive"
+                                      : "Connection: close");
+
+            string &header =
+                status == 200
+                    ? (keep_alive ? asset.header_keep_alive
+                                  : asset.header_close)
+                    : (keep_alive ? asset.header_not_modified_keep_alive
+                                  : asset.header_not_modified_close);
+            header = builder;
+        }
+    }
+}
+
+bool Asset::not_modified(const http_request &req) const
+{
+    // If-None-Match wins when both are there
+    auto if_none_match = req.header("If-None-Match");
+    if (!if_none_match.empty())
+        return utils::etag_matches(if_none_match, this->etag);
+
+    auto if_modified_since = req.header("If-Modified-Since");
+    time_t since;
+    return !if_modified_since.empty() &&
+           utils::parse_http_date(if_modified_since, since) &&
+           this->mtime <= since;
+}
+
+Asset::~Asset()
+{
+    if (this->fd != -1) {
+        close(this->fd);
+    }
+}
+
+AssetCache::AssetCache(string root, size_t sendfile_threshold)
+{
+    this->sendfile_threshold = sendfile_threshold;
+
+    // "dist/" and "dist" are the same directory, relative() counts on there
+    // being no trailing slash
+    while (root.size() > 1 && root.back() == '/') {
+        root.pop_back();
+    }
+    this->root = root;
+
+#ifdef __linux__
+    this->watchfd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (this->watchfd == -1) {
+        perror("inotify_init1");
+    }
+#else
+    spdlog::warn("asset cache: file watching is not supported on this "
+                 "platform, restart the server after rebuilding the app");
+#endif
+
+    this->load_dir(this->root);
+
+    spdlog::info("asset cache: {} files from {}", this->size(), this->root);
+}
+
+AssetCache::~AssetCache()
+{
+    if (this->watchfd != -1) {
+        close(this->watchfd);
+    }
+}
+
+std::shared_ptr<const Asset> AssetCache::find(std::string_view path) const
+{
+    std::shared_lock guard(this->lock);
+
+    auto it = this->assets.find(path);
+    if (it == this->assets.end())
+        return nullptr;
+
+    return it->second;
+}
+
+bool AssetCache::covers(std::string_view path) const
+{
+    return path.size() > this->root.size() &&
+           path.substr(0, this->root.size()) == this->root &&
+           path[this->root.size()] == '/';
+}
+
+size_t AssetCache::size() const
+{
+    std::shared_lock guard(this->lock);
+    return this->assets.size();
+}
+
+void AssetCache::load_dir(const string &dir)
+{
+    std::error_code ec;
+    if (!fs::is_directory(dir, ec)) {
+        spdlog::warn("asset cache: {} is not a directory", dir);
+        return;
+    }
+
+    this->watch_dir(dir);
+
+    for (auto &entry : fs::directory_iterator(dir, ec)) {
+        string path = dir + "/" + entry.path().filename().string();
+
+        if (entry.is_directory(ec)) {
+            this->load_dir(path);
+        }
+        else if (entry.is_regular_file(ec)) {
+            // variants are picked up with the file they belong to
+            string base = variant_base(path);
+            if (!base.empty() && fs::is_regular_file(base, ec))
+                continue;
+
+            this->load_file(path);
+        }
+    }
+}
+
+std::shared_ptr<const Asset>
+Asset::encoded(std::string_view accept_encoding) const
+{
+    if (accept_encoding.empty())
+        return nullptr;
+
+    // brotli is smaller, take it whenever the client can
+    if (this->br && utils::accepts_encoding(accept_encoding, "br"))
+        return this->br;
+    if (this->gzip && utils::accepts_encoding(accept_encoding, "gzip"))
+        return this->gzip;
+
+    return nullptr;
+}
+
+// the file's content (or its fd) and size, nullptr if it can't be read
+std::shared_ptr<Asset> AssetCache::read_file(const string &path,
+                                             struct stat &st)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        if (fd != -1)
+            close(fd);
+        return nullptr;
+    }
+
+    auto asset = std::make_shared<Asset>();
+    asset->path = path;
+    asset->size = st.st_size;
+    asset->mtime = st.st_mtime;
+
+    if (asset->size >= this->sendfile_threshold) {
+        // served with sendfile, the asset owns the fd from now on
+        asset->fd = fd;
+        return asset;
+    }
+
+    bool ok = read_all(fd, asset->size, asset->body);
+    close(fd);
+
+    return ok ? asset : nullptr;
+}
+
+std::shared_ptr<const Asset> AssetCache::load_variant(const Asset &asset,
+                                                      const string &path,
+                                                      time_t mtime,
+                                                      const string &encoding)
+{
+    struct stat st;
+    auto variant = this->read_file(path, st);
+    if (!variant)
+        return nullptr;
+
+    // left over from an older build, better send the real thing
+    if (st.st_mtime < mtime) {
+        spdlog::warn("asset cache: {} is older than {}, ignoring it", path,
+                     asset.path);
+        return nullptr;
+    }
+
+    variant->mime = asset.mime;
+    build_headers(*variant, asset.path, encoding, true);
+
+    return variant;
+}
+
+void AssetCache::load_file(const string &path)
+{
+    // a compressed variant changed, reload the file it belongs to
+    string base = variant_base(path);
+    std::error_code ec;
+    if (!base.empty() && fs::is_regular_file(base, ec)) {
+        this->load_file(base);
+        return;
+    }
+
+    struct stat st;
+    auto asset = this->read_file(path, st);
+
+    if (!asset) {
+        this->remove_file(path);
+        return;
+    }
+
+    string filename = fs::path(path).filename().string();
+    string ext = utils::get_file_ext(filename);
+    auto mime = HTTP::mime_types.find(ext);
+    asset->mime = mime != HTTP::mime_types.end() ? mime->second
+                                                 : "application/octet-stream";
+
+    asset->br = this->load_variant(*asset, path + ".br", st.st_mtime, "br");
+    asset->gzip = this->load_variant(*asset, path + ".gz", st.st_mtime, "gzip");
+
+    // nothing precompressed, compress it now, once. Small files aren't worth
+    // the extra header and the Vary. Neither are the ones big enough to be
+    // sendfile()'d, that would take reading all of it in and keeping the
+    // result in memory: they only have the .gz / .br the build put next to
+    // them
+    if (!asset->gzip && compressible(asset->mime) && asset->fd == -1 &&
+        asset->size >= 1024) {
+        auto gzip = std::make_shared<Asset>();
+
+        if (utils::gzip(asset->body, gzip->body) &&
+            gzip->body.size() < asset->size * 9 / 10) {
+            gzip->path = path + ".gz";
+            gzip->mime = asset->mime;
+            gzip->size = gzip->body.size();
+            gzip->mtime = asset->mtime;
+            build_headers(*gzip, path, "gzip", true);
+            asset->gzip = std::move(gzip);
+        }
+    }
+
+    build_headers(*asset, path, "", asset->br || asset->gzip);
+
+    spdlog::debug("asset cache: loaded {} ({} bytes{}{}{})", path, asset->size,
+                  asset->fd != -1 ? ", sendfile" : "",
+                  asset->gzip ? ", gzip" : "", asset->br ? ", br" : "");
+
+    std::unique_lock guard(this->lock);
+    this->assets[string(this->relative(path))] = std::move(asset);
+}
+
+void AssetCache::remove_file(const string &path)
+{
+    // a compressed variant went away, the file it belonged to stays
+    string base = variant_base(path);
+    if (!base.empty() && this->find(this->relative(base))) {
+        this->load_file(base);
+        return;
+    }
+
+    std::unique_lock guard(this->lock);
+
+    if (this->assets.erase(string(this->relative(path))) > 0) {
+        spdlog::debug("asset cache: dropped {}", path);
+    }
+}
+
+void AssetCache::watch_dir(const string &dir)
+{
+#ifdef __linux__
+    if (this->watchfd == -1)
+        return;
+
+    int wd = inotify_add_watch(this->watchfd, dir.c_str(),
+                               IN_CLOSE_WRITE | IN_CREATE | IN_DELETE |
+                                   IN_MOVED_FROM | IN_MOVED_TO);
+    if (wd == -1) {
+        perror("inotify_add_watch");
+        return;
+    }
+    this->watched_dirs[wd] = dir;
+#endif
+}
+
+void AssetCache::process_events()
+{
+#ifdef __linux__
+    // big enough for a burst of events, they're variable sized
+    alignas(inotify_event) char buf[16 * 1024];
+
+    while (true) {
+        ssize_t len = read(this->watchfd, buf, sizeof(buf));
+        if (len <= 0) {
+            if (len == -1 && errno != EAGAIN) {
+                perror("inotify read");
+            }
+            return;
+        }
+
+        for (char *p = buf; p < buf + len;) {
+            auto ev = reinterpret_cast<inotify_event *>(p);
+            p += sizeof(inotify_event) + ev->len;
+
+            auto dir = this->watched_dirs.find(ev->wd);
+            if (dir == this->watched_dirs.end())
+                continue;
+
+            if (ev->mask & IN_IGNORED) {
+                // the directory itself went away
+                this->watched_dirs.erase(dir);
+                continue;
+            }
+            if (ev->len == 0)
+                continue;
+
+            string path = dir->second + "/" + ev->name;
+
+            if (ev->mask & IN_ISDIR) {
+                if (ev->mask & (IN_CREATE | IN_MOVED_TO)) {
+                    this->load_dir(path);
+                }
+                else if (ev->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                    // every file under it goes
+                    string prefix = string(this->relative(path)) + "/";
+                    std::unique_lock guard(this->lock);
+                    std::erase_if(this->assets, [&prefix](const auto &entry) {
+                        return entry.first.starts_with(prefix);
+                    });
+                }
+            }
+            else if (ev->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) {
+                this->load_file(path);
+            }
+            else if (ev->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                this->remove_file(path);
+            }
+        }
+    }
+#endif
+}
@@ -0,0 +1,142 @@
+#pragma once
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+using std::string;
+
+struct http_request;
+
+// A file from the static directory, ready to go out on the wire: the whole
+// response header block is serialized once when the file is loaded, so
+// serving it is a single writev of {header, body} with nothing formatted or
+// copied per request.
+//
+// Files at or above the sendfile threshold are not read into memory, `body`
+// stays empty and the response body is sendfile()'d from `fd` instead.
+//
+// Compressed versions of the file are assets of their own (with their own
+// headers and body / fd), hung off the original and picked per request by
+// encoded().
+struct Asset {
+    string path;
+    string mime;
+    string body;
+    size_t size = 0;
+    int fd = -1;
+
+    // validators: a hash of exactly the bytes that are sent (so every
+    // variant has its own) and the file's mtime
+    string etag;
+    time_t mtime = 0;
+
+    string header_keep_alive;
+    string header_close;
+    string header_not_modified_keep_alive;
+    string header_not_modified_close;
+
+    std::shared_ptr<const Asset> br;
+    std::shared_ptr<const Asset> gzip;
+
+    ~Asset();
+
+    // the compressed variant to send to a client with this Accept-Encoding,
+    // nullptr if it should get the file as is
+    std::shared_ptr<const Asset> encoded(std::string_view accept_encoding) const;
+
+    // whether the copy the client has (If-None-Match / If-Modified-Since)
+    // is still this one, i.e. it gets a 304
+    bool not_modified(const http_request &req) const;
+
+    const string &header(bool keep_alive) const
+    {
+        return keep_alive ? this->header_keep_alive : this->header_close;
+    }
+
+    const string &not_modified_header(bool keep_alive) const
+    {
+        return keep_alive ? this->header_not_modified_keep_alive
+                          : this->header_not_modified_close;
+    }
+};
+
+// Every file under a directory (the app's dist/) loaded once at startup and
+// shared by all the reactors. Entries are reference counted, so replacing one
+// after a file changed on disk doesn't pull it out from under a response
+// that's still being written.
+//
+// "x.br" / "x.gz" files next to "x" are loaded as its compressed variants
+// instead of being served on their own. Compressible files without a ".gz"
+// get one made when they're loaded, so nothing is ever compressed while
+// answering a request; sendfile()'d ones only have what's on disk.
+//
+// Content-hashed files under assets/ ("index-a1B2c3D4.js") are sent as
+// immutable, everything else has to be revalidated (ETag / 304) on every use.
+//
+// On Linux the directory is watched with inotify and entries are reloaded or
+// dropped as files change; the watch fd is polled by one of the reactors,
+// which calls process_events() when it's readable.
+class AssetCache {
+    // lets find() look a string_view up without making a string of it
+    struct key_hash {
+        using is_transparent = void;
+        size_t operator()(std::string_view key) const
+        {
+            return std::hash<std::string_view>{}(key);
+        }
+    };
+
+    string root;
+    size_t sendfile_threshold;
+
+    mutable std::shared_mutex lock;
+    // keyed by the path under root, "/assets/index-a1B2c3D4.js", which is
+    // also the path it's requested by
+    std::unordered_map<string, std::shared_ptr<const Asset>, key_hash,
+                       std::equal_to<>>
+        assets;
+
+    int watchfd = -1;
+    std::unordered_map<int, string> watched_dirs; // watch descriptor -> dir
+
+    void load_dir(const string &dir);
+    void load_file(const string &path);
+    std::shared_ptr<Asset> read_file(const string &path, struct stat &st);
+    std::shared_ptr<const Asset> load_variant(const Asset &asset,
+                                              const string &path,
+                                              time_t mtime,
+                                              const string &encoding);
+    void remove_file(const string &path);
+    void watch_dir(const string &dir);
+
+  public:
+    AssetCache(string root, size_t sendfile_threshold = SIZE_MAX);
+    ~AssetCache();
+
+    // nullptr if the file isn't cached, `path` is relative to the directory
+    // ("/index.html"), i.e. a request's path
+    std::shared_ptr<const Asset> find(std::string_view path) const;
+
+    // true if the file name `path` is inside the cached directory, i.e. a miss
+    // is a 404 and the disk shouldn't be looked at
+    bool covers(std::string_view path) const;
+    // "<root>/index.html" -> "/index.html", for a path covers() is true for
+    std::string_view relative(std::string_view path) const
+    {
+        return path.substr(this->root.size());
+    }
+
+    size_t size() const;
+
+    int watch_fd() const
+    {
+        return this->watchfd;
+    }
+    void process_events();
+};
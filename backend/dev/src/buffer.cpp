@@ -0,0 +1,73 @@
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include "buffer.h"
+
+void Buffer::prepare(size_t n)
+{
+    if (this->writable() >= n) {
+        return;
+    }
+
+    size_t used = this->size();
+
+    // enough room if the unread bytes are moved back to the front
+    if (this->cap - used >= n) {
+        memmove(this->buf.get(), this->data(), used);
+    }
+    else {
+        size_t new_cap = std::max(this->cap * 2, used + n);
+        auto bigger = std::make_unique<char[]>(new_cap);
+        if (used > 0) {
+            memcpy(bigger.get(), this->data(), used);
+        }
+        this->buf = std::move(bigger);
+        this->cap = new_cap;
+    }
+
+    this->start = 0;
+    this->end = used;
+}
+
+void Buffer::commit(size_t n)
+{
+    assert(n <= this->writable() && "commit past the end of the buffer");
+    this->end += n;
+}
+
+void Buffer::consume(size_t n)
+{
+    assert(n <= this->size() && "consuming more than what was buffered");
+    this->start += n;
+
+    // rewind for free when everything was read
+    if (this->start == this->end) {
+        this->start = this->end = 0;
+    }
+}
+
+void Buffer::erase(size_t offset, size_t n)
+{
+    assert(offset + n <= this->size() && "erasing past the end of the data");
+
+    size_t before = offset;
+    size_t after = this->size() - offset - n;
+
+    if (before < after) {
+        memmove(this->data() + n, this->data(), before);
+        this->consume(n);
+    }
+    else {
+        memmove(this->data() + offset, this->data() + offset + n, after);
+        this->end -= n;
+
+        if (this->start == this->end) {
+            this->start = this->end = 0;
+        }
+    }
+}
+
+void Buffer::clear()
+{
+    this->start = this->end = 0;
+}
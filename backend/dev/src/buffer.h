@@ -0,0 +1,61 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+
+// Growable byte buffer with a read and a write cursor, used as the per
+// connection receive buffer. Bytes are appended at the end (prepare + commit)
+// and dropped from the front (consume); the storage is only reallocated when
+// the unread data doesn't fit anymore, so a connection doing the usual small
+// requests keeps reusing the same block.
+//
+// prepare() may move the unread bytes, so keep offsets, not pointers, across
+// calls to it.
+class Buffer {
+    std::unique_ptr<char[]> buf;
+    size_t cap = 0;
+    size_t start = 0; // first unread byte
+    size_t end = 0;   // one past the last unread byte
+
+  public:
+    char *data()
+    {
+        return this->buf.get() + this->start;
+    }
+    const char *data() const
+    {
+        return this->buf.get() + this->start;
+    }
+    size_t size() const
+    {
+        return this->end - this->start;
+    }
+    bool empty() const
+    {
+        return this->start == this->end;
+    }
+    size_t capacity() const
+    {
+        return this->cap;
+    }
+
+    // room after the unread data, valid until the next prepare()
+    char *write_ptr()
+    {
+        return this->buf.get() + this->end;
+    }
+    size_t writable() const
+    {
+        return this->cap - this->end;
+    }
+
+    // make sure at least n bytes can be written at write_ptr()
+    void prepare(size_t n);
+    // n bytes were written at write_ptr()
+    void commit(size_t n);
+    // drop n bytes from the front
+    void consume(size_t n);
+    // drop n bytes starting at `offset` from data(), by moving whichever side
+    // of the hole is shorter. Pointers into the buffer are invalidated
+    void erase(size_t offset, size_t n);
+    void clear();
+};
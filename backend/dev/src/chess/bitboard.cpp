@@ -0,0 +1,177 @@
+#include <initializer_list>
+#include "bitboard.h"
+
+namespace chess::detail {
+
+Magic BISHOP_MAGICS[64];
+Magic ROOK_MAGICS[64];
+Bitboard PAWN_ATTACKS[2][64];
+Bitboard KNIGHT_ATTACKS[64];
+Bitboard KING_ATTACKS[64];
+Bitboard BETWEEN[64][64];
+Bitboard LINE[64][64];
+
+// every blocker subset of every square's mask, 2^9 at most for a bishop and
+// 2^12 for a rook
+static Bitboard BISHOP_TABLE[5248];
+static Bitboard ROOK_TABLE[102400];
+
+static const int BISHOP_DIRS[4][2] = {{1, 1}, {1, -1}, {-1, 1}, {-1, -1}};
+static const int ROOK_DIRS[4][2] = {{1, 0}, {-1, 0}, {0, 1}, {0, -1}};
+
+static bool on_board(int file, int rank)
+{
+    return file >= 0 && file < 8 && rank >= 0 && rank < 8;
+}
+
+// the slow way, square by square until something is in the way
+static Bitboard slide(Square s, Bitboard occupied, const int (*dirs)[2])
+{
+    Bitboard attacks = 0;
+    for (int d = 0; d < 4; d++) {
+        int file = file_of(s) + dirs[d][0], rank = rank_of(s) + dirs[d][1];
+        while (on_board(file, rank)) {
+            Square to = make_square(file, rank);
+            attacks |= bit(to);
+            if (occupied & bit(to))
+                break;
+            file += dirs[d][0];
+            rank += dirs[d][1];
+        }
+    }
+    return attacks;
+}
+
+static Bitboard jumps(Square s, const int (*offsets)[2], int count)
+{
+    Bitboard attacks = 0;
+    for (int i = 0; i < count; i++) {
+        int file = file_of(s) + offsets[i][0];
+        int rank = rank_of(s) + offsets[i][1];
+        if (on_board(file, rank))
+            attacks |= bit(make_square(file, rank));
+    }
+    return attacks;
+}
+
+// Found by trying sparse random numbers (three ANDed together) until one
+// sends every blocker subset of the square's mask to a slot holding its
+// attacks, different subsets may share a slot when their attacks are the
+// same. The search takes a while, the numbers don't change.
+static const Bitboard BISHOP_MAGIC_NUMBERS[64] = {
+    0x40106000a1160020, 0x0020010250810120, 0x2010010220280081,
+    0x002806004050c040, 0x0002021018000000, 0x2001112010000400,
+    0x0881010120218080, 0x1030820110010500, 0x0000120222042400,
+    0x2000020404040044, 0x8000480094208000, 0x0003422a02000001,
+    0x000a220210100040, 0x8004820202226000, 0x0018234854100800,
+    0x0100004042101040, 0x0004001004082820, 0x0010000810010048,
+    0x1014004208081300, 0x2080818802044202, 0x0040880c00a00100,
+    0x0080400200522010, 0x0001000188180b04, 0x0080249202020204,
+    0x1004400004100410, 0x00013100a0022206, 0x2148500001040080,
+    0x4241080011004300, 0x4020848004002000, 0x10101380d1004100,
+    0x0008004422020284, 0x01010a1041008080, 0x0808080400082121,
+    0x0808080400082121, 0x0091128200100c00, 0x0202200802010104,
+    0x8c0a020200440085, 0x01a0008080b10040, 0x0889520080122800,
+    0x100902022202010a, 0x04081a0816002000, 0x0000681208005000,
+    0x8170840041008802, 0x0a00004200810805, 0x0830404408210100,
+    0x2602208106006102, 0x1048300680802628, 0x2602208106006102,
+    0x0602010120110040, 0x0941010801043000, 0x000040440a210428,
+    0x0008240020880021, 0x0400002012048200, 0x00ac102001210220,
+    0x0220021002009900, 0x84440c080a013080, 0x0001008044200440,
+    0x0004c04410841000, 0x2000500104011130, 0x1a0c010011c20229,
+    0x0044800112202200, 0x0434804908100424, 0x0300404822c08200,
+    0x48081010008a2a80,
+};
+
+static const Bitboard ROOK_MAGIC_NUMBERS[64] = {
+    0x0880004000108025, 0x8040004010002008, 0x2080200010008008,
+    0x1100100008210004, 0xc200209084020008, 0x2100010004000208,
+    0x0400081000822421, 0x0200010422048844, 0x0800800080400024,
+    0x0001402000401000, 0x3000801000802001, 0x4400800800100083,
+    0x0904802402480080, 0x4040800400020080, 0x0018808042000100,
+    0x4040800080004100, 0x0040048001458024, 0x00a0004000205000,
+    0x3100808010002000, 0x4825010010000820, 0x5004808008000401,
+    0x2024818004000a00, 0x0005808002000100, 0x2100060004806104,
+    0x0080400880008421, 0x4062220600410280, 0x010a004a00108022,
+    0x0000100080080080, 0x0021000500080010, 0x0044000202001008,
+    0x0000100400080102, 0xc020128200040545, 0x0080002000400040,
+    0x0000804000802004, 0x0000120022004080, 0x010a386103001001,
+    0x9010080080800400, 0x8440020080800400, 0x0004228824001001,
+    0x000000490a000084, 0x0080002000504000, 0x200020005000c000,
+    0x0012088020420010, 0x0010010080080800, 0x0085001008010004,
+    0x0002000204008080, 0x0040413002040008, 0x0000304081020004,
+    0x0080204000800080, 0x3008804000290100, 0x1010100080200080,
+    0x2008100208028080, 0x5000850800910100, 0x8402019004680200,
+    0x0120911028020400, 0x0000008044010200, 0x0020850200244012,
+    0x0020850200244012, 0x0000102001040841, 0x140900040a100021,
+    0x000200282410a102, 0x000200282410a102, 0x000200282410a102,
+    0x4048240043802106,
+};
+
+static void init_magics(Magic *magics, const Bitboard *numbers,
+                        Bitboard *table, const int (*dirs)[2])
+{
+    for (Square s = 0; s < 64; s++) {
+        // the edges don't block anything further, unless the slider is on
+        // them
+        Bitboard edges = ((RANK_1 | RANK_8) & ~(RANK_1 << (8 * rank_of(s)))) |
+                         ((FILE_A | FILE_H) & ~(FILE_A << file_of(s)));
+        auto &m = magics[s];
+        m.mask = slide(s, 0, dirs) & ~edges;
+        m.magic = numbers[s];
+        m.shift = 64 - popcount(m.mask);
+        m.attacks = table;
+
+        // every subset of the mask, carry-rippler
+        Bitboard b = 0;
+        do {
+            table[m.index(b)] = slide(s, b, dirs);
+            b = (b - m.mask) & m.mask;
+        } while (b);
+        table += Bitboard(1) << popcount(m.mask);
+    }
+}
+
+static void init_lines(Square a)
+{
+    for (Square b = 0; b < 64; b++) {
+        BETWEEN[a][b] = LINE[a][b] = 0;
+        if (a == b)
+            continue;
+
+        for (auto dirs : {BISHOP_DIRS, ROOK_DIRS}) {
+            if (!(slide(a, 0, dirs) & bit(b)))
+                continue;
+            // what each sees of the other, and past it
+            BETWEEN[a][b] = slide(a, bit(b), dirs) & slide(b, bit(a), dirs);
+            LINE[a][b] = (slide(a, 0, dirs) & slide(b, 0, dirs)) | bit(a) |
+                         bit(b);
+        }
+    }
+}
+
+static void init()
+{
+    static const int KNIGHT[8][2] = {{1, 2},  {2, 1},  {2, -1}, {1, -2},
+                                     {-1, -2}, {-2, -1}, {-2, 1}, {-1, 2}};
+    static const int KING[8][2] = {{1, 0},  {1, 1},   {0, 1},  {-1, 1},
+                                   {-1, 0}, {-1, -1}, {0, -1}, {1, -1}};
+    static const int PAWN[2][2][2] = {{{-1, 1}, {1, 1}}, {{-1, -1}, {1, -1}}};
+
+    for (Square s = 0; s < 64; s++) {
+        KNIGHT_ATTACKS[s] = jumps(s, KNIGHT, 8);
+        KING_ATTACKS[s] = jumps(s, KING, 8);
+        PAWN_ATTACKS[White][s] = jumps(s, PAWN[White], 2);
+        PAWN_ATTACKS[Black][s] = jumps(s, PAWN[Black], 2);
+        init_lines(s);
+    }
+
+    init_magics(BISHOP_MAGICS, BISHOP_MAGIC_NUMBERS, BISHOP_TABLE,
+                BISHOP_DIRS);
+    init_magics(ROOK_MAGICS, ROOK_MAGIC_NUMBERS, ROOK_TABLE, ROOK_DIRS);
+}
+
+// before main(), nothing looks at the tables during static initialization
+static const bool initialized = (init(), true);
+
+} // namespace chess::detail
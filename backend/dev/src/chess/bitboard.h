@@ -0,0 +1,136 @@
+#pragma once
+#include <bit>
+#include <cstdint>
+
+// Bitboards: a set of squares as the bits of a uint64_t, bit 0 = a1, 1 = b1
+// .. 63 = h8 (the protocol numbers squares the same way). Attacks are looked
+// up in tables built once at startup, the sliders' with magic bitboards.
+namespace chess {
+
+using Bitboard = uint64_t;
+using Square = int;
+
+static const Square NO_SQUARE = 64;
+
+enum Color : uint8_t { White, Black };
+enum PieceType : uint8_t { Pawn, Knight, Bishop, Rook, Queen, King, NoPiece };
+
+inline Color operator~(Color c)
+{
+    return Color(c ^ 1);
+}
+
+inline int file_of(Square s)
+{
+    return s & 7;
+}
+
+inline int rank_of(Square s)
+{
+    return s >> 3;
+}
+
+inline Square make_square(int file, int rank)
+{
+    return rank * 8 + file;
+}
+
+inline Bitboard bit(Square s)
+{
+    return Bitboard(1) << s;
+}
+
+inline int popcount(Bitboard b)
+{
+    return std::popcount(b);
+}
+
+inline Square lsb(Bitboard b)
+{
+    return std::countr_zero(b);
+}
+
+// the lowest square of `b`, which loses it
+inline Square pop_lsb(Bitboard &b)
+{
+    Square s = std::countr_zero(b);
+    b &= b - 1;
+    return s;
+}
+
+static const Bitboard FILE_A = 0x0101010101010101;
+static const Bitboard FILE_H = FILE_A << 7;
+static const Bitboard RANK_1 = 0xff;
+static const Bitboard RANK_8 = RANK_1 << 56;
+
+namespace detail {
+// what a slider on the square attacks is found by multiplying the blockers
+// on its lines by a number that packs them into the top `shift` bits, an
+// index into its part of one big table
+struct Magic {
+    Bitboard mask;
+    Bitboard magic;
+    const Bitboard *attacks;
+    int shift;
+
+    unsigned index(Bitboard occupied) const
+    {
+        return ((occupied & this->mask) * this->magic) >> this->shift;
+    }
+};
+
+extern Magic BISHOP_MAGICS[64];
+extern Magic ROOK_MAGICS[64];
+extern Bitboard PAWN_ATTACKS[2][64];
+extern Bitboard KNIGHT_ATTACKS[64];
+extern Bitboard KING_ATTACKS[64];
+extern Bitboard BETWEEN[64][64];
+extern Bitboard LINE[64][64];
+} // namespace detail
+
+inline Bitboard pawn_attacks(Color c, Square s)
+{
+    return detail::PAWN_ATTACKS[c][s];
+}
+
+inline Bitboard knight_attacks(Square s)
+{
+    return detail::KNIGHT_ATTACKS[s];
+}
+
+inline Bitboard king_attacks(Square s)
+{
+    return detail::KING_ATTACKS[s];
+}
+
+inline Bitboard bishop_attacks(Square s, Bitboard occupied)
+{
+    auto &m = detail::BISHOP_MAGICS[s];
+    return m.attacks[m.index(occupied)];
+}
+
+inline Bitboard rook_attacks(Square s, Bitboard occupied)
+{
+    auto &m = detail::ROOK_MAGICS[s];
+    return m.attacks[m.index(occupied)];
+}
+
+inline Bitboard queen_attacks(Square s, Bitboard occupied)
+{
+    return bishop_attacks(s, occupied) | rook_attacks(s, occupied);
+}
+
+// the squares strictly between two on a line, nothing if they aren't on one
+inline Bitboard between(Square a, Square b)
+{
+    return detail::BETWEEN[a][b];
+}
+
+// the whole line (rank, file or diagonal) through both, nothing if there
+// isn't one
+inline Bitboard line(Square a, Square b)
+{
+    return detail::LINE[a][b];
+}
+
+} // namespace chess
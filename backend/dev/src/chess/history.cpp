@@ -0,0 +1,63 @@
+#include "history.h"
+
+namespace chess {
+
+// a1 is dark
+static const Bitboard DARK_SQUARES = 0xaa55aa55aa55aa55;
+
+void History::push(const Position &position)
+{
+    // nothing before a capture or pawn move can be repeated after it
+    if (position.halfmove_clock() == 0)
+        this->keys.clear();
+    this->keys.push_back(position.key());
+}
+
+int History::repetitions() const
+{
+    // with the same side to move, every other one
+    int count = 0;
+    for (int i = int(this->keys.size()) - 1; i >= 0; i -= 2) {
+        count += this->keys[i] == this->keys.back();
+    }
+    return count;
+}
+
+// kings and at most one knight or bishop, or only bishops all on squares of
+// the same color
+static bool insufficient_material(const Position &position)
+{
+    Bitboard all = position.occupied();
+    Bitboard kings = position.pieces(White, King) |
+                     position.pieces(Black, King);
+    Bitboard bishops = position.pieces(White, Bishop) |
+                       position.pieces(Black, Bishop);
+    Bitboard knights = position.pieces(White, Knight) |
+                       position.pieces(Black, Knight);
+
+    Bitboard minors = all & ~kings;
+    if (minors & ~(bishops | knights))
+        return false;
+    if (popcount(minors) <= 1)
+        return true;
+    return !knights &&
+           (!(bishops & DARK_SQUARES) || !(bishops & ~DARK_SQUARES));
+}
+
+Result result(const Position &position, const History &history)
+{
+    MoveList moves;
+    position.legal_moves(moves);
+    if (moves.size() == 0)
+        return position.in_check() ? Checkmate : Stalemate;
+
+    if (history.repetitions() >= 3)
+        return Repetition;
+    if (position.halfmove_clock() >= 100)
+        return FiftyMoves;
+    if (insufficient_material(position))
+        return InsufficientMaterial;
+    return Ongoing;
+}
+
+} // namespace chess
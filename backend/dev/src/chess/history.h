@@ -0,0 +1,39 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "position.h"
+
+// What a game needs besides the position to tell when it's over: the
+// positions that came before it, for repetitions.
+namespace chess {
+
+// how a game ended on the board
+enum Result : uint8_t {
+    Ongoing,
+    Checkmate, // the side to move lost
+    Stalemate,
+    Repetition, // the same position a third time
+    FiftyMoves, // 50 moves each without a capture or a pawn move
+    InsufficientMaterial,
+};
+
+// The keys of the positions since the last capture or pawn move, the only
+// ones that can come back: a game never has more than the fifty move rule's
+// 101 of them.
+class History {
+    std::vector<uint64_t> keys;
+
+  public:
+    // the position the game starts from, and the one after every move
+    void push(const Position &position);
+    // how many times the last position pushed has been seen, counting
+    // itself
+    int repetitions() const;
+};
+
+// Mate and stalemate, else the draws the rules make without anyone having
+// to claim them here: threefold repetition, the fifty move rule and neither
+// side having enough to mate with. `history` has `position` last
+Result result(const Position &position, const History &history);
+
+} // namespace chess
@@ -0,0 +1,186 @@
+#include <cstring>
+#include "notation.h"
+
+namespace chess {
+
+static const char PROMOTION_CHARS[] = "nbrq";
+
+static bool parse_square(std::string_view s, Square &square)
+{
+    if (s.size() < 2 || s[0] < 'a' || s[0] > 'h' || s[1] < '1' || s[1] > '8')
+        return false;
+    square = make_square(s[0] - 'a', s[1] - '1');
+    return true;
+}
+
+static void put_square(string &out, Square s)
+{
+    out += char('a' + file_of(s));
+    out += char('1' + rank_of(s));
+}
+
+bool parse_uci(const Position &position, std::string_view uci, Move &move)
+{
+    Square from, to;
+    if (uci.size() < 4 || uci.size() > 5 || !parse_square(uci, from) ||
+        !parse_square(uci.substr(2), to))
+        return false;
+
+    PieceType promotion = NoPiece;
+    if (uci.size() == 5) {
+        const char *p = strchr(PROMOTION_CHARS, uci[4]);
+        if (uci[4] == 0 || p == nullptr)
+            return false;
+        promotion = PieceType(Knight + (p - PROMOTION_CHARS));
+    }
+    return position.find_move(from, to, promotion, move);
+}
+
+string uci(Move move)
+{
+    string out;
+    put_square(out, move.from());
+    put_square(out, move.to());
+    if (move.is_promotion())
+        out += PROMOTION_CHARS[move.promotion() - Knight];
+    return out;
+}
+
+// "NBRQK"[type - Knight]
+static bool parse_piece(char c, PieceType &type)
+{
+    const char *p = strchr("NBRQK", c);
+    if (c == 0 || p == nullptr)
+        return false;
+    type = PieceType(Knight + (p - "NBRQK"));
+    return true;
+}
+
+bool parse_san(const Position &position, std::string_view san, Move &move)
+{
+    // what's said about the move rather than the move
+    while (!san.empty() && strchr("+#!?", san.back()))
+        san.remove_suffix(1);
+
+    MoveList moves;
+    position.legal_moves(moves);
+
+    if (san == "O-O" || san == "0-0" || san == "O-O-O" || san == "0-0-0") {
+        int file = san.size() == 3 ? 6 : 2;
+        for (auto m : moves) {
+            if (m.kind() == Move::Castle && file_of(m.to()) == file) {
+                move = m;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // [piece][from file][from rank][x]to[=promotion], read from the end
+    PieceType promotion = NoPiece;
+    if (!san.empty() && parse_piece(san.back(), promotion)) {
+        san.remove_suffix(1);
+        if (!san.empty() && san.back() == '=')
+            san.remove_suffix(1);
+        if (promotion == King)
+            return false;
+    }
+
+    Square to;
+    if (san.size() < 2 || !parse_square(san.substr(san.size() - 2), to))
+        return false;
+    san.remove_suffix(2);
+    if (!san.empty() && san.back() == 'x')
+        san.remove_suffix(1);
+
+    PieceType piece = Pawn;
+    if (!san.empty() && parse_piece(san[0], piece))
+        san.remove_prefix(1);
+
+    int file = -1, rank = -1;
+    if (!san.empty() && san[0] >= 'a' && san[0] <= 'h') {
+        file = san[0] - 'a';
+        san.remove_prefix(1);
+    }
+    if (!san.empty() && san[0] >= '1' && san[0] <= '8') {
+        rank = san[0] - '1';
+        san.remove_prefix(1);
+    }
+    if (!san.empty())
+        return false;
+
+    int found = 0;
+    for (auto m : moves) {
+        Square from = m.from();
+        if (m.to() == to && position.piece_on(from) == piece &&
+            m.promotion() == promotion && m.kind() != Move::Castle &&
+            (file == -1 || file_of(from) == file) &&
+            (rank == -1 || rank_of(from) == rank)) {
+            move = m;
+            found++;
+        }
+    }
+    return found == 1;
+}
+
+string san(const Position &position, Move move)
+{
+    string out;
+    Square from = move.from(), to = move.to();
+    PieceType piece = position.piece_on(from);
+    bool capture = position.piece_on(to) != NoPiece ||
+                   move.kind() == Move::EnPassant;
+
+    if (move.kind() == Move::Castle) {
+        out = file_of(to) == 6 ? "O-O" : "O-O-O";
+    }
+    else if (piece == Pawn) {
+        if (capture) {
+            out += char('a' + file_of(from));
+            out += 'x';
+        }
+        put_square(out, to);
+        if (move.is_promotion()) {
+            out += '=';
+            out += "NBRQK"[move.promotion() - Knight];
+        }
+    }
+    else {
+        out += "NBRQK"[piece - Knight];
+
+        // the file if that's enough to tell it from the others of its kind
+        // that can go there, else the rank, else both
+        MoveList moves;
+        position.legal_moves(moves);
+        bool ambiguous = false, same_file = false, same_rank = false;
+        for (auto m : moves) {
+            Square other = m.from();
+            if (m.to() != to || other == from ||
+                position.piece_on(other) != piece)
+                continue;
+            ambiguous = true;
+            same_file |= file_of(other) == file_of(from);
+            same_rank |= rank_of(other) == rank_of(from);
+        }
+        if (ambiguous && (!same_file || same_rank))
+            out += char('a' + file_of(from));
+        if (ambiguous && same_file)
+            out += char('1' + rank_of(from));
+
+        if (capture)
+            out += 'x';
+        put_square(out, to);
+    }
+
+    Position after = position;
+    Undo undo;
+    after.make(move, undo);
+    if (after.in_check()) {
+        MoveList replies;
+        after.legal_moves(replies);
+        out += replies.size() == 0 ? '#' : '+';
+    }
+    return out;
+}
+
+} // namespace chess
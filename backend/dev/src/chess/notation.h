@@ -0,0 +1,19 @@
+#pragma once
+#include <string_view>
+#include "position.h"
+
+// Moves as text, both ways. Parsing needs the position: a move is only
+// found if it's legal there.
+namespace chess {
+
+// long algebraic, "e2e4", "e7e8q", castling as the king's move "e1g1"
+bool parse_uci(const Position &position, std::string_view uci, Move &move);
+string uci(Move move);
+
+// standard algebraic, "Nf3", "exd5", "e8=Q+", "O-O". Checks, annotations
+// ("!?") and a missing "=" are let through, an ambiguous move isn't
+bool parse_san(const Position &position, std::string_view san, Move &move);
+// with "+" or "#"
+string san(const Position &position, Move move);
+
+} // namespace chess
@@ -0,0 +1,583 @@
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include "position.h"
+
+namespace chess {
+
+const char *const Position::START_FEN =
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
+
+static const char PIECE_CHARS[] = "pnbrqk";
+
+static const Square A1 = 0, E1 = 4, H1 = 7, A8 = 56, E8 = 60, H8 = 63;
+
+// the rights that go when a piece leaves or is taken on the square
+static uint8_t castling_lost(Square s)
+{
+    switch (s) {
+    case A1:
+        return Position::WHITE_QUEENSIDE;
+    case E1:
+        return Position::WHITE_KINGSIDE | Position::WHITE_QUEENSIDE;
+    case H1:
+        return Position::WHITE_KINGSIDE;
+    case A8:
+        return Position::BLACK_QUEENSIDE;
+    case E8:
+        return Position::BLACK_KINGSIDE | Position::BLACK_QUEENSIDE;
+    case H8:
+        return Position::BLACK_KINGSIDE;
+    default:
+        return 0;
+    }
+}
+
+// Zobrist keys: a random number for each piece on each square, one for
+// black to move, one for each set of castling rights (none is 0) and one for
+// each en passant file. A position's key is the xor of the ones that apply
+struct Keys {
+    uint64_t pieces[2][6][64];
+    uint64_t castling[16];
+    uint64_t en_passant[8];
+    uint64_t black;
+};
+
+// splitmix64 from a fixed seed, so keys are the same in every process
+static constexpr Keys make_keys()
+{
+    Keys keys{};
+    uint64_t state = 0x2545f4914f6cdd1d;
+    auto next = [&state]() {
+        uint64_t z = (state += 0x9e3779b97f4a7c15);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+        return z ^ (z >> 31);
+    };
+
+    for (auto &color : keys.pieces) {
+        for (auto &type : color) {
+            for (auto &square : type)
+                square = next();
+        }
+    }
+    for (int i = 1; i < 16; i++)
+        keys.castling[i] = next();
+    for (auto &file : keys.en_passant)
+        file = next();
+    keys.black = next();
+    return keys;
+}
+
+static constexpr Keys KEYS = make_keys();
+
+// a pawn of `c` moving forward one rank
+static int forward(Color c)
+{
+    return c == White ? 8 : -8;
+}
+
+Position::Position()
+{
+    this->clear();
+    this->set_fen(START_FEN);
+}
+
+void Position::clear()
+{
+    std::fill(std::begin(this->by_type), std::end(this->by_type), 0);
+    std::fill(std::begin(this->by_color), std::end(this->by_color), 0);
+    std::fill(std::begin(this->board), std::end(this->board), NoPiece);
+    this->side = White;
+    this->castling = 0;
+    this->en_passant = NO_SQUARE;
+    this->halfmoves = 0;
+    this->fullmoves = 1;
+    this->zobrist = 0;
+}
+
+void Position::put(Color c, PieceType type, Square s)
+{
+    this->by_type[type] |= bit(s);
+    this->by_color[c] |= bit(s);
+    this->board[s] = type;
+    this->zobrist ^= KEYS.pieces[c][type][s];
+}
+
+void Position::remove(Square s)
+{
+    this->zobrist ^= KEYS.pieces[this->color_on(s)][this->board[s]][s];
+    this->by_type[this->board[s]] &= ~bit(s);
+    this->by_color[White] &= ~bit(s);
+    this->by_color[Black] &= ~bit(s);
+    this->board[s] = NoPiece;
+}
+
+void Position::move_piece(Square from, Square to)
+{
+    Bitboard both = bit(from) | bit(to);
+    Color c = this->color_on(from);
+    auto &keys = KEYS.pieces[c][this->board[from]];
+    this->zobrist ^= keys[from] ^ keys[to];
+    this->by_type[this->board[from]] ^= both;
+    this->by_color[c] ^= both;
+    this->board[to] = this->board[from];
+    this->board[from] = NoPiece;
+}
+
+// after a double push by the side that isn't to move (anymore). A square no
+// pawn can take on would only make equal positions look different
+void Position::set_en_passant(Square s)
+{
+    Color us = this->side;
+    if (pawn_attacks(~us, s) & this->pieces(us, Pawn))
+        this->en_passant = s;
+    else
+        this->en_passant = NO_SQUARE;
+}
+
+uint64_t Position::compute_key() const
+{
+    uint64_t key = KEYS.castling[this->castling];
+    for (Bitboard b = this->occupied(); b;) {
+        Square s = pop_lsb(b);
+        key ^= KEYS.pieces[this->color_on(s)][this->board[s]][s];
+    }
+    if (this->side == Black)
+        key ^= KEYS.black;
+    if (this->en_passant != NO_SQUARE)
+        key ^= KEYS.en_passant[file_of(this->en_passant)];
+    return key;
+}
+
+bool Position::set_fen(std::string_view fen)
+{
+    Position p = *this;
+    p.clear();
+
+    // the fields, the two counters may be missing
+    std::string_view fields[6];
+    int count = 0;
+    while (count < 6) {
+        size_t start = fen.find_first_not_of(' ');
+        if (start == std::string_view::npos)
+            break;
+        fen.remove_prefix(start);
+        size_t end = std::min(fen.find(' '), fen.size());
+        fields[count++] = fen.substr(0, end);
+        fen.remove_prefix(end);
+    }
+    if (count < 4 || fen.find_first_not_of(' ') != std::string_view::npos)
+        return false;
+
+    int file = 0, rank = 7;
+    for (char c : fields[0]) {
+        if (c == '/') {
+            if (file != 8 || rank == 0)
+                return false;
+            file = 0;
+            rank--;
+        }
+        else if (c >= '1' && c <= '8') {
+            file += c - '0';
+            if (file > 8)
+                return false;
+        }
+        else {
+            const char *piece = strchr(PIECE_CHARS, c | 0x20);
+            if (c == 0 || piece == nullptr || file > 7)
+                return false;
+            Color color = c & 0x20 ? Black : White;
+            p.put(color, PieceType(piece - PIECE_CHARS),
+                  make_square(file++, rank));
+        }
+    }
+    if (file != 8 || rank != 0)
+        return false;
+
+    if (fields[1] == "w")
+        p.side = White;
+    else if (fields[1] == "b")
+        p.side = Black;
+    else
+        return false;
+
+    if (fields[2] != "-") {
+        for (char c : fields[2]) {
+            const char *right = strchr("KQkq", c);
+            if (c == 0 || right == nullptr)
+                return false;
+            p.castling |= 1 << (right - "KQkq");
+        }
+    }
+    // only the ones the king and rook are still there for
+    static const Square ROOKS[4] = {H1, A1, H8, A8};
+    for (int i = 0; i < 4; i++) {
+        Color c = i < 2 ? White : Black;
+        if (!(p.pieces(c, King) & bit(c == White ? E1 : E8)) ||
+            !(p.pieces(c, Rook) & bit(ROOKS[i])))
+            p.castling &= ~(1 << i);
+    }
+
+    if (fields[3] != "-") {
+        if (fields[3].size() != 2 || fields[3][0] < 'a' ||
+            fields[3][0] > 'h' || fields[3][1] != (p.side == White ? '6' : '3'))
+            return false;
+        Square s = make_square(fields[3][0] - 'a', fields[3][1] - '1');
+        // the pawn that just went past it
+        if (p.pieces(~p.side, Pawn) & bit(s - forward(p.side)))
+            p.set_en_passant(s);
+    }
+
+    for (int i = 4; i < count; i++) {
+        unsigned n;
+        auto f = fields[i];
+        auto [end, err] = std::from_chars(f.data(), f.data() + f.size(), n);
+        if (err != std::errc() || end != f.data() + f.size() || n > 9999)
+            return false;
+        if (i == 4)
+            p.halfmoves = n;
+        else
+            p.fullmoves = std::max(n, 1u);
+    }
+
+    if (popcount(p.pieces(White, King)) != 1 ||
+        popcount(p.pieces(Black, King)) != 1 ||
+        (p.by_type[Pawn] & (RANK_1 | RANK_8)))
+        return false;
+    // the side that just moved can't have left its king in check
+    Square king = p.king(~p.side);
+    if (p.attackers(king, p.occupied()) & p.pieces(p.side))
+        return false;
+
+    p.zobrist = p.compute_key();
+    *this = p;
+    return true;
+}
+
+string Position::fen() const
+{
+    string out;
+    for (int rank = 7; rank >= 0; rank--) {
+        int empty = 0;
+        for (int file = 0; file < 8; file++) {
+            Square s = make_square(file, rank);
+            if (this->board[s] == NoPiece) {
+                empty++;
+                continue;
+            }
+            if (empty)
+                out += char('0' + empty);
+            empty = 0;
+            char c = PIECE_CHARS[this->board[s]];
+            out += this->color_on(s) == White ? char(c - 0x20) : c;
+        }
+        if (empty)
+            out += char('0' + empty);
+        if (rank > 0)
+            out += '/';
+    }
+
+    out += this->side == White ? " w " : " b ";
+    if (this->castling == 0)
+        out += '-';
+    for (int i = 0; i < 4; i++) {
+        if (this->castling & (1 << i))
+            out += "KQkq"[i];
+    }
+    out += ' ';
+    if (this->en_passant == NO_SQUARE) {
+        out += '-';
+    }
+    else {
+        out += char('a' + file_of(this->en_passant));
+        out += char('1' + rank_of(this->en_passant));
+    }
+    out += ' ' + std::to_string(this->halfmoves) + ' ' +
+           std::to_string(this->fullmoves);
+    return out;
+}
+
+Bitboard Position::attackers(Square s, Bitboard occupied) const
+{
+    auto &t = this->by_type;
+    return (pawn_attacks(White, s) & this->pieces(Black, Pawn)) |
+           (pawn_attacks(Black, s) & this->pieces(White, Pawn)) |
+           (knight_attacks(s) & t[Knight]) | (king_attacks(s) & t[King]) |
+           (bishop_attacks(s, occupied) & (t[Bishop] | t[Queen])) |
+           (rook_attacks(s, occupied) & (t[Rook] | t[Queen]));
+}
+
+Bitboard Position::pinned(Square king) const
+{
+    Color us = this->side;
+    auto &t = this->by_type;
+    Bitboard snipers = ((rook_attacks(king, 0) & (t[Rook] | t[Queen])) |
+                        (bishop_attacks(king, 0) & (t[Bishop] | t[Queen]))) &
+                       this->by_color[~us];
+
+    Bitboard pinned = 0;
+    while (snipers) {
+        Bitboard blockers = between(king, pop_lsb(snipers)) & this->occupied();
+        if (popcount(blockers) == 1)
+            pinned |= blockers & this->by_color[us];
+    }
+    return pinned;
+}
+
+bool Position::in_check() const
+{
+    Color us = this->side;
+    return this->attackers(this->king(us), this->occupied()) &
+           this->by_color[~us];
+}
+
+// a pawn getting to `to`, the last rank makes it four moves
+static void push_pawn(MoveList &moves, Square from, Square to)
+{
+    if (rank_of(to) == 0 || rank_of(to) == 7) {
+        for (int kind = Move::PromoteQueen; kind >= Move::PromoteKnight;
+             kind--)
+            moves.push(Move(from, to, Move::Kind(kind)));
+    }
+    else {
+        moves.push(Move(from, to));
+    }
+}
+
+static void push_all(MoveList &moves, Square from, Bitboard targets)
+{
+    while (targets) {
+        moves.push(Move(from, pop_lsb(targets)));
+    }
+}
+
+// The king moves to squares nothing attacks once it's gone from where it
+// was (it can't hide behind itself from a slider). In check from one piece
+// the others have to take it or get in its way: `target`. In check from two
+// only the king can move. A pinned piece stays on the line through its king
+// and the pinner.
+void Position::generate(MoveList &moves, Bitboard from) const
+{
+    Color us = this->side, them = ~us;
+    Bitboard ours = this->by_color[us], theirs = this->by_color[them];
+    Bitboard occupied = ours | theirs;
+    Square king = this->king(us);
+    Bitboard checkers = this->attackers(king, occupied) & theirs;
+
+    if (from & bit(king)) {
+        Bitboard targets = king_attacks(king) & ~ours;
+        Bitboard without_king = occupied ^ bit(king);
+        while (targets) {
+            Square to = pop_lsb(targets);
+            if (!(this->attackers(to, without_king) & theirs))
+                moves.push(Move(king, to));
+        }
+
+        // through squares that are empty and not attacked, the rook's
+        // b-file square only has to be empty
+        static const struct {
+            uint8_t right;
+            Square king, to;
+            Bitboard empty, safe;
+        } CASTLES[4] = {
+            {WHITE_KINGSIDE, E1, 6, 0x60, 0x60},
+            {WHITE_QUEENSIDE, E1, 2, 0x0e, 0x0c},
+            {BLACK_KINGSIDE, E8, 62, Bitboard(0x60) << 56,
+             Bitboard(0x60) << 56},
+            {BLACK_QUEENSIDE, E8, 58, Bitboard(0x0e) << 56,
+             Bitboard(0x0c) << 56},
+        };
+        for (int i = us == White ? 0 : 2, end = i + 2;
+             i < end && !checkers && this->castling; i++) {
+            auto &c = CASTLES[i];
+            if (!(this->castling & c.right) || (occupied & c.empty))
+                continue;
+            bool safe = true;
+            for (Bitboard b = c.safe; b && safe;) {
+                safe = !(this->attackers(pop_lsb(b), occupied) & theirs);
+            }
+            if (safe)
+                moves.push(Move(c.king, c.to, Move::Castle));
+        }
+    }
+
+    if (popcount(checkers) > 1)
+        return;
+
+    Bitboard target = ~ours;
+    if (checkers)
+        target = between(king, lsb(checkers)) | checkers;
+    Bitboard pinned = this->pinned(king);
+    auto &t = this->by_type;
+
+    // pinned knights never move
+    for (Bitboard b = t[Knight] & ours & ~pinned & from; b;) {
+        Square s = pop_lsb(b);
+        push_all(moves, s, knight_attacks(s) & target);
+    }
+    for (Bitboard b = (t[Bishop] | t[Queen]) & ours & from; b;) {
+        Square s = pop_lsb(b);
+        Bitboard targets = bishop_attacks(s, occupied) & target;
+        if (pinned & bit(s))
+            targets &= line(king, s);
+        push_all(moves, s, targets);
+    }
+    for (Bitboard b = (t[Rook] | t[Queen]) & ours & from; b;) {
+        Square s = pop_lsb(b);
+        Bitboard targets = rook_attacks(s, occupied) & target;
+        if (pinned & bit(s))
+            targets &= line(king, s);
+        push_all(moves, s, targets);
+    }
+
+    int up = forward(us);
+    int start_rank = us == White ? 1 : 6;
+    for (Bitboard b = t[Pawn] & ours & from; b;) {
+        Square s = pop_lsb(b);
+        Bitboard allowed = pinned & bit(s) ? line(king, s) & target : target;
+
+        Square one = s + up;
+        if (!(occupied & bit(one))) {
+            if (allowed & bit(one))
+                push_pawn(moves, s, one);
+            Square two = one + up;
+            if (rank_of(s) == start_rank && !(occupied & bit(two)) &&
+                (allowed & bit(two)))
+                moves.push(Move(s, two, Move::DoublePush));
+        }
+
+        Bitboard captures = pawn_attacks(us, s) & theirs & allowed;
+        while (captures) {
+            push_pawn(moves, s, pop_lsb(captures));
+        }
+
+        // rare enough to check the slow way: the two pawns leaving the
+        // rank can uncover the king, and the pawn taken can be the checker
+        Square ep = this->en_passant;
+        if (ep != NO_SQUARE && (pawn_attacks(us, s) & bit(ep))) {
+            Square taken = ep - up;
+            Bitboard after = (occupied ^ bit(s) ^ bit(taken)) | bit(ep);
+            if (!(this->attackers(king, after) & theirs & ~bit(taken)))
+                moves.push(Move(s, ep, Move::EnPassant));
+        }
+    }
+}
+
+void Position::legal_moves(MoveList &moves) const
+{
+    moves.count = 0;
+    this->generate(moves, ~Bitboard(0));
+}
+
+bool Position::find_move(Square from, Square to, PieceType promotion,
+                         Move &move) const
+{
+    if (!(this->by_color[this->side] & bit(from)))
+        return false;
+
+    MoveList moves;
+    this->generate(moves, bit(from));
+    for (auto m : moves) {
+        if (m.to() == to && m.promotion() == promotion) {
+            move = m;
+            return true;
+        }
+    }
+    return false;
+}
+
+// the rook's move that goes with the king's when castling
+static void castle_rook(Square king_to, Square &from, Square &to)
+{
+    bool kingside = file_of(king_to) == 6;
+    from = king_to + (kingside ? 1 : -2);
+    to = king_to + (kingside ? -1 : 1);
+}
+
+void Position::make(Move move, Undo &undo)
+{
+    Color us = this->side;
+    Square from = move.from(), to = move.to();
+    auto kind = move.kind();
+
+    undo.key = this->zobrist;
+    undo.castling = this->castling;
+    undo.en_passant = this->en_passant;
+    undo.halfmoves = this->halfmoves;
+    undo.captured = PieceType(this->board[to]);
+
+    this->halfmoves++;
+    if (kind == Move::EnPassant) {
+        undo.captured = Pawn;
+        this->remove(to - forward(us));
+    }
+    else if (undo.captured != NoPiece) {
+        this->remove(to);
+    }
+    if (undo.captured != NoPiece || this->board[from] == Pawn)
+        this->halfmoves = 0;
+
+    this->move_piece(from, to);
+    if (move.is_promotion()) {
+        this->remove(to);
+        this->put(us, move.promotion(), to);
+    }
+    else if (kind == Move::Castle) {
+        Square rook_from, rook_to;
+        castle_rook(to, rook_from, rook_to);
+        this->move_piece(rook_from, rook_to);
+    }
+
+    uint8_t castling = this->castling & ~(castling_lost(from) |
+                                          castling_lost(to));
+    this->zobrist ^= KEYS.castling[this->castling] ^ KEYS.castling[castling];
+    this->castling = castling;
+    this->side = ~us;
+    this->zobrist ^= KEYS.black;
+    if (this->en_passant != NO_SQUARE)
+        this->zobrist ^= KEYS.en_passant[file_of(this->en_passant)];
+    this->en_passant = NO_SQUARE;
+    if (kind == Move::DoublePush) {
+        this->set_en_passant(from + forward(us));
+        if (this->en_passant != NO_SQUARE)
+            this->zobrist ^= KEYS.en_passant[file_of(this->en_passant)];
+    }
+    if (us == Black)
+        this->fullmoves++;
+}
+
+void Position::unmake(Move move, const Undo &undo)
+{
+    Color us = ~this->side;
+    Square from = move.from(), to = move.to();
+    auto kind = move.kind();
+
+    this->side = us;
+    if (us == Black)
+        this->fullmoves--;
+
+    if (move.is_promotion()) {
+        this->remove(to);
+        this->put(us, Pawn, to);
+    }
+    else if (kind == Move::Castle) {
+        Square rook_from, rook_to;
+        castle_rook(to, rook_from, rook_to);
+        this->move_piece(rook_to, rook_from);
+    }
+    this->move_piece(to, from);
+
+    if (kind == Move::EnPassant)
+        this->put(~us, Pawn, to - forward(us));
+    else if (undo.captured != NoPiece)
+        this->put(~us, undo.captured, to);
+
+    this->castling = undo.castling;
+    this->en_passant = undo.en_passant;
+    this->halfmoves = undo.halfmoves;
+    // the pieces put back changed it too
+    this->zobrist = undo.key;
+}
+
+} // namespace chess
@@ -0,0 +1,236 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include "bitboard.h"
+
+using std::string;
+
+namespace chess {
+
+// from, to and what kind of move in 16 bits. Captures aren't marked, the
+// board has them. Move() (a1a1) is never legal
+class Move {
+    uint16_t data = 0;
+
+  public:
+    enum Kind : uint8_t {
+        Normal,
+        DoublePush,
+        Castle, // the king's move, the rook follows
+        EnPassant,
+        // promotions, to Knight + kind - PromoteKnight
+        PromoteKnight,
+        PromoteBishop,
+        PromoteRook,
+        PromoteQueen,
+    };
+
+    Move() = default;
+    Move(Square from, Square to, Kind kind = Normal)
+        : data(from | to << 6 | kind << 12)
+    {
+    }
+
+    Square from() const
+    {
+        return this->data & 63;
+    }
+
+    Square to() const
+    {
+        return (this->data >> 6) & 63;
+    }
+
+    Kind kind() const
+    {
+        return Kind(this->data >> 12);
+    }
+
+    bool is_promotion() const
+    {
+        return this->kind() >= PromoteKnight;
+    }
+
+    // NoPiece if it isn't one
+    PieceType promotion() const
+    {
+        if (!this->is_promotion())
+            return NoPiece;
+        return PieceType(Knight + int(this->kind()) - PromoteKnight);
+    }
+
+    bool operator==(const Move &other) const = default;
+};
+
+// the most any position has is 218
+struct MoveList {
+    Move moves[256];
+    size_t count = 0;
+
+    void push(Move move)
+    {
+        this->moves[this->count++] = move;
+    }
+
+    const Move *begin() const
+    {
+        return this->moves;
+    }
+
+    const Move *end() const
+    {
+        return this->moves + this->count;
+    }
+
+    size_t size() const
+    {
+        return this->count;
+    }
+};
+
+// what make() can't work out backwards, for unmake()
+struct Undo {
+    uint64_t key;
+    PieceType captured;
+    uint8_t castling;
+    Square en_passant;
+    uint16_t halfmoves;
+};
+
+// A chess position: a bitboard per piece type and per color, and the board
+// square by square for what's on a given one. Only legal moves are
+// generated, with check and pin masks rather than making each move to see if
+// it leaves the king in check, so checking a client's move is a lookup in a
+// list of a few dozen.
+//
+// It keeps a Zobrist key of itself up to date: make() changes it with a few
+// xors for what the move changed, unmake() puts the old one back.
+class Position {
+  public:
+    // castling rights, bits of castling_rights()
+    static const uint8_t WHITE_KINGSIDE = 1;
+    static const uint8_t WHITE_QUEENSIDE = 2;
+    static const uint8_t BLACK_KINGSIDE = 4;
+    static const uint8_t BLACK_QUEENSIDE = 8;
+
+    static const char *const START_FEN;
+
+  private:
+    Bitboard by_type[6] = {};
+    Bitboard by_color[2] = {};
+    uint8_t board[64]; // PieceType, colors are in by_color
+    Color side = White;
+    uint8_t castling = 0;
+    // only set when a pawn of the side to move is there to take
+    Square en_passant = NO_SQUARE;
+    uint16_t halfmoves = 0; // since the last capture or pawn move
+    uint16_t fullmoves = 1;
+    uint64_t zobrist = 0;
+
+    void clear();
+    void put(Color c, PieceType type, Square s);
+    void remove(Square s);
+    void move_piece(Square from, Square to);
+    void set_en_passant(Square s);
+    // from scratch, make() keeps it up to date
+    uint64_t compute_key() const;
+    // the legal moves of the pieces on `from`
+    void generate(MoveList &moves, Bitboard from) const;
+
+    Bitboard attackers(Square s, Bitboard occupied) const;
+    // the side to move's pieces that alone stand between its king and a
+    // slider of the other side
+    Bitboard pinned(Square king) const;
+
+  public:
+    // the starting position
+    Position();
+
+    // false (and the position is left as it was) for anything that isn't a
+    // well-formed FEN of a position with a king each, where the side that
+    // just moved isn't in check
+    bool set_fen(std::string_view fen);
+    string fen() const;
+
+    Color side_to_move() const
+    {
+        return this->side;
+    }
+
+    PieceType piece_on(Square s) const
+    {
+        return PieceType(this->board[s]);
+    }
+
+    Color color_on(Square s) const
+    {
+        return this->by_color[Black] & bit(s) ? Black : White;
+    }
+
+    Bitboard pieces(Color c) const
+    {
+        return this->by_color[c];
+    }
+
+    Bitboard pieces(Color c, PieceType type) const
+    {
+        return this->by_color[c] & this->by_type[type];
+    }
+
+    Bitboard occupied() const
+    {
+        return this->by_color[White] | this->by_color[Black];
+    }
+
+    Square king(Color c) const
+    {
+        return lsb(this->pieces(c, King));
+    }
+
+    uint8_t castling_rights() const
+    {
+        return this->castling;
+    }
+
+    Square en_passant_square() const
+    {
+        return this->en_passant;
+    }
+
+    int halfmove_clock() const
+    {
+        return this->halfmoves;
+    }
+
+    int fullmove_number() const
+    {
+        return this->fullmoves;
+    }
+
+    // The same for positions that are the same as far as repetitions go:
+    // the pieces, the side to move, the castling rights and a pawn that can
+    // take en passant, not the move counters. What a cache of anything
+    // worked out about a position can be keyed on, across games
+    uint64_t key() const
+    {
+        return this->zobrist;
+    }
+
+    bool in_check() const;
+
+    // every legal move of the side to move
+    void legal_moves(MoveList &moves) const;
+    // the legal move from `from` to `to` (promoting to `promotion`, NoPiece
+    // if it doesn't), false if there's none
+    bool find_move(Square from, Square to, PieceType promotion,
+                   Move &move) const;
+
+    // `move` has to be legal
+    void make(Move move, Undo &undo);
+    // takes back the last move made, with what make() left in `undo`
+    void unmake(Move move, const Undo &undo);
+};
+
+} // namespace chess
@@ -0,0 +1,337 @@
+#include <algorithm>
+#include "games.h"
+
+using proto::Color;
+using proto::Error;
+
+// 6 base 36 digits, short enough to read out to a friend
+static const proto::GameCode MIN_CODE = 60466176;    // 36^5
+static const proto::GameCode MAX_CODE = 2176782335;  // 36^6 - 1
+// how stale the clocks in a shared snapshot can get before it's rebuilt
+static const int64_t SNAPSHOT_CLOCK_MS = 100;
+
+// whose move it is
+static Color turn(const chess::Position &position)
+{
+    return position.side_to_move() == chess::White ? Color::White
+                                                   : Color::Black;
+}
+
+Games::Games(size_t max_games, size_t max_clients)
+    : rng(std::random_device{}())
+{
+    this->max_games = max_games;
+    this->max_clients = max_clients;
+}
+
+bool Games::connect()
+{
+    std::lock_guard<std::mutex> guard(this->lock);
+
+    if (this->clients >= this->max_clients)
+        return false;
+    this->clients++;
+    return true;
+}
+
+void Games::disconnect()
+{
+    std::lock_guard<std::mutex> guard(this->lock);
+    this->clients--;
+}
+
+Error Games::create(PlayerRef player, proto::TimeControl time_control,
+                    proto::GameCode &code)
+{
+    std::lock_guard<std::mutex> guard(this->lock);
+
+    if (this->rooms.size() >= this->max_games)
+        return Error::TooManyGames;
+
+    std::uniform_int_distribution<proto::GameCode> dist(MIN_CODE, MAX_CODE);
+    do {
+        code = dist(this->rng);
+    } while (this->rooms.count(code));
+
+    Room room;
+    room.players[static_cast<int>(Color::White)] = player;
+    room.time_control = time_control;
+    room.left_ms[0] = room.left_ms[1] = time_control.base_ms;
+    room.history.push(room.position);
+    this->rooms.emplace(code, room);
+    return Error::None;
+}
+
+GameClock Games::clock(const Room &room, int64_t now)
+{
+    GameClock clock;
+    if (room.time_control.base_ms == 0)
+        return clock;
+
+    int64_t left[2] = {room.left_ms[0], room.left_ms[1]};
+    int running = static_cast<int>(turn(room.position));
+    if (room.turn_started_ms != 0 && !room.over) {
+        clock.flag_at = room.turn_started_ms + left[running];
+        left[running] -= now - room.turn_started_ms;
+    }
+
+    clock.timed = true;
+    clock.turn = turn(room.position);
+    for (int i = 0; i < 2; i++) {
+        clock.left[i] = std::clamp<int64_t>(left[i], 0, UINT32_MAX);
+    }
+    return clock;
+}
+
+// the reactors of a room's spectators
+static void watching(const std::vector<uint32_t> &counts,
+                     std::vector<int> &watchers)
+{
+    watchers.clear();
+    for (size_t i = 0; i < counts.size(); i++) {
+        if (counts[i] > 0)
+            watchers.push_back(i);
+    }
+}
+
+Error Games::join(proto::GameCode code, PlayerRef player, Color &color,
+                  PlayerRef &opponent, std::vector<int> &watchers,
+                  proto::Encoding encoding, int64_t now, Catchup &catchup)
+{
+    std::lock_guard<std::mutex> guard(this->lock);
+
+    auto it = this->rooms.find(code);
+    if (it == this->rooms.end())
+        return Error::GameNotFound;
+
+    // nothing left to play, it's only there for its spectators
+    if (it->second.over)
+        return Error::GameOver;
+
+    auto &players = it->second.players;
+    if (!players[0]) {
+        color = Color::White;
+    }
+    else if (!players[1]) {
+        color = Color::Black;
+    }
+    else {
+        return Error::GameFull;
+    }
+
+    players[static_cast<int>(color)] = player;
+    opponent = players[static_cast<int>(proto::opposite(color))];
+    watching(it->second.watchers, watchers);
+
+    // the seat someone left in the middle of a game
+    uint64_t from = it->second.moves.empty() ? 0 : Catchup::WHOLE_GAME;
+    this->catch_up(code, it->second, encoding, from, now, catchup);
+    return Error::None;
+}
+
+bool Games::leave(proto::GameCode code, Color color, PlayerRef &opponent,
+                  std::vector<int> &watchers)
+{
+    std::lock_guard<std::mutex> guard(this->lock);
+
+    watchers.clear();
+    auto it = this->rooms.find(code);
+    if (it == this->rooms.end())
+        return false;
+
+    auto &players = it->second.players;
+    players[static_cast<int>(color)] = PlayerRef{};
+    opponent = players[static_cast<int>(proto::opposite(color))];
+    watching(it->second.watchers, watchers);
+
+    if (!opponent) {
+        this->rooms.erase(it);
+        return true;
+    }
+    return false;
+}
+
+Error Games::move(proto::GameCode code, Color color, proto::Move move,
+                  int64_t lag_ms, int64_t now, PlayerRef &opponent,
+                  std::vector<int> &watchers, uint64_t &seq, GameClock &clock,
+                  proto::Result &result)
+{
+    std::lock_guard<std::mutex> guard(this->lock);
+
+    auto it = this->rooms.find(code);
+    if (it == this->rooms.end())
+        return Error::NotInGame;
+
+    auto &room = it->second;
+    opponent = room.players[static_cast<int>(proto::opposite(color))];
+    if (!opponent)
+        return Error::NoOpponent;
+    if (room.over)
+        return Error::GameOver;
+    if (turn(room.position) != color)
+        return Error::NotYourTurn;
+
+    // the promotions are numbered the same, None aside
+    auto promotion = move.promo == proto::Promotion::None
+                         ? chess::NoPiece
+                         : chess::PieceType(move.promo);
+    chess::Move legal;
+    if (!room.position.find_move(move.from, move.to, promotion, legal))
+        return Error::IllegalMove;
+
+    // white's first move starts the clocks
+    if (room.time_control.base_ms > 0) {
+        if (room.turn_started_ms != 0) {
+            int c = static_cast<int>(color);
+            int64_t spent = std::max<int64_t>(
+                0, now - room.turn_started_ms - lag_ms);
+            // too late, its flag is about to be called
+            if (spent >= room.left_ms[c])
+                return Error::GameOver;
+            room.left_ms[c] += room.time_control.increment_ms - spent;
+        }
+        room.turn_started_ms = now;
+    }
+
+    chess::Undo undo;
+    room.position.make(legal, undo);
+    room.history.push(room.position);
+    // numbered the same, the clocks stop if it's over
+    result = proto::Result(chess::result(room.position, room.history));
+    room.over = result != proto::Result::None;
+    room.moves.push_back(move);
+    seq = room.moves.size();
+    watching(room.watchers, watchers);
+    clock = Games::clock(room, now);
+    return Error::None;
+}
+
+bool Games::flag(proto::GameCode code, Color color, int64_t lag_ms,
+                 int64_t now, PlayerRef &opponent, std::vector<int> &watchers,
+                 int64_t &flag_at)
+{
+    std::lock_guard<std::mutex> guard(this->lock);
+
+    flag_at = 0;
+    auto it = this->rooms.find(code);
+    if (it == this->rooms.end())
+        return false;
+
+    auto &room = it->second;
+    if (room.time_control.base_ms == 0 || room.turn_started_ms == 0 ||
+        room.over || turn(room.position) != color)
+        return false;
+
+    int c = static_cast<int>(color);
+    flag_at = room.turn_started_ms + room.left_ms[c];
+    if (now < flag_at + lag_ms)
+        return false;
+
+    room.over = true;
+    room.left_ms[c] = 0;
+    flag_at = 0;
+    // their clocks were still running
+    for (auto &snapshot : room.snapshots)
+        snapshot.frame.reset();
+    opponent = room.players[static_cast<int>(proto::opposite(color))];
+    watching(room.watchers, watchers);
+    return true;
+}
+
+PlayerRef Games::opponent(proto::GameCode code, Color color)
+{
+    std::lock_guard<std::mutex> guard(this->lock);
+
+    auto it = this->rooms.find(code);
+    if (it == this->rooms.end())
+        return {};
+    return it->second.players[static_cast<int>(proto::opposite(color))];
+}
+
+Error Games::watch(proto::GameCode code, int reactor,
+                   proto::Encoding encoding, uint64_t from, int64_t now,
+                   Catchup &catchup)
+{
+    std::lock_guard<std::mutex> guard(this->lock);
+
+    auto it = this->rooms.find(code);
+    if (it == this->rooms.end())
+        return Error::GameNotFound;
+
+    auto &room = it->second;
+    if (room.watchers.size() <= size_t(reactor))
+        room.watchers.resize(reactor + 1);
+    room.watchers[reactor]++;
+    this->catch_up(code, room, encoding, from, now, catchup);
+    return Error::None;
+}
+
+void Games::unwatch(proto::GameCode code, int reactor)
+{
+    std::lock_guard<std::mutex> guard(this->lock);
+
+    // it's gone if the game ended, the count went with it
+    auto it = this->rooms.find(code);
+    if (it == this->rooms.end())
+        return;
+    auto &watchers = it->second.watchers;
+    if (watchers.size() > size_t(reactor) && watchers[reactor] > 0)
+        watchers[reactor]--;
+}
+
+Error Games::catch_up(proto::GameCode code, proto::Encoding encoding,
+                      uint64_t from, int64_t now, Catchup &catchup)
+{
+    std::lock_guard<std::mutex> guard(this->lock);
+
+    auto it = this->rooms.find(code);
+    if (it == this->rooms.end())
+        return Error::GameNotFound;
+    this->catch_up(code, it->second, encoding, from, now, catchup);
+    return Error::None;
+}
+
+void Games::catch_up(proto::GameCode code, Room &room,
+                     proto::Encoding encoding, uint64_t from, int64_t now,
+                     Catchup &out)
+{
+    out.moves.clear();
+    out.snapshot.reset();
+    out.clock = Games::clock(room, now);
+
+    uint64_t seq = room.moves.size();
+    if (from <= seq && seq - from <= Catchup::MAX_MOVES) {
+        out.from = from;
+        out.moves.assign(room.moves.begin() + from, room.moves.end());
+        // what the last move said, like everyone else got it
+        if (room.turn_started_ms != 0)
+            out.clock = Games::clock(room, room.turn_started_ms);
+        return;
+    }
+
+    // built at most once per move, and a few times a second while a clock
+    // in it runs
+    auto &snapshot = room.snapshots[static_cast<int>(encoding)];
+    bool ticking = out.clock.flag_at != 0 &&
+                   now - snapshot.built_ms > SNAPSHOT_CLOCK_MS;
+    if (!snapshot.frame || snapshot.seq != seq || ticking) {
+        proto::ServerMessage msg{
+            .event = proto::Event::Snapshot,
+            .game = code,
+            .moves = room.moves,
+            .fen = room.position.fen(),
+            .timed = out.clock.timed,
+            .clock = {out.clock.left[0], out.clock.left[1]}};
+        snapshot.frame = ws::make_frame(message_opcode(encoding),
+                                        proto::encode(encoding, msg));
+        snapshot.seq = seq;
+        snapshot.built_ms = now;
+    }
+    out.snapshot = snapshot.frame;
+}
+
+size_t Games::size()
+{
+    std::lock_guard<std::mutex> guard(this->lock);
+    return this->rooms.size();
+}
@@ -0,0 +1,176 @@
+#pragma once
+#include <cstddef>
+#include <mutex>
+#include <random>
+#include <unordered_map>
+#include <vector>
+#include "protocol.h"
+#include "slab.h"
+#include "websocket.h"
+#include "chess/history.h"
+#include "chess/position.h"
+
+// each encoding has its own frame type
+inline ws::Opcode message_opcode(proto::Encoding encoding)
+{
+    return encoding == proto::Encoding::Binary ? ws::Opcode::Binary
+                                               : ws::Opcode::Text;
+}
+
+// a player, wherever it's connected: the reactor that owns the connection and
+// the connection's handle there. Stale once the connection is gone, which the
+// owning reactor notices when it looks the handle up
+struct PlayerRef {
+    int reactor = -1;
+    SlabId conn;
+
+    explicit operator bool() const
+    {
+        return this->reactor != -1;
+    }
+};
+
+// A game's clocks at some point: what each side has left and, while one of
+// them is running, when the side to move runs out of time
+struct GameClock {
+    bool timed = false;
+    uint32_t left[2] = {0, 0}; // ms, by Color
+    proto::Color turn = proto::Color::White;
+    int64_t flag_at = 0; // 0 = not running
+};
+
+// What a client needs to be up to date with a game: the moves after the
+// sequence number it has, or the whole game in a Snapshot when that's too far
+// back (or it has nothing). Nothing at all if it's up to date.
+struct Catchup {
+    // the moves it's missing, moves[i] has sequence number from + 1 + i
+    std::vector<proto::Move> moves;
+    uint64_t from = 0;
+    // or the Snapshot message, a ready frame
+    ws::Frame snapshot;
+    // the clocks as of now, or as of the last move with `moves`
+    GameClock clock;
+
+    // for clients that have nothing yet
+    static const uint64_t WHOLE_GAME = UINT64_MAX;
+    // past this many moves a client gets the snapshot instead, it's encoded
+    // once for everyone while moves are encoded for each client
+    static const uint64_t MAX_MOVES = 32;
+};
+
+// Every game being played, shared by all the reactors.
+//
+// Rooms are found by their code in a hash map and hold the players' handles,
+// so relaying a move is one lookup under the lock, never a scan. Each
+// connection remembers the one game it's in, leaving or disconnecting goes
+// straight to it too.
+//
+// Spectators aren't listed here, a room only counts how many each reactor
+// has. The reactors keep their own spectators and fan every update out to
+// them, so what a move costs under the lock doesn't grow with the audience:
+// the calls that change a game hand back the reactors with someone watching.
+//
+// Whoever joins or watches a game that's under way gets a Snapshot of it,
+// which a room keeps ready: it's encoded the first time someone needs it
+// after a move (once per encoding) and from then on shared by everyone.
+//
+// Moves are checked against the room's position before they're passed on,
+// under the lock like everything else: finding one in the legal moves of the
+// piece that moves takes a fraction of a microsecond. The room also keeps
+// the position's Zobrist key after each move since the last capture or pawn
+// move, so a move that ends the game, by mate or a draw by the rules, is
+// seen right away without going back over the board.
+//
+// A game with clocks only keeps what each side had left after its last move
+// and when the side to move's clock started, nothing ticks here. The
+// reactor of the player whose clock runs arms a timer for when it runs out
+// and asks flag() once it goes off. Times are passed in (utils::now_ms()).
+class Games {
+    struct Snapshot {
+        ws::Frame frame;
+        uint64_t seq = 0; // the moves it has
+        int64_t built_ms = 0;
+    };
+
+    struct Room {
+        PlayerRef players[2]; // by Color
+        chess::Position position;
+        chess::History history;         // for repetitions
+        std::vector<proto::Move> moves; // so far, moves[i] is number i + 1
+        std::vector<uint32_t> watchers; // spectators, by reactor
+        Snapshot snapshots[2];          // by Encoding
+
+        proto::TimeControl time_control;
+        int64_t left_ms[2] = {0, 0}; // when the clocks last stopped
+        int64_t turn_started_ms = 0; // 0 = clocks not started yet
+        bool over = false;           // a flag fell or the position ended it
+    };
+
+    std::mutex lock;
+    std::unordered_map<proto::GameCode, Room> rooms;
+    size_t clients = 0;
+
+    size_t max_games;
+    size_t max_clients;
+    std::mt19937_64 rng;
+
+    void catch_up(proto::GameCode code, Room &room, proto::Encoding encoding,
+                  uint64_t from, int64_t now, Catchup &out);
+    static GameClock clock(const Room &room, int64_t now);
+
+  public:
+    Games(size_t max_games, size_t max_clients);
+
+    // a websocket client arriving / leaving, false when there are already
+    // max_clients
+    bool connect();
+    void disconnect();
+
+    // the creator plays white and waits for an opponent
+    proto::Error create(PlayerRef player, proto::TimeControl time_control,
+                        proto::GameCode &code);
+    // takes the free seat, `opponent` is who was already waiting (if anyone).
+    // A game that's under way comes with its snapshot in `catchup`, the
+    // clocks always do. A seat someone left in the middle of a game is free
+    // for whoever has the code: there are no accounts to keep it for, that's
+    // how a player whose connection dropped gets back in. GameOver once the
+    // game has ended
+    proto::Error join(proto::GameCode code, PlayerRef player,
+                      proto::Color &color, PlayerRef &opponent,
+                      std::vector<int> &watchers, proto::Encoding encoding,
+                      int64_t now, Catchup &catchup);
+    // gives up the seat, the room goes once both are empty. True if it did,
+    // its spectators stop watching then
+    bool leave(proto::GameCode code, proto::Color color, PlayerRef &opponent,
+               std::vector<int> &watchers);
+
+    // a move by `color`: checks it's their turn and legal, records it (as
+    // number `seq`) and passes it on. Its clock is charged for the time
+    // since the opponent's move less `lag_ms` (the network's share), `clock`
+    // is where both are at after it. `result` is how it ended the game, if
+    // it did
+    proto::Error move(proto::GameCode code, proto::Color color,
+                      proto::Move move, int64_t lag_ms, int64_t now,
+                      PlayerRef &opponent, std::vector<int> &watchers,
+                      uint64_t &seq, GameClock &clock, proto::Result &result);
+    // `color`'s timer went off: true if it's out of time, with `lag_ms` to
+    // spare, which ends the game. Otherwise `flag_at` is when to ask again,
+    // 0 if its clock isn't running (anymore)
+    bool flag(proto::GameCode code, proto::Color color, int64_t lag_ms,
+              int64_t now, PlayerRef &opponent, std::vector<int> &watchers,
+              int64_t &flag_at);
+    PlayerRef opponent(proto::GameCode code, proto::Color color);
+
+    // one more / one less spectator on `reactor`. `catchup` gets what
+    // happened after move `from`, any later move is fanned out to the
+    // reactor
+    proto::Error watch(proto::GameCode code, int reactor,
+                       proto::Encoding encoding, uint64_t from, int64_t now,
+                       Catchup &catchup);
+    void unwatch(proto::GameCode code, int reactor);
+    // what happened after move `from`, GameNotFound once the game is gone
+    proto::Error catch_up(proto::GameCode code, proto::Encoding encoding,
+                          uint64_t from, int64_t now, Catchup &catchup);
+
+    size_t size();
+};
@@ -2,26 +2,103 @@
 #include <string>
 #include <sstream>
 #include <fstream>
-#include <sys/socket.h>
 #include "openssl/sha.h"
+#include "asset_cache.h"
 #include "http.h"
+#include "out_queue.h"
 #include "utils.h"
 #include "network.h"
 
 using std::string;
 
 std::map<string, string> HTTP::mime_types = {
-    {"txt", "text/plain"},    {"html", "text/html"},
-    {"svg", "image/svg+xml"}, {"wasm", "application/wasm"},
-    {"css", "text/css"},      {"js", "text/javascript"}};
+    {"txt", "text/plain"},        {"html", "text/html"},
+    {"svg", "image/svg+xml"},     {"wasm", "application/wasm"},
+    {"css", "text/css"},          {"js", "text/javascript"},
+    {"json", "application/json"}, {"png", "image/png"},
+    {"ico", "image/x-icon"},      {"woff2", "font/woff2"}};
 
-HTTP::HTTP(int sockfd, http_request &req) : req(req)
+static const char *status_text(int status)
 {
-    this->fd = sockfd;
+    switch (status) {
+    case 101:
+        return "Switching Protocols";
+    case 200:
+        return "OK";
+    case 304:
+        return "Not Modified";
+    case 400:
+        return "Bad Request";
+    case 404:
+        return "Not Found";
+    case 413:
+        return "Content Too Large";
+    case 431:
+        return "Request Header Fields Too Large";
+    case 501:
+        return "Not Implemented";
+    case 503:
+        return "Service Unavailable";
+    default:
+        return "Internal Server Error";
+    }
+}
+
+std::string_view http_request::header(std::string_view name) const
+{
+    for (size_t i = 0; i < this->header_count; i++) {
+        if (utils::iequals(this->headers[i].name, name))
+            return this->headers[i].value;
+    }
+    return {};
+}
+
+HTTP::HTTP(http_request &req, OutQueue &out, AssetCache *assets)
+    : req(req), out(out)
+{
+    this->assets = assets;
+}
+
+void HTTP::sendAsset(std::string_view path)
+{
+    // a miss is a 404, which also keeps "../" in the path from escaping
+    auto asset = this->assets ? this->assets->find(path) : nullptr;
+
+    if (!asset) {
+        this->out.push(this->not_found());
+        return;
+    }
+
+    // picking a variant is a lookup, the compression happened at load
+    if (auto variant = asset->encoded(this->req.header("Accept-Encoding"))) {
+        asset = std::move(variant);
+    }
+
+    // the client's copy is still good, no body
+    if (asset->not_modified(this->req)) {
+        this->out.push(asset, asset->not_modified_header(this->req.keep_alive));
+        return;
+    }
+
+    // nothing is copied, the queue holds on to the asset until it's sent
+    this->out.push(asset, asset->header(this->req.keep_alive));
+
+    if (asset->fd != -1) {
+        this->out.push_file(asset, asset->fd, 0, asset->size);
+    }
+    else {
+        this->out.push(asset, asset->body);
+    }
 }
 
 void HTTP::sendFile(string fileName)
 {
+    // files under the cached directory never touch the disk
+    if (this->assets && this->assets->covers(fileName)) {
+        this->sendAsset(this->assets->relative(fileName));
+        return;
+    }
+
     // TODO: validate the paths
     string prefix = "../";
 
@@ -40,33 +117,27 @@ void HTTP::sendFile(string fileName)
                        .body(content_str)
                        .header("Content-Type: " + HTTP::mime_types[ext])
                        .header("Content-Length: " +
-                               std::to_string(content_str.size()));
+                               std::to_string(content_str.size()))
+                       .header(this->connection_header());
     }
     else {
         response = this->not_found();
     }
 
-    int bytes = send(this->fd, response.data(), response.size(), 0);
-
-    if (bytes == -1) {
-        perror("send error");
-    }
+    this->out.push(std::move(response));
 }
 
-void HTTP::sendText(string text)
+void HTTP::sendText(string text, std::string_view type)
 {
     http_builder builder;
     string response =
         builder.status(200)
             .body(text)
-            .header("Content-Type: text/plain")
-            .header("Content-Length: " + std::to_string(text.size()));
-
-    int bytes = send(this->fd, response.data(), response.size(), 0);
+            .header("Content-Type: " + string(type))
+            .header("Content-Length: " + std::to_string(text.size()))
+            .header(this->connection_header());
 
-    if (bytes == -1) {
-        perror("send error");
-    }
+    this->out.push(std::move(response));
 }
 
 string HTTP::not_found()
@@ -78,13 +149,37 @@ string HTTP::not_found()
         builder.status(404)
             .body(content_str)
             .header("Content-Type: text/plain")
-            .header("Content-Length: " + std::to_string(content_str.size()));
+            .header("Content-Length: " + std::to_string(content_str.size()))
+            .header(this->connection_header());
     return response;
 }
 
-string HTTP::websocket_handshake()
+string HTTP::connection_header() const
 {
-    string key = req.headers["Sec-WebSocket-Key"] + network::WEBSOCKET_UUID_STRING;
+    return this->req.keep_alive ? "Connection: keep-alive"
+                                : "Connection: close";
+}
+
+// plain text error page, the connection is closed after sending it
+string HTTP::error(int status)
+{
+    http_builder builder;
+
+    string content_str = std::to_string(status) + " " + status_text(status);
+    string response =
+        builder.status(status)
+            .body(content_str)
+            .header("Content-Type: text/plain")
+            .header("Content-Length: " + std::to_string(content_str.size()))
+            .header("Connection: close");
+    return response;
+}
+
+string HTTP::websocket_handshake(std::string_view extensions,
+                                 std::string_view protocol)
+{
+    string key = string(req.header("Sec-WebSocket-Key")) +
+                 network::WEBSOCKET_UUID_STRING;
     // convert string to unsigned char
     std::vector<unsigned char> vec(key.begin(), key.end());
     const unsigned char *str = vec.data();
@@ -97,27 +192,24 @@ string HTTP::websocket_handshake()
 
     http_builder builder;
 
-    string response = builder.status(101)
-                          .header("Upgrade: websocket")
-                          .header("Connection: Upgrade")
-                          .header("Sec-WebSocket-Accept: " + base64_key);
-    return response;
+    builder.status(101)
+        .header("Upgrade: websocket")
+        .header("Connection: Upgrade")
+        .header("Sec-WebSocket-Accept: " + base64_key);
+    if (!extensions.empty()) {
+        builder.header("Sec-WebSocket-Extensions: " + string(extensions));
+    }
+    if (!protocol.empty()) {
+        builder.header("Sec-WebSocket-Protocol: " + string(protocol));
+    }
+    return builder;
 }
 
 http_builder::operator string() const
 {
     string res = "";
-    string status_line = std::to_string(this->_status);
-
-    if (this->_status == 200) {
-        status_line += " OK";
-    }
-    else if (this->_status == 101) {
-        status_line += " Switching Protocols";
-    }
-    else {
-        status_line += " Not Found";
-    }
+    string status_line =
+        std::to_string(this->_status) + " " + status_text(this->_status);
 
     res += this->_version + " " + status_line + "\r\n";
 
@@ -126,12 +218,8 @@ http_builder::operator string() const
         res += h + "\r\n";
     }
 
-    if (!this->_body.empty()) {
-        res += "\n";
-        res += this->_body + "\r\n";
-    }
-
     res += "\r\n";
+    res += this->_body;
 
     return res;
 }
@@ -1,17 +1,42 @@
 #pragma once
+#include <array>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <map>
 
 using std::string;
 
+class AssetCache;
+class OutQueue;
+
+static const size_t HTTP_MAX_HEADERS = 32;
+
+struct http_header {
+    std::string_view name;
+    std::string_view value;
+};
+
+// Everything in here points into the connection's receive buffer, so a
+// request is only valid until its handler returns.
 struct http_request {
-    string method;
-    string path;
-    string param;
+    std::string_view method;
+    std::string_view path; // without the query string
+    std::string_view query;
+    std::string_view version;
+    std::string_view param; // what the route's wildcard matched
+    std::string_view body;
 
-    std::map<string, string> headers;
-    bool isWebsocketHandshake;
+    std::array<http_header, HTTP_MAX_HEADERS> headers;
+    size_t header_count = 0;
+
+    bool isWebsocketHandshake = false;
+    // whether the connection stays open after the response, the reactor
+    // turns it off once the connection hits its request limit
+    bool keep_alive = false;
+
+    // case insensitive lookup, empty if the header isn't there
+    std::string_view header(std::string_view name) const;
 };
 
 struct http_builder {
@@ -28,16 +53,30 @@ struct http_builder {
     operator string() const;
 };
 
+// Response side of a request. Nothing is written to the socket from here,
+// responses are appended to the connection's out queue and the reactor
+// flushes it once the handler returns.
 class HTTP {
-    int fd;
     http_request &req;
+    OutQueue &out;
+    AssetCache *assets;
+
+    string connection_header() const;
 
   public:
     static std::map<string, string> mime_types;
-    HTTP(int fd, http_request &req);
+    HTTP(http_request &req, OutQueue &out, AssetCache *assets = nullptr);
 
+    static string error(int status);
     string not_found();
-    string websocket_handshake();
+    // the negotiated Sec-WebSocket-Extensions / Sec-WebSocket-Protocol, if
+    // any
+    string websocket_handshake(std::string_view extensions = {},
+                               std::string_view protocol = {});
     void sendFile(string fileName);
-    void sendText(string text);
+    // a file from the cached directory (Server::cache_static) by its path
+    // under it, "/index.html". Nothing else is looked at, without a cache
+    // it's a 404
+    void sendAsset(std::string_view path);
+    void sendText(string text, std::string_view type = "text/plain");
 };
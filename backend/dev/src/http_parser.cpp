@@ -0,0 +1,220 @@
+#include <charconv>
+#include <cstring>
+#include "http_parser.h"
+#include "utils.h"
+
+HttpParser::HttpParser(size_t max_size)
+{
+    this->max_size = max_size;
+}
+
+void HttpParser::reset()
+{
+    size_t max_size = this->max_size;
+    *this = HttpParser(max_size);
+}
+
+size_t HttpParser::consumed() const
+{
+    return this->body_start + this->content_length;
+}
+
+HttpParser::Status HttpParser::fail(int status)
+{
+    this->error_status = status;
+    return Status::Error;
+}
+
+HttpParser::Status HttpParser::parse(const char *data, size_t len,
+                                     http_request &req)
+{
+    while (this->state != State::Done) {
+        if (this->state == State::Body) {
+            if (len - this->body_start < this->content_length) {
+                return Status::Incomplete;
+            }
+            this->state = State::Done;
+            break;
+        }
+
+        if (this->scanned == len) {
+            return Status::Incomplete;
+        }
+
+        auto nl = static_cast<const char *>(
+            memchr(data + this->scanned, '\n', len - this->scanned));
+
+        if (nl == nullptr) {
+            this->scanned = len;
+            if (len > this->max_size) {
+                return this->fail(431);
+            }
+            return Status::Incomplete;
+        }
+
+        size_t end = nl - data;
+        this->scanned = end + 1;
+
+        if (this->scanned > this->max_size) {
+            return this->fail(431);
+        }
+
+        // lines end with \r\n, but be lenient about a bare \n
+        if (end > this->line_start && data[end - 1] == '\r') {
+            end--;
+        }
+
+        if (this->state == State::RequestLine) {
+            // empty lines before the request line should be ignored
+            // (RFC 9112 2.2)
+            if (end > this->line_start) {
+                if (!this->parse_request_line(data, this->line_start, end)) {
+                    return this->fail(400);
+                }
+                this->state = State::Headers;
+            }
+        }
+        else if (end == this->line_start) {
+            // empty line, end of the headers
+            this->body_start = this->scanned;
+            // not body_start + content_length, a huge Content-Length would
+            // wrap it around. The headers are within max_size already
+            if (this->content_length > this->max_size - this->body_start) {
+                return this->fail(413);
+            }
+            this->state =
+                this->content_length > 0 ? State::Body : State::Done;
+        }
+        else {
+            if (this->header_count == HTTP_MAX_HEADERS) {
+                return this->fail(431);
+            }
+            if (!this->parse_header(data, this->line_start, end)) {
+                return this->fail(this->error_status ? this->error_status
+                                                     : 400);
+            }
+        }
+
+        this->line_start = this->scanned;
+    }
+
+    this->build(data, req);
+    return Status::Complete;
+}
+
+// METHOD SP request-target SP HTTP-version
+bool HttpParser::parse_request_line(const char *data, size_t start,
+                                    size_t end)
+{
+    std::string_view line(data + start, end - start);
+
+    size_t sp1 = line.find(' ');
+    if (sp1 == 0 || sp1 == std::string_view::npos)
+        return false;
+
+    size_t sp2 = line.find(' ', sp1 + 1);
+    if (sp2 == std::string_view::npos || sp2 == sp1 + 1)
+        return false;
+
+    auto version = line.substr(sp2 + 1);
+    if (version.substr(0, 5) != "HTTP/")
+        return false;
+
+    this->method = {uint32_t(start), uint32_t(sp1)};
+    this->target = {uint32_t(start + sp1 + 1), uint32_t(sp2 - sp1 - 1)};
+    this->version = {uint32_t(start + sp2 + 1), uint32_t(version.size())};
+
+    return data[this->target.offset] == '/';
+}
+
+// field-name ":" OWS field-value OWS
+bool HttpParser::parse_header(const char *data, size_t start, size_t end)
+{
+    std::string_view line(data + start, end - start);
+
+    // obsolete line folding is not supported
+    if (line[0] == ' ' || line[0] == '\t')
+        return false;
+
+    size_t colon = line.find(':');
+    if (colon == 0 || colon == std::string_view::npos)
+        return false;
+
+    auto name = line.substr(0, colon);
+    if (name.back() == ' ' || name.back() == '\t')
+        return false;
+
+    auto value = line.substr(colon + 1);
+    size_t first = value.find_first_not_of(" \t");
+    size_t last = value.find_last_not_of(" \t");
+    value = first == std::string_view::npos
+                ? std::string_view()
+                : value.substr(first, last - first + 1);
+
+    if (utils::iequals(name, "Content-Length")) {
+        size_t length;
+        auto res = std::from_chars(value.data(), value.data() + value.size(),
+                                   length);
+        if (res.ec != std::errc() || res.ptr != value.data() + value.size())
+            return false;
+        // two that disagree: a proxy in front may have gone by the other
+        // one, and read the rest as another request
+        if (this->has_content_length && length != this->content_length)
+            return false;
+        this->content_length = length;
+        this->has_content_length = true;
+    }
+    else if (utils::iequals(name, "Transfer-Encoding")) {
+        // chunked request bodies are not supported, nothing we serve
+        // takes a body anyway
+        this->error_status = 501;
+        return false;
+    }
+
+    size_t value_offset = value.empty() ? end : value.data() - data;
+
+    this->names[this->header_count] = {uint32_t(start), uint32_t(colon)};
+    this->values[this->header_count] = {uint32_t(value_offset),
+                                        uint32_t(value.size())};
+    this->header_count++;
+
+    return true;
+}
+
+void HttpParser::build(const char *data, http_request &req) const
+{
+    auto view = [data](Span s) {
+        return std::string_view(data + s.offset, s.length);
+    };
+
+    req.method = view(this->method);
+    req.version = view(this->version);
+
+    auto target = view(this->target);
+    size_t q = target.find('?');
+    req.path = target.substr(0, q);
+    req.query = q == std::string_view::npos ? std::string_view()
+                                            : target.substr(q + 1);
+
+    req.header_count = this->header_count;
+    for (size_t i = 0; i < this->header_count; i++) {
+        req.headers[i] = {view(this->names[i]), view(this->values[i])};
+    }
+
+    req.body = std::string_view(data + this->body_start, this->content_length);
+
+    // persistent by default in HTTP/1.1, opt-in for HTTP/1.0
+    auto connection = req.header("Connection");
+    if (req.version == "HTTP/1.0") {
+        req.keep_alive = utils::has_token(connection, "keep-alive");
+    }
+    else {
+        req.keep_alive = !utils::has_token(connection, "close");
+    }
+
+    req.isWebsocketHandshake =
+        req.method == "GET" &&
+        utils::iequals(req.header("Upgrade"), "websocket") &&
+        utils::has_token(req.header("Connection"), "Upgrade") &&
+        !req.header("Sec-WebSocket-Key").empty();
+}
@@ -0,0 +1,65 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include "http.h"
+
+// Incremental HTTP/1.1 request parser.
+//
+// parse() is handed everything buffered for the connection so far, starting
+// at the first byte of the request. It picks up where the previous call left
+// off, so no byte is looked at twice no matter how the request was split
+// across reads. While a request is incomplete only offsets are kept (the
+// buffer may be reallocated in between calls); once it's complete the
+// http_request is filled with string_views into `data`, nothing is copied or
+// allocated.
+class HttpParser {
+  public:
+    enum class Status { Incomplete, Complete, Error };
+
+  private:
+    enum class State { RequestLine, Headers, Body, Done };
+
+    struct Span {
+        uint32_t offset = 0;
+        uint32_t length = 0;
+    };
+
+    State state = State::RequestLine;
+    size_t scanned = 0;    // everything before this was already parsed
+    size_t line_start = 0; // start of the line being parsed
+    size_t body_start = 0;
+    size_t content_length = 0;
+    bool has_content_length = false;
+    int error_status = 0;
+
+    Span method, target, version;
+    std::array<Span, HTTP_MAX_HEADERS> names;
+    std::array<Span, HTTP_MAX_HEADERS> values;
+    size_t header_count = 0;
+
+    size_t max_size;
+
+    Status fail(int status);
+    bool parse_request_line(const char *data, size_t start, size_t end);
+    bool parse_header(const char *data, size_t start, size_t end);
+    void build(const char *data, http_request &req) const;
+
+  public:
+    // requests (headers + body) bigger than max_size are rejected
+    HttpParser(size_t max_size = 16 * 1024);
+
+    Status parse(const char *data, size_t len, http_request &req);
+
+    // size of the request that was just parsed, i.e. where the next one
+    // starts in a pipelined stream
+    size_t consumed() const;
+
+    // status code to answer with when parse() returned Error
+    int error() const
+    {
+        return this->error_status;
+    }
+
+    void reset();
+};
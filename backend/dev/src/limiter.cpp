@@ -0,0 +1,211 @@
+#include <algorithm>
+#include <bit>
+#include "limiter.h"
+
+// a token, in the millitokens the buckets count
+static const uint64_t TOKEN = 1000;
+// the smallest table a shard has once it's been used
+static const size_t MIN_SLOTS = 16;
+
+// murmur3's finalizer, addresses of one subnet only differ in a few bits
+static uint32_t mix(uint32_t h)
+{
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return h;
+}
+
+Limiter::Limiter(Limits limits)
+{
+    this->limits = limits;
+}
+
+void Limiter::refill(Entry &e, int64_t now) const
+{
+    if (now <= e.refilled_ms)
+        return;
+
+    uint64_t elapsed = now - e.refilled_ms;
+    e.connect_tokens = std::min<uint64_t>(
+        e.connect_tokens + elapsed * this->limits.connect_rate,
+        this->limits.connect_burst * TOKEN);
+    e.message_tokens = std::min<uint64_t>(
+        e.message_tokens + elapsed * this->limits.message_rate,
+        this->limits.message_burst * TOKEN);
+    e.refilled_ms = now;
+}
+
+// nothing a fresh entry wouldn't have
+bool Limiter::idle(const Entry &e, int64_t now) const
+{
+    if (e.connections > 0 || e.banned_until_ms > now)
+        return false;
+
+    uint64_t elapsed = std::max<int64_t>(0, now - e.refilled_ms);
+    return e.connect_tokens + elapsed * this->limits.connect_rate >=
+               this->limits.connect_burst * TOKEN &&
+           e.message_tokens + elapsed * this->limits.message_rate >=
+               this->limits.message_burst * TOKEN;
+}
+
+void Limiter::ban(Entry &e, int64_t now)
+{
+    e.banned_until_ms = now + this->limits.ban_ms;
+    this->bans++;
+}
+
+Limiter::Entry *Limiter::find(Shard &shard, uint32_t hash, uint32_t ip,
+                              int64_t now, bool insert)
+{
+    if (!shard.slots.empty()) {
+        size_t mask = shard.slots.size() - 1;
+        for (size_t i = (hash / SHARDS) & mask;; i = (i + 1) & mask) {
+            auto &e = shard.slots[i];
+            if (e.ip == ip)
+                return &e;
+            if (e.ip == 0)
+                break;
+        }
+    }
+
+    if (!insert)
+        return nullptr;
+
+    // at most half full, probes stay short
+    if ((shard.used + 1) * 2 > shard.slots.size()) {
+        this->rebuild(shard, now);
+    }
+
+    size_t mask = shard.slots.size() - 1;
+    size_t i = (hash / SHARDS) & mask;
+    while (shard.slots[i].ip != 0) {
+        i = (i + 1) & mask;
+    }
+
+    auto &e = shard.slots[i];
+    e = Entry{
+        .ip = ip,
+        .connect_tokens = uint32_t(this->limits.connect_burst * TOKEN),
+        .message_tokens = uint32_t(this->limits.message_burst * TOKEN),
+        .refilled_ms = now,
+    };
+    shard.used++;
+    return &e;
+}
+
+// Moves what's worth keeping to a table 4 times its size, idle entries are
+// forgotten. The next rebuild is at least a quarter of the table's inserts
+// away, so it's O(1) per insert however it goes.
+void Limiter::rebuild(Shard &shard, int64_t now)
+{
+    std::vector<Entry> keep;
+    for (auto &e : shard.slots) {
+        if (e.ip != 0 && !this->idle(e, now))
+            keep.push_back(e);
+    }
+
+    size_t size = std::max(MIN_SLOTS, std::bit_ceil(keep.size() * 4));
+    shard.slots.assign(size, Entry{});
+    shard.used = keep.size();
+
+    size_t mask = size - 1;
+    for (auto &e : keep) {
+        size_t i = (mix(e.ip) / SHARDS) & mask;
+        while (shard.slots[i].ip != 0) {
+            i = (i + 1) & mask;
+        }
+        shard.slots[i] = e;
+    }
+}
+
+bool Limiter::connect(uint32_t ip, int64_t now)
+{
+    uint32_t hash = mix(ip);
+    auto &shard = this->shards[hash % SHARDS];
+    std::lock_guard<std::mutex> guard(shard.lock);
+
+    auto &e = *this->find(shard, hash, ip, now, true);
+
+    if (e.banned_until_ms > now) {
+        this->rejected_connections++;
+        return false;
+    }
+
+    if (e.connections >= this->limits.connections) {
+        this->ban(e, now);
+        this->rejected_connections++;
+        return false;
+    }
+
+    // reconnecting a lot isn't worth a ban, the connections are just refused
+    this->refill(e, now);
+    if (e.connect_tokens < TOKEN) {
+        this->rejected_connections++;
+        return false;
+    }
+
+    e.connect_tokens -= TOKEN;
+    e.connections++;
+    return true;
+}
+
+void Limiter::disconnect(uint32_t ip)
+{
+    uint32_t hash = mix(ip);
+    auto &shard = this->shards[hash % SHARDS];
+    std::lock_guard<std::mutex> guard(shard.lock);
+
+    // it has connections, so it was never dropped
+    auto e = this->find(shard, hash, ip, 0, false);
+    if (e && e->connections > 0)
+        e->connections--;
+}
+
+bool Limiter::message(uint32_t ip, int64_t now)
+{
+    uint32_t hash = mix(ip);
+    auto &shard = this->shards[hash % SHARDS];
+    std::lock_guard<std::mutex> guard(shard.lock);
+
+    auto e = this->find(shard, hash, ip, now, false);
+    if (e == nullptr)
+        return true;
+
+    if (e->banned_until_ms > now) {
+        this->rejected_messages++;
+        return false;
+    }
+
+    this->refill(*e, now);
+    if (e->message_tokens < TOKEN) {
+        this->ban(*e, now);
+        this->rejected_messages++;
+        return false;
+    }
+
+    e->message_tokens -= TOKEN;
+    return true;
+}
+
+bool Limiter::banned(uint32_t ip, int64_t now)
+{
+    uint32_t hash = mix(ip);
+    auto &shard = this->shards[hash % SHARDS];
+    std::lock_guard<std::mutex> guard(shard.lock);
+
+    auto e = this->find(shard, hash, ip, now, false);
+    return e && e->banned_until_ms > now;
+}
+
+size_t Limiter::size()
+{
+    size_t n = 0;
+    for (auto &shard : this->shards) {
+        std::lock_guard<std::mutex> guard(shard.lock);
+        n += shard.used;
+    }
+    return n;
+}
@@ -0,0 +1,85 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+// what a client IP is allowed, see ServerConfig
+struct Limits {
+    uint32_t connections = 10;  // open at once
+    uint32_t connect_rate = 10; // new connections per second
+    uint32_t connect_burst = 20;
+    uint32_t message_rate = 20; // websocket messages per second
+    uint32_t message_burst = 40;
+    int64_t ban_ms = 60000;
+};
+
+// Per IP connection and message limits, shared by all the reactors (the
+// Python backend's _IP_Limiter and _RateLimiter).
+//
+// Every IP that's been seen lately has one entry: how many connections it
+// has open, a token bucket for new connections, one for websocket messages
+// and when its ban (if any) ends. Buckets are refilled from the time that
+// passed whenever the entry is looked at, so nothing ever runs in the
+// background, and a ban is just a timestamp in the entry.
+//
+// Entries live in open addressing tables (linear probing, 32 bytes an
+// entry), split over SHARDS shards with a lock each so reactors rarely wait
+// on each other. An entry that has nothing to remember (no connections, full
+// buckets, no ban) is the same as no entry, those are dropped whenever a
+// table fills up, so a flood of one-off IPs doesn't make it grow for good.
+class Limiter {
+  public:
+    static const int SHARDS = 64;
+
+  private:
+    struct Entry {
+        uint32_t ip = 0; // 0 = free, 0.0.0.0 never connects
+        uint32_t connections = 0;
+        // millitokens, refilled by `rate` per ms
+        uint32_t connect_tokens = 0;
+        uint32_t message_tokens = 0;
+        int64_t refilled_ms = 0;
+        int64_t banned_until_ms = 0;
+    };
+
+    struct alignas(64) Shard {
+        std::mutex lock;
+        std::vector<Entry> slots; // a power of two of them
+        size_t used = 0;
+    };
+
+    Limits limits;
+    Shard shards[SHARDS];
+
+    Entry *find(Shard &shard, uint32_t hash, uint32_t ip, int64_t now,
+                bool insert);
+    void rebuild(Shard &shard, int64_t now);
+    void refill(Entry &e, int64_t now) const;
+    bool idle(const Entry &e, int64_t now) const;
+    void ban(Entry &e, int64_t now);
+
+  public:
+    std::atomic<uint64_t> rejected_connections{0};
+    std::atomic<uint64_t> rejected_messages{0};
+    std::atomic<uint64_t> bans{0};
+
+    explicit Limiter(Limits limits);
+
+    // IPv4 addresses in network byte order, `now` from utils::now_ms()
+
+    // a new connection, false if it should be closed right away: the IP is
+    // banned, connecting too fast, or already has as many connections as it
+    // gets (that one bans it, like the Python backend did)
+    bool connect(uint32_t ip, int64_t now);
+    // one that connect() let through went away
+    void disconnect(uint32_t ip);
+    // a websocket message, false if the IP is banned or sending too fast
+    // (which bans it)
+    bool message(uint32_t ip, int64_t now);
+
+    bool banned(uint32_t ip, int64_t now);
+    // IPs remembered right now
+    size_t size();
+};
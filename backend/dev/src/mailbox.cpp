@@ -0,0 +1,69 @@
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+#include "mailbox.h"
+#include "utils.h"
+
+Mailbox::Mailbox()
+{
+#ifdef __linux__
+    this->read_fd = this->write_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (this->read_fd == -1) {
+        perror("eventfd");
+        exit(EXIT_FAILURE);
+    }
+#else
+    int fds[2];
+    if (pipe(fds) == -1) {
+        perror("pipe");
+        exit(EXIT_FAILURE);
+    }
+    this->read_fd = fds[0];
+    this->write_fd = fds[1];
+    utils::set_nonblocking(this->read_fd);
+    utils::set_nonblocking(this->write_fd);
+#endif
+}
+
+Mailbox::~Mailbox()
+{
+    close(this->read_fd);
+    if (this->write_fd != this->read_fd)
+        close(this->write_fd);
+}
+
+void Mailbox::post(Mail mail)
+{
+    bool was_empty;
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+        was_empty = this->pending.empty();
+        this->pending.push_back(std::move(mail));
+    }
+
+    // the owner hasn't taken the earlier ones yet, it's already been woken
+    if (!was_empty)
+        return;
+
+    uint64_t one = 1;
+    while (write(this->write_fd, &one, sizeof(one)) == -1 && errno == EINTR) {
+    }
+}
+
+void Mailbox::take(std::vector<Mail> &out)
+{
+    // reset the wakeup before looking, a post landing in between either is
+    // in the swap or wakes us again
+    uint64_t buf[16];
+    while (read(this->read_fd, buf, sizeof(buf)) > 0) {
+    }
+
+    out.clear();
+    std::lock_guard<std::mutex> guard(this->lock);
+    out.swap(this->pending);
+}
@@ -0,0 +1,47 @@
+#pragma once
+#include <mutex>
+#include <vector>
+#include "protocol.h"
+#include "slab.h"
+
+// a message for one of a reactor's connections, from another reactor
+struct Mail {
+    SlabId to;
+    proto::ServerMessage msg;
+    // instead of `to`, everyone on the reactor watching this game. With
+    // `game_over` they stop watching afterwards
+    proto::GameCode spectators = 0;
+    bool game_over = false;
+    int64_t posted_us = 0; // for the fan-out latency
+    // the recipient's clock runs out then, see Reactor::deliver()
+    int64_t flag_at = 0;
+};
+
+// How reactors hand each other work: the two players of a game are often on
+// different reactors. Posting is a push under a short lock, plus a wakeup
+// (eventfd, a pipe elsewhere) when the mailbox was empty, so a burst of
+// posts costs the owner one wakeup. The owner watches fd() in its poller and
+// takes everything at once.
+class Mailbox {
+    std::mutex lock;
+    std::vector<Mail> pending;
+    int read_fd;
+    int write_fd;
+
+  public:
+    Mailbox();
+    ~Mailbox();
+
+    Mailbox(const Mailbox &) = delete;
+    Mailbox &operator=(const Mailbox &) = delete;
+
+    int fd() const
+    {
+        return this->read_fd;
+    }
+
+    // any thread
+    void post(Mail mail);
+    // the owner, swaps everything posted so far into `out`
+    void take(std::vector<Mail> &out);
+};
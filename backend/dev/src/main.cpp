@@ -1,5 +1,6 @@
 #include "server.h"
 #include "src/http.h"
+#include <cstring>
 #include <iostream>
 
 #define PORT "9034"
@@ -8,22 +9,61 @@
 
 void root(http_request &req, HTTP &http)
 {
-    http.sendFile("../dist/index.html");
+    http.sendAsset("/index.html");
 }
 
 void root2(http_request &req, HTTP &http)
 {
-    http.sendFile("../dist/" + req.param);
+    http.sendAsset(req.path);
 }
 
 void assets(http_request &req, HTTP &http)
 {
-    http.sendFile("../dist/assets/" + req.param);
+    http.sendAsset(req.path);
 }
 
-int main()
+int main(int argc, char **argv)
 {
-    Server server(PORT, MAX_BUF_SIZE, BACKLOG);
+    ServerConfig config;
+
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--poller=", 9) == 0) {
+            if (!poller::parse_type(argv[i] + 9, config.poller)) {
+                std::cerr << "unknown poller: " << argv[i] + 9
+                          << " (expected poll or epoll)" << std::endl;
+                return 1;
+            }
+        }
+        else if (strncmp(argv[i], "--threads=", 10) == 0) {
+            config.threads = atoi(argv[i] + 10);
+        }
+        else if (strcmp(argv[i], "--pin") == 0) {
+            config.pin_threads = true;
+        }
+        else if (strncmp(argv[i], "--sendfile-threshold=", 21) == 0) {
+            config.sendfile_threshold = strtoull(argv[i] + 21, nullptr, 10);
+        }
+        else if (strcmp(argv[i], "--no-deflate") == 0) {
+            config.ws_deflate = false;
+        }
+        else if (strcmp(argv[i], "--no-limit") == 0) {
+            config.limit = false;
+        }
+        else if (strncmp(argv[i], "--stats=", 8) == 0) {
+            config.stats_path = argv[i] + 8;
+        }
+        else {
+            std::cerr << "usage: " << argv[0]
+                      << " [--poller=poll|epoll] [--threads=N] [--pin]"
+                         " [--sendfile-threshold=BYTES] [--no-deflate]"
+                         " [--no-limit] [--stats=PATH]"
+                      << std::endl;
+            return 1;
+        }
+    }
+
+    Server server(PORT, MAX_BUF_SIZE, BACKLOG, config);
+    server.cache_static("../dist");
     server.route("/", &root);
     server.route("/*", &root2);
     server.route("/assets/*", &assets);
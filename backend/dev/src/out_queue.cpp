@@ -0,0 +1,139 @@
+#include <algorithm>
+#include <cerrno>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include "out_queue.h"
+#include "utils.h"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0 // macOS, SIGPIPE is ignored by the server instead
+#endif
+#ifndef MSG_MORE
+#define MSG_MORE 0
+#endif
+
+// how many segments go into one writev, well under every IOV_MAX
+static const int MAX_IOV = 64;
+
+void OutQueue::push(string data)
+{
+    if (data.empty())
+        return;
+
+    this->total += data.size();
+    this->memory += data.size();
+    this->segments.push_back(Segment{.owned = std::move(data)});
+    this->segments.back().len = this->segments.back().owned.size();
+}
+
+void OutQueue::push(std::shared_ptr<const void> owner, std::string_view data)
+{
+    if (data.empty())
+        return;
+
+    this->total += data.size();
+    this->memory += data.size();
+    this->segments.push_back(Segment{
+        .owner = std::move(owner),
+        .data = data.data(),
+        .len = data.size(),
+    });
+}
+
+void OutQueue::push_file(std::shared_ptr<const void> owner, int fd,
+                         off_t offset, size_t len)
+{
+    if (len == 0)
+        return;
+
+    this->total += len;
+    this->segments.push_back(Segment{
+        .owner = std::move(owner),
+        .fd = fd,
+        .offset = offset,
+        .len = len,
+    });
+}
+
+void OutQueue::clear()
+{
+    this->segments.clear();
+    this->sent = 0;
+    this->total = 0;
+    this->memory = 0;
+}
+
+// drops the n bytes that were just written off the front
+void OutQueue::advance(size_t n)
+{
+    this->total -= n;
+
+    while (n > 0) {
+        auto &front = this->segments.front();
+        size_t done = std::min(n, front.len - this->sent);
+
+        if (front.fd == -1)
+            this->memory -= done;
+
+        n -= done;
+        this->sent += done;
+
+        if (this->sent == front.len) {
+            this->sent = 0;
+            this->segments.pop_front();
+        }
+    }
+}
+
+OutQueue::Status OutQueue::flush(int sockfd)
+{
+    while (!this->segments.empty()) {
+        auto &front = this->segments.front();
+        ssize_t n;
+
+        if (front.fd != -1) {
+            off_t offset = front.offset + this->sent;
+            n = utils::send_file(sockfd, front.fd, &offset,
+                                 front.len - this->sent);
+
+            // the file got shorter than what the header promised
+            if (n == 0)
+                return Status::Error;
+        }
+        else {
+            iovec iov[MAX_IOV];
+            int count = 0;
+            size_t i = 0;
+
+            for (; i < this->segments.size() && count < MAX_IOV; i++) {
+                auto &s = this->segments[i];
+                if (s.fd != -1)
+                    break;
+
+                size_t skip = i == 0 ? this->sent : 0;
+                iov[count++] = {const_cast<char *>(s.bytes()) + skip,
+                                s.len - skip};
+            }
+
+            // MSG_MORE when a file follows: the end of the header should go
+            // in the same packet as the start of the body
+            msghdr msg = {};
+            msg.msg_iov = iov;
+            msg.msg_iovlen = count;
+            bool more = i < this->segments.size();
+            n = sendmsg(sockfd, &msg, MSG_NOSIGNAL | (more ? MSG_MORE : 0));
+        }
+
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return Status::Blocked;
+            return Status::Error;
+        }
+
+        this->advance(n);
+    }
+
+    return Status::Done;
+}
@@ -0,0 +1,68 @@
+#pragma once
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <sys/types.h>
+
+using std::string;
+
+// Everything a connection still has to write, in order. Nothing is ever
+// written with a blocking call: flush() sends as much as the socket takes and
+// the reactor calls it again when the socket becomes writable.
+//
+// A segment either owns its bytes, points into something kept alive by the
+// segment (a cached asset, a frame shared by every spectator of a game), or
+// is a range of a file that goes out with sendfile(). Consecutive memory
+// segments are written with a single writev.
+class OutQueue {
+  public:
+    enum class Status { Done, Blocked, Error };
+
+  private:
+    struct Segment {
+        string owned;
+        std::shared_ptr<const void> owner; // set for borrowed bytes and files
+        const char *data = nullptr;        // borrowed bytes
+        int fd = -1;                       // file, `len` bytes from `offset`
+        off_t offset = 0;
+        size_t len = 0;
+
+        const char *bytes() const
+        {
+            return this->owner ? this->data : this->owned.data();
+        }
+    };
+
+    std::deque<Segment> segments;
+    size_t sent = 0;   // of segments.front()
+    size_t total = 0;  // bytes left to write, over all segments
+    size_t memory = 0; // the part of it that isn't a file
+
+    void advance(size_t n);
+
+  public:
+    void push(string data);
+    // `data` has to stay valid as long as `owner` is alive
+    void push(std::shared_ptr<const void> owner, std::string_view data);
+    void push_file(std::shared_ptr<const void> owner, int fd, off_t offset,
+                   size_t len);
+
+    Status flush(int sockfd);
+    void clear();
+
+    size_t size() const
+    {
+        return this->total;
+    }
+    // what the queue keeps in memory, files only cost their fd
+    size_t buffered() const
+    {
+        return this->memory;
+    }
+    bool empty() const
+    {
+        return this->segments.empty();
+    }
+};
@@ -0,0 +1,204 @@
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include "poller.h"
+#include "spdlog/spdlog.h"
+
+PollerType poller::default_type()
+{
+#ifdef __linux__
+    return PollerType::Epoll;
+#else
+    return PollerType::Poll;
+#endif
+}
+
+bool poller::parse_type(const char *name, PollerType &out)
+{
+    if (strcmp(name, "poll") == 0) {
+        out = PollerType::Poll;
+        return true;
+    }
+    if (strcmp(name, "epoll") == 0) {
+        out = PollerType::Epoll;
+        return true;
+    }
+    return false;
+}
+
+std::unique_ptr<Poller> Poller::create(PollerType type)
+{
+#ifdef __linux__
+    if (type == PollerType::Epoll) {
+        return std::make_unique<EpollPoller>();
+    }
+#else
+    if (type == PollerType::Epoll) {
+        spdlog::warn("epoll is not available, falling back to poll");
+    }
+#endif
+    return std::make_unique<PollPoller>();
+}
+
+static short to_poll_events(uint32_t interest)
+{
+    short events = 0;
+    if (interest & poller::READ)
+        events |= POLLIN;
+    if (interest & poller::WRITE)
+        events |= POLLOUT;
+    return events;
+}
+
+bool PollPoller::add(int fd, uint32_t interest, uint64_t token)
+{
+    if (this->index.count(fd) > 0) {
+        return false;
+    }
+
+    this->index[fd] = this->pfds.size();
+    this->pfds.push_back(pollfd{.fd = fd, .events = to_poll_events(interest)});
+    this->tokens.push_back(token);
+    return true;
+}
+
+bool PollPoller::modify(int fd, uint32_t interest, uint64_t token)
+{
+    auto it = this->index.find(fd);
+    if (it == this->index.end()) {
+        return false;
+    }
+
+    this->pfds[it->second].events = to_poll_events(interest);
+    this->tokens[it->second] = token;
+    return true;
+}
+
+void PollPoller::remove(int fd)
+{
+    auto it = this->index.find(fd);
+    if (it == this->index.end()) {
+        return;
+    }
+
+    // move the last entry into the hole so removal stays O(1)
+    size_t i = it->second;
+    size_t last = this->pfds.size() - 1;
+    if (i != last) {
+        this->pfds[i] = this->pfds[last];
+        this->tokens[i] = this->tokens[last];
+        this->index[this->pfds[i].fd] = i;
+    }
+
+    this->pfds.pop_back();
+    this->tokens.pop_back();
+    this->index.erase(it);
+}
+
+int PollPoller::wait(std::vector<PollEvent> &events, int timeout_ms)
+{
+    events.clear();
+
+    int ready = poll(this->pfds.data(), this->pfds.size(), timeout_ms);
+    if (ready <= 0) {
+        return ready;
+    }
+
+    for (size_t i = 0; i < this->pfds.size() && (int)events.size() < ready;
+         i++) {
+        short revents = this->pfds[i].revents;
+        if (revents == 0)
+            continue;
+
+        events.push_back(PollEvent{
+            .token = this->tokens[i],
+            .readable = (revents & (POLLIN | POLLHUP)) != 0,
+            .writable = (revents & POLLOUT) != 0,
+            .error = (revents & (POLLERR | POLLNVAL)) != 0,
+        });
+    }
+
+    return events.size();
+}
+
+#ifdef __linux__
+static uint32_t to_epoll_events(uint32_t interest)
+{
+    uint32_t events = EPOLLET | EPOLLRDHUP;
+    if (interest & poller::READ)
+        events |= EPOLLIN;
+    if (interest & poller::WRITE)
+        events |= EPOLLOUT;
+    return events;
+}
+
+EpollPoller::EpollPoller(int max_events) : ready(max_events)
+{
+    this->epfd = epoll_create1(EPOLL_CLOEXEC);
+
+    if (this->epfd == -1) {
+        perror("epoll_create1");
+        exit(EXIT_FAILURE);
+    }
+}
+
+EpollPoller::~EpollPoller()
+{
+    close(this->epfd);
+}
+
+bool EpollPoller::add(int fd, uint32_t interest, uint64_t token)
+{
+    epoll_event ev = {.events = to_epoll_events(interest)};
+    ev.data.u64 = token;
+
+    if (epoll_ctl(this->epfd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+        perror("epoll_ctl add");
+        return false;
+    }
+    return true;
+}
+
+bool EpollPoller::modify(int fd, uint32_t interest, uint64_t token)
+{
+    epoll_event ev = {.events = to_epoll_events(interest)};
+    ev.data.u64 = token;
+
+    if (epoll_ctl(this->epfd, EPOLL_CTL_MOD, fd, &ev) == -1) {
+        perror("epoll_ctl mod");
+        return false;
+    }
+    return true;
+}
+
+void EpollPoller::remove(int fd)
+{
+    // the event argument is ignored but pre-2.6.9 kernels want it non-null
+    epoll_event ev = {};
+    epoll_ctl(this->epfd, EPOLL_CTL_DEL, fd, &ev);
+}
+
+int EpollPoller::wait(std::vector<PollEvent> &events, int timeout_ms)
+{
+    events.clear();
+
+    int ready = epoll_wait(this->epfd, this->ready.data(), this->ready.size(),
+                           timeout_ms);
+    if (ready <= 0) {
+        return ready;
+    }
+
+    for (int i = 0; i < ready; i++) {
+        uint32_t e = this->ready[i].events;
+
+        events.push_back(PollEvent{
+            .token = this->ready[i].data.u64,
+            .readable = (e & (EPOLLIN | EPOLLRDHUP | EPOLLHUP)) != 0,
+            .writable = (e & EPOLLOUT) != 0,
+            .error = (e & EPOLLERR) != 0,
+        });
+    }
+
+    return ready;
+}
+#endif
@@ -0,0 +1,92 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include <poll.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
+
+enum class PollerType { Poll, Epoll };
+
+// interest flags passed to Poller::add / Poller::modify
+namespace poller {
+static const uint32_t READ = 1 << 0;
+static const uint32_t WRITE = 1 << 1;
+
+PollerType default_type();
+bool parse_type(const char *name, PollerType &out);
+} // namespace poller
+
+struct PollEvent {
+    // whatever was passed to add(), the server uses it to find the connection
+    // without a lookup by fd
+    uint64_t token;
+
+    bool readable;
+    bool writable;
+    bool error;
+};
+
+// Readiness notification backend for the server's event loop.
+//
+// Every fd registered here MUST be non-blocking: the epoll backend is edge
+// triggered, so a handler has to drain its socket (until EAGAIN) every time
+// it's woken up, otherwise it won't hear about the leftover data again.
+class Poller {
+  public:
+    virtual ~Poller() = default;
+
+    virtual bool add(int fd, uint32_t interest, uint64_t token) = 0;
+    virtual bool modify(int fd, uint32_t interest, uint64_t token) = 0;
+    virtual void remove(int fd) = 0;
+
+    // blocks for at most timeout_ms (-1 = forever), fills `events` with the
+    // fds that are ready and returns how many there are, -1 on error
+    virtual int wait(std::vector<PollEvent> &events, int timeout_ms) = 0;
+
+    virtual const char *name() const = 0;
+
+    static std::unique_ptr<Poller> create(PollerType type);
+};
+
+// poll(2) fallback, O(n) per wakeup since the kernel and us both have to walk
+// every registered fd. Removal is O(1) (swap with the last entry).
+class PollPoller : public Poller {
+    std::vector<pollfd> pfds;
+    std::vector<uint64_t> tokens;
+    std::unordered_map<int, size_t> index; // fd -> position in pfds
+
+  public:
+    bool add(int fd, uint32_t interest, uint64_t token) override;
+    bool modify(int fd, uint32_t interest, uint64_t token) override;
+    void remove(int fd) override;
+    int wait(std::vector<PollEvent> &events, int timeout_ms) override;
+    const char *name() const override
+    {
+        return "poll";
+    }
+};
+
+#ifdef __linux__
+// edge-triggered epoll(7), cost per wakeup only depends on the number of
+// ready fds, not on how many idle connections are registered
+class EpollPoller : public Poller {
+    int epfd;
+    std::vector<epoll_event> ready;
+
+  public:
+    EpollPoller(int max_events = 1024);
+    ~EpollPoller();
+
+    bool add(int fd, uint32_t interest, uint64_t token) override;
+    bool modify(int fd, uint32_t interest, uint64_t token) override;
+    void remove(int fd) override;
+    int wait(std::vector<PollEvent> &events, int timeout_ms) override;
+    const char *name() const override
+    {
+        return "epoll";
+    }
+};
+#endif
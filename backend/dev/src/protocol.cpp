@@ -0,0 +1,700 @@
+#include <cstdio>
+#include <nlohmann/json.hpp>
+#include "protocol.h"
+
+using json = nlohmann::json;
+
+static const char PROMOTION_CHARS[] = " nbrq";
+
+string proto::negotiate(std::string_view offers, Encoding &encoding)
+{
+    encoding = Encoding::Json;
+
+    while (!offers.empty()) {
+        size_t comma = offers.find(',');
+        auto item = offers.substr(0, comma);
+        offers.remove_prefix(comma == std::string_view::npos ? offers.size()
+                                                             : comma + 1);
+
+        size_t first = item.find_first_not_of(" \t");
+        if (first == std::string_view::npos)
+            continue;
+        item = item.substr(first, item.find_last_not_of(" \t") - first + 1);
+
+        // subprotocol names are case sensitive (RFC 6455 4.1)
+        if (item == BINARY_PROTOCOL) {
+            encoding = Encoding::Binary;
+            return BINARY_PROTOCOL;
+        }
+        if (item == JSON_PROTOCOL) {
+            return JSON_PROTOCOL;
+        }
+    }
+
+    return "";
+}
+
+string proto::game_code_str(GameCode code)
+{
+    char buf[16];
+    int i = sizeof(buf);
+
+    do {
+        buf[--i] = "0123456789abcdefghijklmnopqrstuvwxyz"[code % 36];
+        code /= 36;
+    } while (code > 0);
+
+    return string(buf + i, sizeof(buf) - i);
+}
+
+bool proto::parse_game_code(std::string_view s, GameCode &code)
+{
+    // 12 base 36 digits already don't fit in 62 bits, don't bother with
+    // overflow past that
+    if (s.empty() || s.size() > 12)
+        return false;
+
+    code = 0;
+    for (char c : s) {
+        int digit;
+        if (c >= '0' && c <= '9')
+            digit = c - '0';
+        else if (c >= 'a' && c <= 'z')
+            digit = c - 'a' + 10;
+        else if (c >= 'A' && c <= 'Z')
+            digit = c - 'A' + 10;
+        else
+            return false;
+        code = code * 36 + digit;
+    }
+    return true;
+}
+
+bool proto::parse_move(std::string_view uci, Move &move)
+{
+    if (uci.size() != 4 && uci.size() != 5)
+        return false;
+
+    for (int i = 0; i < 4; i += 2) {
+        if (uci[i] < 'a' || uci[i] > 'h' || uci[i + 1] < '1' ||
+            uci[i + 1] > '8')
+            return false;
+    }
+
+    move.from = (uci[1] - '1') * 8 + (uci[0] - 'a');
+    move.to = (uci[3] - '1') * 8 + (uci[2] - 'a');
+    move.promo = Promotion::None;
+
+    if (uci.size() == 5) {
+        // 1.. skips None
+        for (int p = 1; p < 5; p++) {
+            if (uci[4] == PROMOTION_CHARS[p])
+                move.promo = static_cast<Promotion>(p);
+        }
+        if (move.promo == Promotion::None)
+            return false;
+    }
+
+    return true;
+}
+
+string proto::move_str(Move move)
+{
+    string s = {char('a' + move.from % 8), char('1' + move.from / 8),
+                char('a' + move.to % 8), char('1' + move.to / 8)};
+    if (move.promo != Promotion::None) {
+        s += PROMOTION_CHARS[static_cast<uint8_t>(move.promo)];
+    }
+    return s;
+}
+
+bool proto::parse_time_control(std::string_view s, TimeControl &tc)
+{
+    size_t plus = s.find('+');
+    if (plus == std::string_view::npos)
+        return false;
+
+    uint64_t seconds[2];
+    std::string_view parts[2] = {s.substr(0, plus), s.substr(plus + 1)};
+    for (int i = 0; i < 2; i++) {
+        if (parts[i].empty() || parts[i].size() > 6)
+            return false;
+        seconds[i] = 0;
+        for (char c : parts[i]) {
+            if (c < '0' || c > '9')
+                return false;
+            seconds[i] = seconds[i] * 10 + (c - '0');
+        }
+    }
+
+    tc.base_ms = seconds[0] * 1000;
+    tc.increment_ms = seconds[1] * 1000;
+    return true;
+}
+
+string proto::time_control_str(TimeControl tc)
+{
+    return std::to_string(tc.base_ms / 1000) + "+" +
+           std::to_string(tc.increment_ms / 1000);
+}
+
+void proto::put_varint(string &out, uint64_t v)
+{
+    while (v >= 0x80) {
+        out += char(v | 0x80);
+        v >>= 7;
+    }
+    out += char(v);
+}
+
+bool proto::get_varint(std::string_view &in, uint64_t &v)
+{
+    v = 0;
+    for (size_t i = 0; i < in.size() && i < 10; i++) {
+        uint8_t b = in[i];
+        v |= uint64_t(b & 0x7F) << (7 * i);
+
+        if (!(b & 0x80)) {
+            in.remove_prefix(i + 1);
+            return true;
+        }
+    }
+    return false;
+}
+
+// what a message says once the encoding is out of the way
+static bool interpret(uint64_t type, const std::string_view *payload,
+                      const uint64_t *seq, proto::ClientMessage &msg)
+{
+    using proto::Type;
+
+    if (type > static_cast<uint8_t>(Type::Sync))
+        return false;
+
+    msg.type = static_cast<Type>(type);
+    if (msg.type == Type::Create) {
+        msg.time_control = {};
+        return payload == nullptr ||
+               proto::parse_time_control(*payload, msg.time_control);
+    }
+    if (payload == nullptr)
+        return false;
+
+    switch (msg.type) {
+    case Type::Join:
+    case Type::Leave:
+    case Type::Spectate:
+        return proto::parse_game_code(*payload, msg.game);
+    case Type::Chat:
+        msg.text = *payload;
+        return true;
+    case Type::Move:
+        return proto::parse_move(*payload, msg.move);
+    case Type::Sync:
+        if (seq == nullptr)
+            return false;
+        msg.seq = *seq;
+        return proto::parse_game_code(*payload, msg.game);
+    default:
+        return false;
+    }
+}
+
+// RFC 3629: no overlong forms, no surrogates, nothing past U+10FFFF
+static bool valid_utf8(std::string_view s)
+{
+    auto p = reinterpret_cast<const unsigned char *>(s.data());
+    size_t n = s.size(), i = 0;
+
+    while (i < n) {
+        unsigned char c = p[i];
+        if (c < 0x80) {
+            i++;
+            continue;
+        }
+
+        size_t len;
+        uint32_t cp;
+        if ((c & 0xE0) == 0xC0) {
+            len = 2;
+            cp = c & 0x1F;
+        }
+        else if ((c & 0xF0) == 0xE0) {
+            len = 3;
+            cp = c & 0x0F;
+        }
+        else if ((c & 0xF8) == 0xF0) {
+            len = 4;
+            cp = c & 0x07;
+        }
+        else {
+            return false;
+        }
+
+        if (i + len > n)
+            return false;
+        for (size_t k = 1; k < len; k++) {
+            if ((p[i + k] & 0xC0) != 0x80)
+                return false;
+            cp = (cp << 6) | (p[i + k] & 0x3F);
+        }
+
+        static const uint32_t min_cp[] = {0, 0, 0x80, 0x800, 0x10000};
+        if (cp < min_cp[len] || cp > 0x10FFFF ||
+            (cp >= 0xD800 && cp <= 0xDFFF))
+            return false;
+        i += len;
+    }
+    return true;
+}
+
+static void skip_ws(std::string_view s, size_t &i)
+{
+    while (i < s.size() &&
+           (s[i] == ' ' || s[i] == '\t' || s[i] == '\n' || s[i] == '\r'))
+        i++;
+}
+
+// a plain unsigned number of at most `max_digits` digits without leading
+// zeros, anything else is for the DOM parser
+static bool scan_uint(std::string_view s, size_t &i, size_t max_digits,
+                      uint64_t &value)
+{
+    size_t start = i;
+    value = 0;
+    while (i < s.size() && s[i] >= '0' && s[i] <= '9' &&
+           i - start < max_digits) {
+        value = value * 10 + (s[i] - '0');
+        i++;
+    }
+    return i > start && !(s[start] == '0' && i - start > 1);
+}
+
+// The fast path, false means "not sure", never "invalid": the DOM parser has
+// the last word on anything this doesn't recognize.
+static bool scan_json(std::string_view s, uint64_t &type, bool &has_payload,
+                      std::string_view &payload, bool &has_seq, uint64_t &seq)
+{
+    bool has_type = false;
+    has_payload = false;
+    has_seq = false;
+
+    size_t i = 0;
+    skip_ws(s, i);
+    if (i == s.size() || s[i] != '{')
+        return false;
+    i++;
+
+    while (true) {
+        skip_ws(s, i);
+        if (i == s.size() || s[i] != '"')
+            return false;
+
+        // a key with an escaped quote won't match either name anyway
+        size_t end = s.find('"', i + 1);
+        if (end == std::string_view::npos)
+            return false;
+        auto key = s.substr(i + 1, end - i - 1);
+        i = end + 1;
+
+        skip_ws(s, i);
+        if (i == s.size() || s[i] != ':')
+            return false;
+        i++;
+        skip_ws(s, i);
+
+        if (key == "type" && !has_type) {
+            // small, the only thing it can be
+            if (!scan_uint(s, i, 3, type))
+                return false;
+            has_type = true;
+        }
+        else if (key == "seq" && !has_seq) {
+            // games never get anywhere near 10^15 moves
+            if (!scan_uint(s, i, 15, seq))
+                return false;
+            has_seq = true;
+        }
+        else if (key == "payload" && !has_payload) {
+            if (i == s.size() || s[i] != '"')
+                return false;
+
+            size_t start = ++i;
+            while (i < s.size() && s[i] != '"') {
+                // escapes (and control characters, which have to be
+                // escaped) are for the DOM parser
+                if (static_cast<unsigned char>(s[i]) < 0x20 || s[i] == '\\')
+                    return false;
+                i++;
+            }
+            if (i == s.size())
+                return false;
+
+            payload = s.substr(start, i - start);
+            i++;
+            if (!valid_utf8(payload))
+                return false;
+            has_payload = true;
+        }
+        else {
+            return false;
+        }
+
+        skip_ws(s, i);
+        if (i < s.size() && s[i] == ',') {
+            i++;
+            continue;
+        }
+        if (i < s.size() && s[i] == '}') {
+            i++;
+            break;
+        }
+        return false;
+    }
+
+    skip_ws(s, i);
+    return i == s.size() && has_type;
+}
+
+bool proto::decode_json(std::string_view data, ClientMessage &msg)
+{
+    uint64_t type = 0, seq = 0;
+    bool has_payload = false, has_seq = false;
+    std::string_view payload;
+
+    if (scan_json(data, type, has_payload, payload, has_seq, seq)) {
+        return interpret(type, has_payload ? &payload : nullptr,
+                         has_seq ? &seq : nullptr, msg);
+    }
+
+    return proto::decode_json_dom(data, msg);
+}
+
+bool proto::decode_json_dom(std::string_view data, ClientMessage &msg)
+{
+    // no exceptions, a client sending garbage is not exceptional
+    json j = json::parse(data, nullptr, false);
+    if (j.is_discarded() || !j.is_object())
+        return false;
+
+    auto type = j.find("type");
+    if (type == j.end() || !type->is_number_unsigned())
+        return false;
+
+    uint64_t seq = 0;
+    auto seq_value = j.find("seq");
+    bool has_seq = seq_value != j.end() && seq_value->is_number_unsigned();
+    if (has_seq)
+        seq = seq_value->get<uint64_t>();
+
+    // only a missing payload is none, a Create with a number isn't one
+    auto payload = j.find("payload");
+    if (payload == j.end())
+        return interpret(type->get<uint64_t>(), nullptr,
+                         has_seq ? &seq : nullptr, msg);
+    if (!payload->is_string())
+        return false;
+
+    // the unescaped string only exists in the DOM, which is about to go
+    msg.storage = payload->get<string>();
+    std::string_view view = msg.storage;
+    return interpret(type->get<uint64_t>(), &view, has_seq ? &seq : nullptr,
+                     msg);
+}
+
+bool proto::decode_binary(std::string_view data, ClientMessage &msg)
+{
+    if (data.empty() || uint8_t(data[0]) > static_cast<uint8_t>(Type::Sync))
+        return false;
+
+    msg.type = static_cast<Type>(data[0]);
+    data.remove_prefix(1);
+
+    switch (msg.type) {
+    case Type::Create: {
+        msg.time_control = {};
+        if (data.empty())
+            return true;
+
+        uint64_t base, increment;
+        if (!proto::get_varint(data, base) ||
+            !proto::get_varint(data, increment) || !data.empty() ||
+            base > UINT32_MAX || increment > UINT32_MAX)
+            return false;
+        msg.time_control = {.base_ms = uint32_t(base),
+                            .increment_ms = uint32_t(increment)};
+        return true;
+    }
+
+    case Type::Join:
+    case Type::Leave:
+    case Type::Spectate:
+        return proto::get_varint(data, msg.game) && data.empty();
+
+    case Type::Chat:
+        // relayed to JSON clients too, which can't carry anything else
+        msg.text = data;
+        return valid_utf8(data);
+
+    case Type::Move: {
+        if (data.size() != 2)
+            return false;
+
+        uint16_t v = (uint8_t(data[0]) << 8) | uint8_t(data[1]);
+        msg.move = Move{
+            .from = uint8_t(v >> 10),
+            .to = uint8_t((v >> 4) & 0x3F),
+            .promo = static_cast<Promotion>(v & 0xF),
+        };
+        return (v & 0xF) <= static_cast<uint8_t>(Promotion::Queen);
+    }
+
+    case Type::Sync:
+        return proto::get_varint(data, msg.game) &&
+               proto::get_varint(data, msg.seq) && data.empty();
+    }
+
+    return false;
+}
+
+string proto::encode_json(const ClientMessage &msg)
+{
+    json j = {{"type", static_cast<int>(msg.type)}};
+
+    switch (msg.type) {
+    case Type::Create:
+        if (msg.time_control.base_ms > 0)
+            j["payload"] = proto::time_control_str(msg.time_control);
+        break;
+    case Type::Join:
+    case Type::Leave:
+    case Type::Spectate:
+        j["payload"] = proto::game_code_str(msg.game);
+        break;
+    case Type::Chat:
+        j["payload"] = string(msg.text);
+        break;
+    case Type::Move:
+        j["payload"] = proto::move_str(msg.move);
+        break;
+    case Type::Sync:
+        j["payload"] = proto::game_code_str(msg.game);
+        j["seq"] = msg.seq;
+        break;
+    default:
+        break;
+    }
+
+    return j.dump();
+}
+
+string proto::encode_binary(const ClientMessage &msg)
+{
+    string out(1, static_cast<char>(msg.type));
+
+    switch (msg.type) {
+    case Type::Create:
+        if (msg.time_control.base_ms > 0) {
+            proto::put_varint(out, msg.time_control.base_ms);
+            proto::put_varint(out, msg.time_control.increment_ms);
+        }
+        break;
+    case Type::Join:
+    case Type::Leave:
+    case Type::Spectate:
+        proto::put_varint(out, msg.game);
+        break;
+    case Type::Chat:
+        out += msg.text;
+        break;
+    case Type::Move: {
+        uint16_t v = msg.move.pack();
+        out += char(v >> 8);
+        out += char(v);
+        break;
+    }
+    case Type::Sync:
+        proto::put_varint(out, msg.game);
+        proto::put_varint(out, msg.seq);
+        break;
+    default:
+        break;
+    }
+
+    return out;
+}
+
+const char *proto::error_str(Error error)
+{
+    switch (error) {
+    case Error::None:
+        return "ok";
+    case Error::GameNotFound:
+        return "game not found";
+    case Error::GameFull:
+        return "game is full";
+    case Error::TooManyGames:
+        return "too many games";
+    case Error::AlreadyInGame:
+        return "already in a game";
+    case Error::NotInGame:
+        return "not in a game";
+    case Error::NotYourTurn:
+        return "not your turn";
+    case Error::NoOpponent:
+        return "waiting for an opponent";
+    case Error::Unsupported:
+        return "not supported";
+    case Error::GameOver:
+        return "the game is over";
+    case Error::IllegalMove:
+        return "illegal move";
+    }
+    return "unknown error";
+}
+
+const char *proto::result_str(Result result)
+{
+    switch (result) {
+    case Result::None:
+        return "none";
+    case Result::Checkmate:
+        return "checkmate";
+    case Result::Stalemate:
+        return "stalemate";
+    case Result::Repetition:
+        return "threefold repetition";
+    case Result::FiftyMoves:
+        return "fifty moves";
+    case Result::InsufficientMaterial:
+        return "insufficient material";
+    }
+    return "unknown result";
+}
+
+// a JSON string literal, only what has to be escaped is
+static void append_json_string(string &out, std::string_view s)
+{
+    out += '"';
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        }
+        else if (static_cast<unsigned char>(c) < 0x20) {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", c);
+            out += buf;
+        }
+        else {
+            out += c;
+        }
+    }
+    out += '"';
+}
+
+// built by hand, these go out for every move
+string proto::encode_json(const ServerMessage &msg)
+{
+    string out = "{\"type\":";
+    out += char('0' + static_cast<uint8_t>(msg.event));
+    out += ",\"payload\":";
+
+    switch (msg.event) {
+    case Event::Created:
+    case Event::Joined:
+        append_json_string(out, proto::game_code_str(msg.game));
+        out += msg.color == Color::White ? ",\"color\":\"w\""
+                                         : ",\"color\":\"b\"";
+        break;
+    case Event::Left:
+    case Event::Flag:
+        append_json_string(out, proto::game_code_str(msg.game));
+        out += msg.color == Color::White ? ",\"color\":\"w\""
+                                         : ",\"color\":\"b\"";
+        break;
+    case Event::Snapshot:
+        append_json_string(out, proto::game_code_str(msg.game));
+        out += ",\"seq\":" + std::to_string(msg.moves.size());
+        out += ",\"moves\":[";
+        for (size_t i = 0; i < msg.moves.size(); i++) {
+            if (i > 0)
+                out += ',';
+            append_json_string(out, proto::move_str(msg.moves[i]));
+        }
+        out += "],\"fen\":";
+        append_json_string(out, msg.fen);
+        break;
+    case Event::Chat:
+        append_json_string(out, msg.text);
+        break;
+    case Event::Move:
+        append_json_string(out, proto::move_str(msg.move));
+        out += ",\"seq\":" + std::to_string(msg.seq);
+        break;
+    case Event::Error:
+        append_json_string(out, proto::error_str(msg.error));
+        break;
+    case Event::End:
+        append_json_string(out, proto::game_code_str(msg.game));
+        out += ",\"result\":";
+        append_json_string(out, proto::result_str(msg.result));
+        break;
+    }
+
+    if (msg.timed) {
+        out += ",\"clock\":[" + std::to_string(msg.clock[0]) + ',' +
+               std::to_string(msg.clock[1]) + ']';
+    }
+    out += '}';
+    return out;
+}
+
+string proto::encode_binary(const ServerMessage &msg)
+{
+    string out(1, static_cast<char>(msg.event));
+
+    switch (msg.event) {
+    case Event::Created:
+    case Event::Joined:
+    case Event::Left:
+    case Event::Flag:
+        proto::put_varint(out, msg.game);
+        out += static_cast<char>(msg.color);
+        break;
+    case Event::Snapshot:
+        proto::put_varint(out, msg.game);
+        proto::put_varint(out, msg.moves.size());
+        for (auto move : msg.moves) {
+            uint16_t v = move.pack();
+            out += char(v >> 8);
+            out += char(v);
+        }
+        proto::put_varint(out, msg.fen.size());
+        out += msg.fen;
+        break;
+    case Event::Chat:
+        out += msg.text;
+        break;
+    case Event::Move: {
+        uint16_t v = msg.move.pack();
+        out += char(v >> 8);
+        out += char(v);
+        proto::put_varint(out, msg.seq);
+        break;
+    }
+    case Event::Error:
+        out += static_cast<char>(msg.error);
+        break;
+    case Event::End:
+        proto::put_varint(out, msg.game);
+        out += static_cast<char>(msg.result);
+        break;
+    }
+
+    if (msg.timed) {
+        proto::put_varint(out, msg.clock[0]);
+        proto::put_varint(out, msg.clock[1]);
+    }
+    return out;
+}
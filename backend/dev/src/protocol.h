@@ -0,0 +1,244 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using std::string;
+
+// The game protocol spoken over the websocket (see notes.md), in two
+// encodings of the same message set. JSON is what browsers have always sent
+// and stays the default, the binary one is picked with Sec-WebSocket-Protocol
+// and is decoded without going anywhere near a JSON parser:
+//
+//   byte 0      message type
+//   Create      nothing, or a time control: base and increment in ms, two
+//               varints
+//   Join, Leave, Spectate
+//               game code, unsigned LEB128 varint
+//   Chat        the text (UTF-8), everything up to the end of the frame
+//   Move        2 bytes big endian: from << 10 | to << 4 | promotion
+//   Sync        game code varint, sequence number varint
+//
+// Binary messages go in binary frames, JSON ones in text frames.
+namespace proto {
+
+enum class Encoding : uint8_t { Json, Binary };
+
+static const char *const JSON_PROTOCOL = "chess.json.v1";
+static const char *const BINARY_PROTOCOL = "chess.bin.v1";
+
+// Picks our encoding from a Sec-WebSocket-Protocol offer, in the client's
+// order of preference, and returns the subprotocol to answer with. A client
+// offering nothing we know gets JSON and no header, like before there were
+// subprotocols.
+string negotiate(std::string_view offers, Encoding &encoding);
+
+enum class Type : uint8_t {
+    // {"type": 0} for a game without clocks, {"type": 0, "payload": "300+2"}
+    // for one with (base + increment, in seconds)
+    Create = 0,
+    Join = 1,
+    Leave = 2,
+    Spectate = 3,
+    Chat = 4,
+    Move = 5,
+    // what happened in a game after the sequence number the client has,
+    // {"type": 6, "payload": "<game-code>", "seq": 12}. It's watching the
+    // game from then on, unless it plays in it
+    Sync = 6,
+};
+
+// games are numbered, JSON clients see the number in base 36
+using GameCode = uint64_t;
+
+string game_code_str(GameCode code);
+bool parse_game_code(std::string_view s, GameCode &code);
+
+enum class Promotion : uint8_t { None, Knight, Bishop, Rook, Queen };
+
+// squares are 0 = a1 .. 63 = h8
+struct Move {
+    uint8_t from = 0;
+    uint8_t to = 0;
+    Promotion promo = Promotion::None;
+
+    uint16_t pack() const
+    {
+        return (this->from << 10) | (this->to << 4) |
+               static_cast<uint8_t>(this->promo);
+    }
+};
+
+// long algebraic notation, "e2e4" / "e7e8q"
+bool parse_move(std::string_view uci, Move &move);
+string move_str(Move move);
+
+// a game's clocks, base 0 = the game has none
+struct TimeControl {
+    uint32_t base_ms = 0;
+    uint32_t increment_ms = 0;
+};
+
+// "300+2", seconds. Up to 6 digits each, that's plenty
+bool parse_time_control(std::string_view s, TimeControl &tc);
+string time_control_str(TimeControl tc);
+
+// at most 5 bytes for a 32 bit code, 10 for 64
+void put_varint(string &out, uint64_t v);
+bool get_varint(std::string_view &in, uint64_t &v);
+
+struct ClientMessage {
+    Type type = Type::Create;
+    GameCode game = 0;        // Join, Leave, Spectate, Sync
+    Move move;                // Move
+    uint64_t seq = 0;         // Sync
+    TimeControl time_control; // Create
+    // Chat. Points into the decoded frame, or into `storage` when the JSON
+    // string had escapes to undo; either way only valid as long as both are
+    std::string_view text;
+    string storage;
+};
+
+// False for anything malformed: unknown type, missing or mistyped payload,
+// trailing bytes.
+//
+// decode_json() scans the `{"type": N, "payload": "..."}` every client sends
+// (and Sync's "seq") by hand, in any order and with any whitespace, and never
+// allocates.
+// Anything else (escapes in the string, extra keys, other value types) goes
+// through decode_json_dom(), a full nlohmann parse, so both accept exactly
+// the same messages.
+bool decode_json(std::string_view data, ClientMessage &msg);
+bool decode_json_dom(std::string_view data, ClientMessage &msg);
+bool decode_binary(std::string_view data, ClientMessage &msg);
+
+string encode_json(const ClientMessage &msg);
+string encode_binary(const ClientMessage &msg);
+
+inline bool decode(Encoding encoding, std::string_view data,
+                   ClientMessage &msg)
+{
+    return encoding == Encoding::Binary ? decode_binary(data, msg)
+                                        : decode_json(data, msg);
+}
+
+// What the server sends back, the same type numbers where there is a
+// counterpart:
+//
+// Moves are numbered in each game, the sequence number of a move is how many
+// moves the game has with it (1 for white's first).
+//
+// In a game with clocks, Created, Joined, Snapshot and Move messages end with
+// what each side has left in ms, {..., "clock": [white, black]}, binary: two
+// more varints. A Move's is as of the move (increment included), the side
+// to move's clock runs from then on, the others' as of when they were sent.
+// Clocks start with white's first move. A Move sent to catch up (after a
+// Sync) only has it if it's the last one.
+//
+//   Created, Joined  {"type": 0|1, "payload": "<game-code>", "color": "w"}
+//                    binary: code varint, color byte (0 white, 1 black)
+//                    Joined goes to both players once the game is on, with
+//                    the color of the one receiving it, and to spectators
+//                    with the color of the one who joined
+//   Left             a player left, {"type": 2, "payload": "<code>",
+//                    "color": "b"} with the color of the one who left,
+//                    binary: code varint, color byte
+//   Snapshot         the game as it is now: to a spectator when it starts
+//                    watching or fell too far behind to be sent every move,
+//                    to a player taking a seat in a game that's under way,
+//                    and for a Sync from too far back. {"type": 3,
+//                    "payload": "<code>", "seq": 2, "moves": ["e2e4",
+//                    "e7e5"], "fen": "<the position after them>"},
+//                    binary: code varint, move count varint (the sequence
+//                    number), 2 bytes per move, FEN length varint, the FEN
+//   Chat             like the client's
+//   Move             {"type": 5, "payload": "e2e4", "seq": 1}, binary: the
+//                    client's 2 bytes, sequence number varint. Spectators
+//                    get the moves too, and a Sync gets the ones it missed
+//                    like this
+//   Error            {"type": 6, "payload": "game not found"}, binary: the
+//                    Error value as one byte
+//   Flag             a player ran out of time, the game is over. To both
+//                    players and the spectators, {"type": 7, "payload":
+//                    "<code>", "color": "w"} with the color of the one whose
+//                    flag fell, binary: code varint, color byte
+//   End              the game ended on the board, mate or a draw the
+//                    server called. To both players and the spectators,
+//                    after the move that ended it, {"type": 8, "payload":
+//                    "<code>", "result": "stalemate"}, binary: code varint,
+//                    the Result value as one byte
+enum class Event : uint8_t {
+    Created = 0,
+    Joined = 1,
+    Left = 2,
+    Snapshot = 3,
+    Chat = 4,
+    Move = 5,
+    Error = 6,
+    Flag = 7,
+    End = 8,
+};
+
+// how a game ended on the board. With checkmate the side that moved last won
+enum class Result : uint8_t {
+    None,
+    Checkmate,
+    Stalemate,
+    Repetition, // threefold
+    FiftyMoves,
+    InsufficientMaterial,
+};
+
+const char *result_str(Result result);
+
+enum class Color : uint8_t { White, Black };
+
+inline Color opposite(Color c)
+{
+    return c == Color::White ? Color::Black : Color::White;
+}
+
+enum class Error : uint8_t {
+    None,
+    GameNotFound,
+    GameFull,
+    TooManyGames,
+    AlreadyInGame,
+    NotInGame,
+    NotYourTurn,
+    NoOpponent,
+    Unsupported,
+    GameOver,
+    IllegalMove,
+};
+
+const char *error_str(Error error);
+
+struct ServerMessage {
+    Event event = Event::Error;
+    GameCode game = 0;            // Created, Joined, Left, Snapshot, Flag, End
+    Color color = Color::White;   // Created, Joined, Left, Flag
+    Move move;                    // Move
+    uint64_t seq = 0;             // Move
+    std::vector<Move> moves;      // Snapshot
+    string fen;                   // Snapshot
+    string text;                  // Chat, owned: it can cross reactors
+    Error error = Error::None;    // Error
+    Result result = Result::None; // End
+    // Created, Joined, Snapshot, Move of a game with clocks: ms left, by
+    // Color
+    bool timed = false;
+    uint32_t clock[2] = {0, 0};
+};
+
+string encode_json(const ServerMessage &msg);
+string encode_binary(const ServerMessage &msg);
+
+inline string encode(Encoding encoding, const ServerMessage &msg)
+{
+    return encoding == Encoding::Binary ? encode_binary(msg)
+                                        : encode_json(msg);
+}
+} // namespace proto
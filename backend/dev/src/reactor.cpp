@@ -0,0 +1,1373 @@
+#include <algorithm>
+#include <bit>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <optional>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "reactor.h"
+#include "http.h"
+#include "http_parser.h"
+#include "src/utils.h"
+#include "trie/trie.h"
+#include "websocket.h"
+#include "spdlog/spdlog.h"
+
+// poller token of the listener, connections use their packed ConnId which
+// can never be all ones
+static const uint64_t LISTENER_TOKEN = UINT64_MAX;
+static const uint64_t ASSET_WATCH_TOKEN = UINT64_MAX - 1;
+static const uint64_t MAILBOX_TOKEN = UINT64_MAX - 2;
+
+// our pings carry when they were sent, the pong gives us the round trip
+static string ping_frame(int64_t now_ms)
+{
+    char stamp[sizeof(now_ms)];
+    memcpy(stamp, &now_ms, sizeof(now_ms));
+    return ws::control_frame(ws::Opcode::Ping,
+                             std::string_view(stamp, sizeof(stamp)));
+}
+
+Reactor::Reactor(int id, int listenerfd, Trie *router, int max_buf_size,
+                 const ServerConfig &config, AssetCache *assets, Games *games,
+                 Limiter *limiter)
+    : config(config), timers(utils::now_ms()), clocks(utils::now_ms())
+{
+    this->assets = assets;
+    this->games = games;
+    this->limiter = limiter;
+    this->id = id;
+    this->now_ms = utils::now_ms();
+    this->listenerfd = listenerfd;
+    this->router = router;
+    this->max_buf_size = max_buf_size;
+}
+
+void Reactor::run()
+{
+    this->poller = Poller::create(this->config.poller);
+    this->poller->add(this->listenerfd, poller::READ, LISTENER_TOKEN);
+
+    // the cache is shared, one reactor is enough to keep it up to date
+    if (this->id == 0 && this->assets && this->assets->watch_fd() != -1) {
+        this->poller->add(this->assets->watch_fd(), poller::READ,
+                          ASSET_WATCH_TOKEN);
+    }
+
+    this->poller->add(this->mailbox.fd(), poller::READ, MAILBOX_TOKEN);
+
+    spdlog::info("reactor {} running ({})", this->id, this->poller->name());
+
+    std::vector<PollEvent> events;
+
+    while (true) {
+        int event_count = this->poller->wait(events, this->next_timeout());
+
+        if (event_count == -1) {
+            if (errno == EINTR)
+                continue;
+            perror("poll");
+            exit(EXIT_FAILURE);
+        }
+        this->now_ms = utils::now_ms();
+
+        for (auto &ev : events) {
+            if (ev.token == LISTENER_TOKEN) {
+                this->handle_new_conn();
+                continue;
+            }
+            if (ev.token == ASSET_WATCH_TOKEN) {
+                this->assets->process_events();
+                continue;
+            }
+            if (ev.token == MAILBOX_TOKEN) {
+                this->handle_mail();
+                continue;
+            }
+
+            auto conn_ptr = this->connections.get(ConnId::unpack(ev.token));
+            if (conn_ptr == nullptr)
+                continue;
+
+            auto &conn = *conn_ptr;
+
+            if (ev.error) {
+                conn.mark_dirty();
+            }
+            else {
+                if (ev.writable && !conn.out.empty()) {
+                    this->handle_writable(conn);
+                }
+                if (ev.readable && !conn.is_dirty) {
+                    spdlog::debug("existing connection");
+                    this->handle_incoming(conn);
+                }
+            }
+
+            if (conn.is_dirty) {
+                this->dirty.push_back(conn.id);
+            }
+            // a websocket is only alive if the client says something
+            else if (!conn.lingering && (ev.readable || !conn.is_websocket)) {
+                this->touch(conn);
+            }
+        }
+
+        this->expire_timers();
+        this->cleanup();
+        // what the handlers above (and closing connections) queued for
+        // other connections
+        this->flush_scheduled();
+    }
+
+    close(this->listenerfd);
+}
+
+void Reactor::set_peers(const std::vector<std::unique_ptr<Reactor>> *peers)
+{
+    this->peers = peers;
+}
+
+void Reactor::post(Mail mail)
+{
+    this->mailbox.post(std::move(mail));
+}
+
+void Reactor::handle_mail()
+{
+    this->mailbox.take(this->mail);
+
+    for (auto &m : this->mail) {
+        if (m.spectators != 0) {
+            this->fan_out(m.spectators, m.msg, m.game_over, m.posted_us);
+            continue;
+        }
+        this->deliver(PlayerRef{.reactor = this->id, .conn = m.to},
+                      std::move(m.msg), m.flag_at);
+    }
+}
+
+void Reactor::handle_new_conn()
+{
+    // the listener is edge triggered under epoll, so accept everything that
+    // is queued up before going back to wait
+    while (true) {
+        sockaddr_storage client_addr;
+        socklen_t client_addrlen = sizeof(client_addr);
+        char ip_addr[INET_ADDRSTRLEN];
+
+        int clientfd =
+            accept(this->listenerfd, reinterpret_cast<sockaddr *>(&client_addr),
+                   &client_addrlen);
+
+        if (clientfd == -1) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                perror("accept");
+            }
+            return;
+        }
+
+        auto temp = reinterpret_cast<sockaddr *>(&client_addr);
+        auto sin_addr = reinterpret_cast<sockaddr_in *>(temp)->sin_addr;
+
+        // refused before anything is spent on it
+        if (this->limiter &&
+            !this->limiter->connect(sin_addr.s_addr, this->now_ms)) {
+            spdlog::debug("refusing connection, over the limits");
+            close(clientfd);
+            continue;
+        }
+
+        inet_ntop(client_addr.ss_family, &sin_addr, ip_addr, sizeof(ip_addr));
+
+        spdlog::info("new connection, IP Address: {}", ip_addr);
+
+        utils::set_nonblocking(clientfd);
+
+        // responses and game messages are small and latency sensitive, don't
+        // let Nagle hold back e.g. the second of two pipelined responses
+        int yes = 1;
+        setsockopt(clientfd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+
+        auto id = this->connections.insert(Connection{
+            .fd = clientfd,
+            .ip_addr = ip_addr,
+            .ip = sin_addr.s_addr,
+            .limited = this->limiter != nullptr,
+            .is_websocket = false,
+            .is_dirty = false,
+            .parser = HttpParser(this->config.http_max_request_size),
+        });
+        auto &conn = *this->connections.get(id);
+        conn.id = id;
+
+        if (!this->poller->add(clientfd, poller::READ, id.pack())) {
+            if (this->limiter) {
+                this->limiter->disconnect(sin_addr.s_addr);
+            }
+            this->connections.remove(id);
+            close(clientfd);
+            continue;
+        }
+
+        // a client that connects and never sends anything (or never finishes
+        // its request) is out of time after http_request_timeout_ms
+        conn.last_active_ms = this->now_ms;
+        conn.request_started_ms = this->now_ms;
+        this->schedule(conn);
+    }
+}
+
+void Reactor::handle_incoming(Connection &conn)
+{
+    while (!conn.is_dirty) {
+        if (conn.lingering) {
+            this->drain(conn);
+            return;
+        }
+
+        // keep reading until the socket runs dry (EAGAIN) or gets closed, the
+        // handlers return false when there's nothing left to do
+        bool more = true;
+        while (more && !conn.is_dirty && !conn.paused) {
+            if (conn.is_websocket) {
+                more = this->handle_websocket(conn);
+            }
+            else {
+                more = this->handle_http(conn);
+            }
+        }
+
+        // everything the requests above queued goes out together
+        bool was_paused = conn.paused;
+        this->flush(conn);
+
+        // it drained right away, go on with the requests that were held back
+        if (!was_paused || conn.paused)
+            break;
+    }
+}
+
+void Reactor::handle_writable(Connection &conn)
+{
+    bool was_paused = conn.paused;
+    this->flush(conn);
+
+    // requests that came in meanwhile may be sitting in the buffer already,
+    // no read event is going to announce those
+    if (was_paused && !conn.paused && !conn.is_dirty) {
+        this->handle_incoming(conn);
+    }
+}
+
+void Reactor::flush(Connection &conn)
+{
+    if (conn.is_dirty)
+        return;
+
+    if (!conn.out.empty()) {
+        if (conn.out.flush(conn.fd) == OutQueue::Status::Error) {
+            conn.mark_dirty();
+            return;
+        }
+
+        if (conn.out.buffered() > this->config.out_max_buffered) {
+            spdlog::warn("dropping {}, {} bytes waiting to be sent",
+                         conn.ip_addr, conn.out.buffered());
+            conn.mark_dirty();
+            return;
+        }
+    }
+
+    // catch_up() clears it, this goes around once
+    if (conn.lagging &&
+        conn.out.size() <= this->config.spectate_max_backlog / 2) {
+        this->catch_up(conn);
+        this->flush(conn);
+        return;
+    }
+
+    if (conn.close_after_send) {
+        if (conn.out.empty())
+            this->linger(conn);
+    }
+    else if (conn.paused && conn.out.size() < this->config.out_high_water) {
+        conn.paused = false;
+    }
+
+    this->update_interest(conn);
+}
+
+// Closing a socket that still has unread input makes the kernel send a RST,
+// which can wipe out the response (or close frame) we just sent before the
+// client got to read it. So only our side is shut down, and whatever the
+// client still sends is thrown away until it closes too or times out.
+void Reactor::linger(Connection &conn)
+{
+    shutdown(conn.fd, SHUT_WR);
+
+    conn.close_after_send = false;
+    conn.paused = false;
+    conn.lingering = true;
+    conn.last_active_ms = this->now_ms;
+    this->schedule(conn);
+}
+
+void Reactor::drain(Connection &conn)
+{
+    do {
+        conn.in.clear();
+    } while (this->fill(conn));
+}
+
+// read while requests are being taken, write while something is queued
+void Reactor::update_interest(Connection &conn)
+{
+    if (conn.is_dirty)
+        return;
+
+    uint32_t interest = (conn.paused ? 0 : poller::READ) |
+                        (conn.out.empty() ? 0 : poller::WRITE);
+
+    if (interest != conn.interest) {
+        this->poller->modify(conn.fd, interest, conn.id.pack());
+        conn.interest = interest;
+    }
+}
+
+bool Reactor::handle_http(Connection &conn)
+{
+    auto &in = conn.in;
+
+    // there may already be a whole request in the buffer (pipelined, or read
+    // together with the previous one), only go to the socket when there isn't
+    http_request req;
+    auto status = conn.parser.parse(in.data(), in.size(), req);
+
+    if (status == HttpParser::Status::Incomplete) {
+        return this->fill(conn);
+    }
+
+    if (status == HttpParser::Status::Error) {
+        conn.out.push(HTTP::error(conn.parser.error()));
+        conn.close_when_sent();
+        return false;
+    }
+
+    HTTP http(req, conn.out, this->assets);
+
+    conn.requests_served++;
+    if (conn.requests_served >= this->config.http_max_keepalive_requests) {
+        req.keep_alive = false;
+    }
+
+    if (req.isWebsocketHandshake && this->games && !this->games->connect()) {
+        spdlog::warn("refusing websocket {}, too many clients", conn.ip_addr);
+        conn.out.push(HTTP::error(503));
+        conn.close_when_sent();
+        return false;
+    }
+
+    if (req.isWebsocketHandshake) {
+        conn.is_client = this->games != nullptr;
+        string extensions = this->negotiate_deflate(conn, req);
+        string protocol = proto::negotiate(
+            req.header("Sec-WebSocket-Protocol"), conn.encoding);
+        conn.out.push(http.websocket_handshake(extensions, protocol));
+        conn.is_websocket = true;
+        conn.ws_decoder = ws::Decoder(this->config.ws_max_message_size,
+                                      conn.deflate.enabled);
+    }
+    else {
+        // the router is shared between reactors, so the wildcard match is
+        // handed back to us instead of being stored on the node
+        std::string_view wildcard;
+        auto route = this->router->find(req.path, &wildcard);
+
+        if (!this->config.stats_path.empty() &&
+            req.path == this->config.stats_path) {
+            http.sendText(this->stats_json(), "application/json");
+        }
+        else if (route && route->value) {
+            if (route->isWildcard) {
+                req.param = wildcard;
+            }
+            route->value(req, http);
+        }
+        else {
+            conn.out.push(http.not_found());
+        }
+    }
+
+    // req points into the buffer, only drop the bytes once it's handled
+    in.consume(conn.parser.consumed());
+    conn.parser.reset();
+
+    // anything pipelined after a "Connection: close" request is dropped
+    if (!conn.is_websocket && !req.keep_alive) {
+        conn.close_when_sent();
+        return false;
+    }
+
+    // a client pipelining requests for big files without reading the
+    // responses doesn't get to queue up more than this
+    if (conn.out.size() >= this->config.out_high_water) {
+        conn.paused = true;
+        return false;
+    }
+
+    // loop around for the next pipelined request, responses are queued in
+    // the order the requests came in
+    return true;
+}
+
+bool Reactor::handle_websocket(Connection &conn)
+{
+    ws::Message msg;
+    auto status = conn.ws_decoder.next(conn.in, msg);
+
+    if (status == ws::Decoder::Status::Incomplete) {
+        return this->fill(conn);
+    }
+
+    if (status == ws::Decoder::Status::Error) {
+        this->close_websocket(conn, conn.ws_decoder.error());
+        return false;
+    }
+
+    // before anything is done with it, inflating included. Everything but
+    // the close handshake counts, a ping costs us a pong
+    if (msg.opcode != ws::Opcode::Close && this->limiter &&
+        !this->limiter->message(conn.ip, this->now_ms)) {
+        spdlog::warn("{} is over the message limit", conn.ip_addr);
+        this->close_websocket(conn, ws::CLOSE_POLICY_VIOLATION);
+        return false;
+    }
+
+    if (msg.compressed) {
+        auto &inflater = conn.inflater ? *conn.inflater : this->shared_inflater;
+        auto result = inflater.decompress(msg.payload, this->inflated,
+                                          this->config.ws_max_message_size);
+
+        if (result != ws::Inflater::Status::Ok) {
+            this->close_websocket(conn, result == ws::Inflater::Status::TooBig
+                                            ? ws::CLOSE_TOO_BIG
+                                            : ws::CLOSE_PROTOCOL_ERROR);
+            return false;
+        }
+        msg.payload = this->inflated;
+    }
+
+    switch (msg.opcode) {
+    case ws::Opcode::Close:
+        spdlog::info("client disconnect");
+        // client is disconnecting, send back a close frame with the same
+        // status code in response
+        conn.out.push(
+            ws::control_frame(ws::Opcode::Close, msg.payload.substr(0, 2)));
+        conn.close_when_sent();
+        return false;
+
+    case ws::Opcode::Ping:
+        conn.out.push(ws::control_frame(ws::Opcode::Pong, msg.payload));
+        break;
+
+    case ws::Opcode::Pong: {
+        // our pings carry the time they were sent
+        int64_t sent;
+        if (msg.payload.size() == sizeof(sent)) {
+            memcpy(&sent, msg.payload.data(), sizeof(sent));
+            int64_t rtt = this->now_ms - sent;
+            if (rtt >= 0 && rtt < 60000) {
+                conn.rtt_ms = conn.rtt_ms == 0 ? rtt
+                                               : (3 * conn.rtt_ms + rtt) / 4;
+            }
+        }
+        break;
+    }
+
+    default:
+        return this->handle_message(conn, msg);
+    }
+
+    return true;
+}
+
+bool Reactor::handle_message(Connection &conn, const ws::Message &msg)
+{
+    // a binary client sending text (or the other way around) is talking some
+    // other protocol
+    if (msg.opcode != message_opcode(conn.encoding)) {
+        this->close_websocket(conn, ws::CLOSE_UNSUPPORTED_DATA);
+        return false;
+    }
+
+    proto::ClientMessage m;
+    if (!proto::decode(conn.encoding, msg.payload, m)) {
+        this->close_websocket(conn, ws::CLOSE_INVALID_PAYLOAD);
+        return false;
+    }
+
+    if (this->games == nullptr)
+        return true;
+
+    using proto::Error;
+    using proto::Event;
+    using proto::ServerMessage;
+
+    switch (m.type) {
+    case proto::Type::Create: {
+        if (conn.game != 0) {
+            this->reply_error(conn, Error::AlreadyInGame);
+            break;
+        }
+
+        this->unwatch(conn);
+        auto &tc = m.time_control;
+        auto err = this->games->create(this->player(conn), tc, conn.game);
+        if (err != Error::None) {
+            this->reply_error(conn, err);
+            break;
+        }
+        conn.color = proto::Color::White;
+        this->reply(conn, ServerMessage{.event = Event::Created,
+                                        .game = conn.game,
+                                        .color = conn.color,
+                                        .timed = tc.base_ms > 0,
+                                        .clock = {tc.base_ms, tc.base_ms}});
+        break;
+    }
+
+    case proto::Type::Join: {
+        if (conn.game != 0) {
+            this->reply_error(conn, Error::AlreadyInGame);
+            break;
+        }
+
+        PlayerRef opponent;
+        auto err = this->games->join(m.game, this->player(conn), conn.color,
+                                     opponent, this->watchers, conn.encoding,
+                                     this->now_ms, this->catchup);
+        if (err != Error::None) {
+            this->reply_error(conn, err);
+            break;
+        }
+        // a spectator stops watching only once it has a seat
+        this->unwatch(conn);
+        conn.game = m.game;
+        auto &clock = this->catchup.clock;
+        ServerMessage joined{.event = Event::Joined,
+                             .game = conn.game,
+                             .color = conn.color,
+                             .timed = clock.timed,
+                             .clock = {clock.left[0], clock.left[1]}};
+        this->reply(conn, joined);
+        this->send_catchup(conn, this->catchup);
+        // a seat in the middle of a game, its clock may be running already
+        if (clock.flag_at != 0 && clock.turn == conn.color) {
+            this->start_clock(conn, clock.flag_at);
+        }
+
+        this->notify_spectators(this->watchers, conn.game, joined);
+        // the game is on for whoever was waiting
+        if (opponent) {
+            joined.color = proto::opposite(conn.color);
+            this->deliver(opponent, joined);
+        }
+        break;
+    }
+
+    case proto::Type::Leave:
+        if (conn.game == 0 || conn.game != m.game) {
+            this->reply_error(conn, Error::NotInGame);
+            break;
+        }
+        this->leave_game(conn);
+        break;
+
+    case proto::Type::Spectate:
+        if (conn.game != 0) {
+            this->reply_error(conn, Error::AlreadyInGame);
+            break;
+        }
+        this->watch(conn, m.game, Catchup::WHOLE_GAME);
+        break;
+
+    case proto::Type::Sync:
+        // a player only misses moves if it sent a Sync from too far back
+        // earlier, anyone else watches the game from there on
+        if (conn.game == m.game) {
+            if (this->games->catch_up(conn.game, conn.encoding, m.seq,
+                                      this->now_ms,
+                                      this->catchup) == Error::None)
+                this->send_catchup(conn, this->catchup);
+        }
+        else if (conn.game != 0) {
+            this->reply_error(conn, Error::AlreadyInGame);
+        }
+        else {
+            this->watch(conn, m.game, m.seq);
+        }
+        break;
+
+    case proto::Type::Chat: {
+        if (conn.game == 0) {
+            this->reply_error(conn, Error::NotInGame);
+            break;
+        }
+
+        auto opponent = this->games->opponent(conn.game, conn.color);
+        if (opponent) {
+            this->deliver(opponent, ServerMessage{.event = Event::Chat,
+                                                  .text = string(m.text)});
+        }
+        break;
+    }
+
+    case proto::Type::Move: {
+        if (conn.game == 0) {
+            this->reply_error(conn, Error::NotInGame);
+            break;
+        }
+
+        PlayerRef opponent;
+        uint64_t seq;
+        GameClock clock;
+        proto::Result result;
+        auto err = this->games->move(conn.game, conn.color, m.move,
+                                     this->lag(conn), this->now_ms, opponent,
+                                     this->watchers, seq, clock, result);
+        if (err != Error::None) {
+            this->reply_error(conn, err);
+            break;
+        }
+        this->stop_clock(conn);
+        ServerMessage move{.event = Event::Move,
+                           .move = m.move,
+                           .seq = seq,
+                           .timed = clock.timed,
+                           .clock = {clock.left[0], clock.left[1]}};
+        this->notify_spectators(this->watchers, conn.game, move);
+        this->deliver(opponent, std::move(move), clock.flag_at);
+        if (result != proto::Result::None) {
+            this->announce_end(conn, opponent,
+                               ServerMessage{.event = Event::End,
+                                             .game = conn.game,
+                                             .result = result});
+        }
+        break;
+    }
+    }
+
+    return true;
+}
+
+PlayerRef Reactor::player(const Connection &conn) const
+{
+    return PlayerRef{.reactor = this->id, .conn = conn.id};
+}
+
+// A message for a player, wherever it's connected. One of ours gets it queued
+// right away and flushed at the end of the loop iteration (together with
+// whatever else it gets meanwhile), one of another reactor's is posted there.
+void Reactor::deliver(PlayerRef to, proto::ServerMessage msg,
+                      int64_t flag_at)
+{
+    if (to.reactor != this->id) {
+        (*this->peers)[to.reactor]->post(
+            Mail{.to = to.conn, .msg = std::move(msg), .flag_at = flag_at});
+        return;
+    }
+
+    // it may have gone in the meantime, the handle just doesn't resolve
+    auto conn = this->connections.get(to.conn);
+    if (conn == nullptr || conn->is_dirty || !conn->is_websocket ||
+        conn->close_after_send || conn->lingering)
+        return;
+
+    this->reply(*conn, msg);
+    if (flag_at != 0) {
+        this->start_clock(*conn, flag_at);
+    }
+    this->schedule_flush(*conn);
+}
+
+void Reactor::reply(Connection &conn, const proto::ServerMessage &msg)
+{
+    this->send_message(conn, message_opcode(conn.encoding),
+                       proto::encode(conn.encoding, msg));
+}
+
+void Reactor::reply_error(Connection &conn, proto::Error error)
+{
+    this->reply(conn, proto::ServerMessage{.event = proto::Event::Error,
+                                           .error = error});
+}
+
+void Reactor::leave_game(Connection &conn)
+{
+    if (conn.game == 0)
+        return;
+
+    this->stop_clock(conn);
+    PlayerRef opponent;
+    bool game_over =
+        this->games->leave(conn.game, conn.color, opponent, this->watchers);
+    proto::ServerMessage left{
+        .event = proto::Event::Left, .game = conn.game, .color = conn.color};
+
+    this->notify_spectators(this->watchers, conn.game, left, game_over);
+    if (opponent) {
+        this->deliver(opponent, std::move(left));
+    }
+    conn.game = 0;
+}
+
+// a spectator that has the game up to move `from` (or nothing)
+void Reactor::watch(Connection &conn, proto::GameCode game, uint64_t from)
+{
+    this->unwatch(conn);
+
+    auto err = this->games->watch(game, this->id, conn.encoding, from,
+                                  this->now_ms, this->catchup);
+    if (err != proto::Error::None) {
+        this->reply_error(conn, err);
+        return;
+    }
+
+    auto &list = this->spectators[game];
+    conn.watching = game;
+    conn.watch_pos = list.size();
+    list.push_back(conn.id);
+    this->stats.spectators++;
+
+    this->send_catchup(conn, this->catchup);
+}
+
+// the snapshot is queued as it is, shared with whoever else got it. A few
+// missed moves are sent like they were the first time
+void Reactor::send_catchup(Connection &conn, const Catchup &catchup)
+{
+    if (catchup.snapshot) {
+        ws::send(conn.out, catchup.snapshot);
+        this->stats.snapshots++;
+        return;
+    }
+
+    auto &clock = catchup.clock;
+    for (size_t i = 0; i < catchup.moves.size(); i++) {
+        bool last = i + 1 == catchup.moves.size();
+        this->reply(conn, proto::ServerMessage{
+                              .event = proto::Event::Move,
+                              .move = catchup.moves[i],
+                              .seq = catchup.from + 1 + i,
+                              .timed = last && clock.timed,
+                              .clock = {clock.left[0], clock.left[1]}});
+    }
+}
+
+void Reactor::unwatch(Connection &conn)
+{
+    if (conn.watching == 0)
+        return;
+
+    // the last one takes its place, however many are watching
+    auto it = this->spectators.find(conn.watching);
+    auto &list = it->second;
+    auto last = list.back();
+    list[conn.watch_pos] = last;
+    this->connections.get(last)->watch_pos = conn.watch_pos;
+    list.pop_back();
+    if (list.empty())
+        this->spectators.erase(it);
+
+    this->games->unwatch(conn.watching, this->id);
+    this->stats.spectators--;
+    conn.watching = 0;
+    conn.lagging = false;
+}
+
+// An update for everyone watching a game: the reactors in `reactors` (as
+// Games handed them back) get it once each, not once per spectator.
+void Reactor::notify_spectators(const std::vector<int> &reactors,
+                                proto::GameCode game,
+                                const proto::ServerMessage &msg,
+                                bool game_over)
+{
+    if (reactors.empty())
+        return;
+
+    int64_t now = utils::now_us();
+    for (int r : reactors) {
+        if (r == this->id) {
+            this->fan_out(game, msg, game_over, now);
+        }
+        else {
+            (*this->peers)[r]->post(Mail{.msg = msg,
+                                         .spectators = game,
+                                         .game_over = game_over,
+                                         .posted_us = now});
+        }
+    }
+}
+
+// Queues an update to all of our spectators of a game. It's encoded once per
+// encoding and every spectator's queue holds the same frame. A spectator
+// with too much queued already is skipped (it gets the whole game again once
+// it has caught up, see catch_up()), so a slow one never holds more than
+// about spectate_max_backlog, and it's dropped if it stays behind.
+void Reactor::fan_out(proto::GameCode game, const proto::ServerMessage &msg,
+                      bool game_over, int64_t posted_us)
+{
+    auto it = this->spectators.find(game);
+    if (it == this->spectators.end())
+        return;
+
+    std::optional<ws::Broadcast> encoded[2]; // by Encoding
+    int64_t now = utils::now_ms();
+
+    for (auto id : it->second) {
+        auto &conn = *this->connections.get(id);
+        if (conn.is_dirty || conn.close_after_send || conn.lingering)
+            continue;
+
+        if (!conn.lagging &&
+            conn.out.size() >= this->config.spectate_max_backlog) {
+            conn.lagging = true;
+            conn.lagging_since_ms = now;
+        }
+
+        // the end of the game goes out either way, nothing follows it
+        if (conn.lagging && !game_over) {
+            if (now - conn.lagging_since_ms <
+                this->config.spectate_max_lag_ms) {
+                this->stats.dropped++;
+                continue;
+            }
+
+            spdlog::warn("dropping spectator {}, too far behind",
+                         conn.ip_addr);
+            this->stats.disconnects++;
+            conn.mark_dirty();
+            this->dirty.push_back(conn.id);
+            continue;
+        }
+
+        auto &frame = encoded[static_cast<int>(conn.encoding)];
+        if (!frame) {
+            frame.emplace(message_opcode(conn.encoding),
+                          proto::encode(conn.encoding, msg));
+        }
+        this->send_message(conn, *frame);
+        this->schedule_flush(conn);
+        this->stats.sent++;
+    }
+
+    this->stats.updates++;
+    this->stats.add_latency(utils::now_us() - posted_us);
+
+    // the room is gone, nothing left to watch
+    if (game_over) {
+        for (auto id : it->second) {
+            auto &conn = *this->connections.get(id);
+            conn.watching = 0;
+            conn.lagging = false;
+        }
+        this->stats.spectators -= it->second.size();
+        this->spectators.erase(it);
+    }
+}
+
+// A spectator that fell behind has sent what it had queued: instead of the
+// moves it missed it gets the whole game as it is now, and every move again
+// from there.
+void Reactor::catch_up(Connection &conn)
+{
+    conn.lagging = false;
+
+    // it's over if it's gone, the last update is already queued
+    if (this->games->catch_up(conn.watching, conn.encoding,
+                              Catchup::WHOLE_GAME, this->now_ms,
+                              this->catchup) != proto::Error::None)
+        return;
+
+    this->send_catchup(conn, this->catchup);
+    this->stats.resyncs++;
+}
+
+void FanoutStats::add_latency(int64_t us)
+{
+    int bucket = std::bit_width(uint64_t(std::max<int64_t>(us, 1))) - 1;
+    this->latency[std::min(bucket, LATENCY_BUCKETS - 1)]++;
+}
+
+// the fan-out numbers of every reactor together
+string Reactor::stats_json() const
+{
+    uint64_t spectators = 0, updates = 0, sent = 0, dropped = 0, resyncs = 0,
+             disconnects = 0, snapshots = 0;
+    uint64_t latency[FanoutStats::LATENCY_BUCKETS] = {};
+    uint64_t samples = 0;
+
+    auto add = [&](const FanoutStats &s) {
+        spectators += s.spectators;
+        updates += s.updates;
+        sent += s.sent;
+        dropped += s.dropped;
+        resyncs += s.resyncs;
+        disconnects += s.disconnects;
+        snapshots += s.snapshots;
+        for (int i = 0; i < FanoutStats::LATENCY_BUCKETS; i++) {
+            latency[i] += s.latency[i];
+            samples += s.latency[i];
+        }
+    };
+
+    if (this->peers) {
+        for (auto &reactor : *this->peers)
+            add(reactor->stats);
+    }
+    else {
+        add(this->stats);
+    }
+
+    // upper bounds, that's what the buckets give
+    auto percentile = [&](double p) -> uint64_t {
+        uint64_t seen = 0;
+        for (int i = 0; i < FanoutStats::LATENCY_BUCKETS; i++) {
+            seen += latency[i];
+            if (seen > 0 && seen >= p * samples)
+                return uint64_t(2) << i;
+        }
+        return 0;
+    };
+
+    json j = {
+        {"spectators", spectators},
+        {"fanout",
+         {{"updates", updates},
+          {"sent", sent},
+          {"dropped", dropped},
+          {"resyncs", resyncs},
+          {"disconnects", disconnects},
+          {"snapshots", snapshots},
+          {"latency_us",
+           {{"p50", percentile(0.5)},
+            {"p99", percentile(0.99)},
+            {"p999", percentile(0.999)},
+            {"max", percentile(1.0)}}}}},
+    };
+    if (this->limiter) {
+        auto &limiter = *this->limiter;
+        j["limiter"] = {
+            {"tracked", limiter.size()},
+            {"rejected_connections", limiter.rejected_connections.load()},
+            {"rejected_messages", limiter.rejected_messages.load()},
+            {"bans", limiter.bans.load()},
+        };
+    }
+    return j.dump();
+}
+
+void Reactor::schedule_flush(Connection &conn)
+{
+    if (conn.flush_scheduled)
+        return;
+
+    conn.flush_scheduled = true;
+    this->scheduled_flushes.push_back(conn.id);
+}
+
+void Reactor::flush_scheduled()
+{
+    for (auto id : this->scheduled_flushes) {
+        auto conn = this->connections.get(id);
+        if (conn == nullptr)
+            continue;
+
+        conn->flush_scheduled = false;
+        this->flush(*conn);
+        // picked up by the next cleanup, which doesn't wait for an event
+        if (conn->is_dirty) {
+            this->dirty.push_back(conn->id);
+        }
+    }
+
+    this->scheduled_flushes.clear();
+}
+
+void Reactor::close_websocket(Connection &conn, uint16_t status)
+{
+    spdlog::info("closing websocket {}: error {}", conn.ip_addr, status);
+    conn.out.push(ws::close_frame(status));
+    conn.close_when_sent();
+}
+
+// Context takeover is what makes deflate worth it for small messages, but it
+// keeps zlib state per connection for as long as the connection lives. Only
+// as many connections as fit in the budget get it, the rest are told to reset
+// the context after every message and go through the shared streams.
+string Reactor::negotiate_deflate(Connection &conn, const http_request &req)
+{
+    if (!this->config.ws_deflate)
+        return "";
+
+    size_t budget = this->config.ws_deflate_memory;
+    size_t used = this->deflate_memory;
+
+    bool server_takeover = this->config.ws_deflate_server_takeover &&
+                           used + ws::Deflater::memory() <= budget;
+    if (server_takeover)
+        used += ws::Deflater::memory();
+    bool client_takeover = used + ws::Inflater::memory() <= budget;
+
+    string extensions =
+        ws::negotiate_deflate(req.header("Sec-WebSocket-Extensions"),
+                              !server_takeover, !client_takeover, conn.deflate);
+
+    if (!conn.deflate.enabled)
+        return extensions;
+
+    // the client can still have asked for no takeover itself
+    if (!conn.deflate.server_no_context_takeover) {
+        conn.deflater = std::make_unique<ws::Deflater>(true);
+        conn.deflate_memory += ws::Deflater::memory();
+    }
+    if (!conn.deflate.client_no_context_takeover) {
+        conn.inflater = std::make_unique<ws::Inflater>(true);
+        conn.deflate_memory += ws::Inflater::memory();
+    }
+    this->deflate_memory += conn.deflate_memory;
+
+    return extensions;
+}
+
+void Reactor::send_message(Connection &conn, ws::Opcode opcode,
+                           string payload)
+{
+    if (!conn.deflate.enabled ||
+        payload.size() < this->config.ws_deflate_min_size) {
+        ws::send(conn.out, opcode, std::move(payload));
+        return;
+    }
+
+    if (conn.deflater) {
+        // whatever went through the context has to reach the client, even if
+        // it didn't get any smaller
+        ws::send(conn.out, opcode, conn.deflater->compress(payload), true);
+        return;
+    }
+
+    string compressed = this->shared_deflater.compress(payload);
+    if (compressed.size() < payload.size()) {
+        ws::send(conn.out, opcode, std::move(compressed), true);
+    }
+    else {
+        ws::send(conn.out, opcode, std::move(payload));
+    }
+}
+
+void Reactor::send_message(Connection &conn, ws::Broadcast &msg)
+{
+    if (!conn.deflate.enabled ||
+        msg.data().size() < this->config.ws_deflate_min_size) {
+        ws::send(conn.out, msg.plain());
+    }
+    else if (conn.deflater) {
+        // its context is its own, the frame can't be shared
+        this->send_message(conn, msg.type(), string(msg.data()));
+    }
+    else {
+        ws::send(conn.out, msg.deflated(this->shared_deflater));
+    }
+}
+
+// one recv() into the connection's buffer, false once the socket is drained
+// (or closed, then the connection is marked dirty)
+bool Reactor::fill(Connection &conn)
+{
+    auto &in = conn.in;
+    in.prepare(this->max_buf_size);
+
+    int bytes_received = recv(conn.fd, in.write_ptr(), in.writable(), 0);
+    if (bytes_received == -1) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            conn.mark_dirty();
+        }
+        return false;
+    }
+    if (bytes_received == 0) {
+        conn.mark_dirty();
+        return false;
+    }
+
+    in.commit(bytes_received);
+    return true;
+}
+
+void Reactor::cleanup()
+{
+    if (this->dirty.empty())
+        return;
+
+    // only the connections that were closed during this iteration are
+    // visited, idle ones are never touched. Telling spectators a player
+    // left can shed one of ours that fell behind, which comes back dirty:
+    // the list is taken before it's walked, until nothing more is added
+    while (!this->dirty.empty()) {
+        std::vector<ConnId> ids;
+        ids.swap(this->dirty);
+        for (auto id : ids) {
+            auto conn = this->connections.get(id);
+            if (conn == nullptr)
+                continue;
+
+            if (conn->timer != TimerWheel::NONE) {
+                this->timers.cancel(conn->timer);
+            }
+            this->stop_clock(*conn);
+            this->deflate_memory -= conn->deflate_memory;
+            if (conn->limited) {
+                this->limiter->disconnect(conn->ip);
+            }
+            if (conn->is_client) {
+                // the opponent learns about it, on its own reactor if need be
+                this->leave_game(*conn);
+                this->unwatch(*conn);
+                this->games->disconnect();
+            }
+            this->poller->remove(conn->fd);
+            close(conn->fd);
+            this->connections.remove(id);
+        }
+    }
+
+    spdlog::info("reactor {} cleanup: {}", this->id, this->connections.size());
+}
+
+// the client did something, deadlines are only pushed back here, the
+// connection's timer finds out when it goes off
+void Reactor::touch(Connection &conn)
+{
+    conn.last_active_ms = this->now_ms;
+
+    if (conn.is_websocket)
+        return;
+
+    // a request being received keeps the time of its first byte, however
+    // slowly the rest trickles in. Requests we aren't reading don't count
+    if (conn.in.empty() || conn.paused) {
+        conn.request_started_ms = 0;
+    }
+    else if (conn.request_started_ms == 0) {
+        conn.request_started_ms = this->now_ms;
+        this->schedule(conn);
+    }
+}
+
+// when something has to happen to the connection if it stays as it is
+int64_t Reactor::deadline(const Connection &conn) const
+{
+    auto &config = this->config;
+
+    if (conn.lingering)
+        return conn.last_active_ms + config.http_keepalive_timeout_ms;
+
+    if (conn.is_websocket) {
+        if (config.ws_ping_interval_ms == 0)
+            return INT64_MAX;
+        if (conn.ping_sent_ms > conn.last_active_ms)
+            return conn.ping_sent_ms + config.ws_pong_timeout_ms;
+        return conn.last_active_ms + config.ws_ping_interval_ms;
+    }
+
+    int64_t idle = conn.last_active_ms + config.http_keepalive_timeout_ms;
+    if (conn.request_started_ms == 0)
+        return idle;
+    return std::min<int64_t>(
+        idle, conn.request_started_ms + config.http_request_timeout_ms);
+}
+
+// arms the connection's timer, or moves it if it would go off too late
+void Reactor::schedule(Connection &conn)
+{
+    int64_t at = this->deadline(conn);
+
+    if (conn.timer == TimerWheel::NONE) {
+        if (at != INT64_MAX)
+            conn.timer = this->timers.arm(at, conn.id.pack());
+    }
+    else if (at < conn.timer_at) {
+        this->timers.rearm(conn.timer, at);
+    }
+    conn.timer_at = at;
+}
+
+void Reactor::expire_timers()
+{
+    this->expired.clear();
+    this->timers.advance(this->now_ms, this->expired);
+
+    for (auto token : this->expired) {
+        auto conn = this->connections.get(ConnId::unpack(token));
+        if (conn == nullptr)
+            continue;
+
+        conn->timer = TimerWheel::NONE;
+        if (!conn->is_dirty)
+            this->on_deadline(*conn);
+    }
+
+    this->expired.clear();
+    this->clocks.advance(this->now_ms, this->expired);
+
+    for (auto token : this->expired) {
+        auto conn = this->connections.get(ConnId::unpack(token));
+        if (conn == nullptr)
+            continue;
+
+        conn->flag_timer = TimerWheel::NONE;
+        if (!conn->is_dirty)
+            this->on_flag(*conn);
+    }
+}
+
+void Reactor::on_deadline(Connection &conn)
+{
+    // moved back since the timer was armed
+    if (this->deadline(conn) > this->now_ms) {
+        this->schedule(conn);
+        return;
+    }
+
+    bool pong_overdue = conn.ping_sent_ms > conn.last_active_ms;
+
+    if (conn.is_websocket && !conn.lingering && !pong_overdue) {
+        conn.out.push(ping_frame(this->now_ms));
+        conn.ping_sent_ms = this->now_ms;
+        this->schedule_flush(conn);
+        this->schedule(conn);
+        return;
+    }
+
+    // the pong may well be there, we just aren't reading
+    if (pong_overdue && conn.paused) {
+        conn.ping_sent_ms = this->now_ms;
+        this->schedule(conn);
+        return;
+    }
+
+    const char *why = "idle";
+    if (conn.lingering)
+        why = "done lingering";
+    else if (conn.is_websocket)
+        why = "no pong";
+    else if (conn.request_started_ms != 0)
+        why = "request too slow";
+    spdlog::debug("closing connection {}: {}", conn.ip_addr, why);
+    conn.mark_dirty();
+    this->dirty.push_back(conn.id);
+}
+
+// what a player's moves aren't charged for, the time they spent on the wire
+int64_t Reactor::lag(const Connection &conn) const
+{
+    auto cap = this->config.game_lag_compensation_ms;
+    return std::min<int64_t>(conn.rtt_ms, cap);
+}
+
+// The player's clock is running: its flag falls at `flag_at` as far as the
+// game goes, we look a little later in case its move is on the way. A fresh
+// ping keeps the round trip we allow for up to date.
+void Reactor::start_clock(Connection &conn, int64_t flag_at)
+{
+    int64_t at = flag_at + this->lag(conn);
+    if (conn.flag_timer == TimerWheel::NONE)
+        conn.flag_timer = this->clocks.arm(at, conn.id.pack());
+    else
+        this->clocks.rearm(conn.flag_timer, at);
+
+    if (conn.is_websocket && !conn.lingering) {
+        conn.out.push(ping_frame(this->now_ms));
+        this->schedule_flush(conn);
+    }
+}
+
+void Reactor::stop_clock(Connection &conn)
+{
+    if (conn.flag_timer != TimerWheel::NONE) {
+        this->clocks.cancel(conn.flag_timer);
+        conn.flag_timer = TimerWheel::NONE;
+    }
+}
+
+// Games has the last word: the player may have moved on another reactor's
+// watch, left, or been given more time by a shorter round trip
+void Reactor::on_flag(Connection &conn)
+{
+    if (conn.game == 0)
+        return;
+
+    PlayerRef opponent;
+    int64_t flag_at;
+    bool fell = this->games->flag(conn.game, conn.color, this->lag(conn),
+                                  this->now_ms, opponent, this->watchers,
+                                  flag_at);
+    if (!fell) {
+        if (flag_at != 0) {
+            conn.flag_timer = this->clocks.arm(flag_at + this->lag(conn),
+                                               conn.id.pack());
+        }
+        return;
+    }
+
+    this->announce_end(conn, opponent,
+                       proto::ServerMessage{.event = proto::Event::Flag,
+                                            .game = conn.game,
+                                            .color = conn.color});
+}
+
+// why conn's game is over, to it, its opponent and the spectators (the
+// reactors in this->watchers). The room stays until the players leave
+void Reactor::announce_end(Connection &conn, PlayerRef opponent,
+                           proto::ServerMessage msg)
+{
+    this->reply(conn, msg);
+    this->schedule_flush(conn);
+    this->notify_spectators(this->watchers, conn.game, msg);
+    if (opponent) {
+        this->deliver(opponent, std::move(msg));
+    }
+}
+
+// how long the poller can sleep before a connection's timer goes off
+int Reactor::next_timeout()
+{
+    // connections that broke while being flushed at the end of the last
+    // iteration still have to be cleaned up
+    if (!this->dirty.empty())
+        return 0;
+
+    int64_t now = utils::now_ms();
+    int64_t timeout = this->timers.next_timeout(now);
+    int64_t flag = this->clocks.next_timeout(now);
+    if (timeout == -1 || (flag != -1 && flag < timeout))
+        return flag;
+    return timeout;
+}
+
+ssize_t Reactor::recv(int fd, void *buf, size_t buf_len, int flag)
+{
+    auto bytes_received = ::recv(fd, buf, buf_len, flag);
+
+    if (bytes_received == -1 && errno != EAGAIN && errno != EWOULDBLOCK) {
+        perror("recv error");
+    }
+
+    return bytes_received;
+}
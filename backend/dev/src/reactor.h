@@ -0,0 +1,326 @@
+#pragma once
+#include <atomic>
+#include <unordered_map>
+#include <memory>
+#include "asset_cache.h"
+#include "buffer.h"
+#include "games.h"
+#include "http.h"
+#include "http_parser.h"
+#include "limiter.h"
+#include "mailbox.h"
+#include "out_queue.h"
+#include "poller.h"
+#include "protocol.h"
+#include "slab.h"
+#include "timer_wheel.h"
+#include "trie/trie.h"
+#include "utils.h"
+#include "websocket.h"
+
+// stable, generational handle to a connection of a reactor, it stays safe to
+// hold after the connection is gone (lookups just fail)
+using ConnId = SlabId;
+
+struct Connection {
+    ConnId id;
+    int fd;
+    string ip_addr;
+    uint32_t ip = 0; // network byte order
+    // counted in the Limiter's connections for its IP
+    bool limited = false;
+
+    bool is_websocket;
+    bool is_dirty;
+
+    Buffer in; // bytes received but not handled yet
+    HttpParser parser;
+    ws::Decoder ws_decoder; // once is_websocket
+    // permessage-deflate. The streams are only the connection's own while it
+    // keeps a compression context, otherwise the reactor's shared ones are
+    // used
+    ws::DeflateParams deflate;
+    std::unique_ptr<ws::Deflater> deflater;
+    std::unique_ptr<ws::Inflater> inflater;
+    size_t deflate_memory = 0; // taken from the reactor's budget
+    // how game messages are encoded, picked with Sec-WebSocket-Protocol
+    proto::Encoding encoding = proto::Encoding::Json;
+    // counted in Games' clients, from the handshake on
+    bool is_client = false;
+    // the one game it's playing, 0 = none
+    proto::GameCode game = 0;
+    proto::Color color = proto::Color::White;
+    // or the one it's watching, and its place in the reactor's list of that
+    // game's spectators
+    proto::GameCode watching = 0;
+    uint32_t watch_pos = 0;
+    // a spectator too far behind, it skips moves until it's caught up (see
+    // ServerConfig::spectate_max_backlog)
+    bool lagging = false;
+    int64_t lagging_since_ms = 0;
+    uint32_t requests_served = 0;
+
+    OutQueue out; // bytes not written yet
+    // what the poller currently watches the fd for
+    uint32_t interest = poller::READ;
+    // requests stop being read while too much is queued (see
+    // ServerConfig::out_high_water), or for good once a response that closes
+    // the connection is queued
+    bool paused = false;
+    bool close_after_send = false;
+    // something was queued for it by another connection's handler, it's
+    // flushed at the end of the loop iteration
+    bool flush_scheduled = false;
+    // our side is shut down, waiting for the client to close its side
+    bool lingering = false;
+
+    // its one timer in the reactor's wheel, armed for as long as the
+    // connection lives, for the earliest of its deadlines (see
+    // Reactor::deadline). It goes off early rather than being moved every
+    // time the connection does something
+    TimerWheel::TimerId timer = TimerWheel::NONE;
+    int64_t timer_at = 0;
+    // the client was last heard from (plain HTTP: anything happened)
+    int64_t last_active_ms = 0;
+    // the request being received started then, 0 = none
+    int64_t request_started_ms = 0;
+    // the last ping we sent, it's unanswered while last_active_ms is older
+    int64_t ping_sent_ms = 0;
+    // round trip time to the client, from the pongs to our pings
+    int64_t rtt_ms = 0;
+    // while its clock runs in a game with clocks, in the reactor's clocks
+    // wheel
+    TimerWheel::TimerId flag_timer = TimerWheel::NONE;
+
+    void mark_dirty()
+    {
+        is_dirty = true;
+    }
+
+    // stop taking requests, the connection is closed once everything queued
+    // is sent
+    void close_when_sent()
+    {
+        close_after_send = true;
+        paused = true;
+    }
+};
+
+struct ServerConfig {
+    PollerType poller = poller::default_type();
+
+    // number of reactor threads, each with its own SO_REUSEPORT listener,
+    // connection table and event loop. 0 = one per core
+    int threads = 1;
+    // pin reactor i to cpu i (Linux only)
+    bool pin_threads = false;
+
+    // cached files of at least this size are sent with sendfile(2) from an
+    // open fd instead of being kept in memory
+    size_t sendfile_threshold = 512 * 1024;
+
+    // a connection with this much queued up for writing stops having its
+    // requests read until it drains. One holding more than out_max_buffered
+    // in memory (a websocket client not keeping up) is dropped, files being
+    // sendfile()'d don't count towards that
+    size_t out_high_water = 256 * 1024;
+    size_t out_max_buffered = 4 * 1024 * 1024;
+
+    // requests with a bigger header block + body get a 431 / 413
+    size_t http_max_request_size = 16 * 1024;
+    // keep-alive connections are closed after this long without a request,
+    // or once they have served this many requests
+    int http_keepalive_timeout_ms = 15000;
+    uint32_t http_max_keepalive_requests = 1000;
+    // a request (the websocket handshake too) has this long from its first
+    // byte, or from the connection being opened, to be received whole
+    int http_request_timeout_ms = 10000;
+
+    // websocket messages (all fragments together) bigger than this close the
+    // connection with 1009
+    size_t ws_max_message_size = 64 * 1024;
+    // a websocket client quiet for ws_ping_interval_ms is pinged, and
+    // dropped if nothing comes back within ws_pong_timeout_ms (a half-open
+    // connection would otherwise stay forever). 0 = never ping
+    int ws_ping_interval_ms = 30000;
+    int ws_pong_timeout_ms = 10000;
+
+    // permessage-deflate (RFC 7692), messages smaller than
+    // ws_deflate_min_size are sent uncompressed either way. We reset our
+    // compression context after every message unless
+    // ws_deflate_server_takeover is set, so a broadcast is deflated once for
+    // everyone; keeping a context per connection compresses small unicast
+    // messages better, at ~256K each.
+    // The zlib state connections keep for themselves (both directions) is
+    // capped at ws_deflate_memory per reactor, connections past that reset
+    // both contexts after every message and share the reactor's streams.
+    bool ws_deflate = true;
+    size_t ws_deflate_min_size = 256;
+    bool ws_deflate_server_takeover = false;
+    size_t ws_deflate_memory = 64 * 1024 * 1024;
+
+    // websocket clients connected and games going on at once, across all
+    // reactors (the Python backend's CONN_LIMIT / ROOMS_LIMIT)
+    size_t game_max_clients = 50000;
+    size_t game_max_games = 25000;
+
+    // a player's clock isn't charged for its round trip time (measured with
+    // our pings), up to this much per move: a client can delay its pongs to
+    // look further away than it is
+    int game_lag_compensation_ms = 300;
+
+    // a spectator with more than spectate_max_backlog bytes queued stops
+    // being sent moves, once it's down to half of that it gets the whole
+    // game in one message instead. One that is still behind after
+    // spectate_max_lag_ms is dropped
+    size_t spectate_max_backlog = 16 * 1024;
+    int spectate_max_lag_ms = 30000;
+
+    // any reactor answers requests for this path with the spectator fan-out
+    // numbers of all of them, as JSON. "" = nowhere, they're internals any
+    // client could read, so it's only on when asked for (--stats=PATH)
+    string stats_path;
+
+    // per client IP, over all reactors (see Limiter): connections open at
+    // once, new connections and websocket messages per second with the
+    // bursts allowed, and how long going over bans the IP (a fast
+    // reconnecting client is only refused). A banned IP's connections are
+    // closed as soon as they're accepted and its websockets with 1008.
+    // Benchmarks connect everything from one address, they need it off
+    bool limit = true;
+    Limits limits;
+};
+
+// What a reactor's spectator fan-out has been doing. Only its reactor writes
+// them, they're atomics so that any reactor can read them for the stats page.
+struct FanoutStats {
+    // fan-out latency: from a move being accepted (maybe on another reactor)
+    // until it's queued for all of this reactor's spectators, bucket i counts
+    // the ones under 2^(i + 1) us
+    static const int LATENCY_BUCKETS = 32;
+
+    std::atomic<uint64_t> spectators{0};  // watching right now
+    std::atomic<uint64_t> updates{0};     // fanned out, once per reactor
+    std::atomic<uint64_t> sent{0};        // queued to a spectator
+    std::atomic<uint64_t> dropped{0};     // skipped, the spectator was behind
+    std::atomic<uint64_t> resyncs{0};     // whole games sent to catch up
+    std::atomic<uint64_t> disconnects{0}; // behind for too long
+    std::atomic<uint64_t> snapshots{0};   // Snapshot frames queued
+    std::atomic<uint64_t> latency[LATENCY_BUCKETS] = {};
+
+    void add_latency(int64_t us);
+};
+
+// One event loop. A reactor owns everything it touches (listener, poller,
+// connections), the only things shared between reactors are the read-only
+// router, the asset cache and the game registry. A message for a connection
+// of another reactor goes through that reactor's mailbox.
+class Reactor {
+    int id;
+    int listenerfd;
+    int max_buf_size;
+    Trie *router;
+    const ServerConfig &config;
+    AssetCache *assets;
+
+    std::unique_ptr<Poller> poller;
+    Slab<Connection> connections;
+    std::vector<ConnId> dirty; // closed during the current loop iteration
+
+    // a timer per connection, by ConnId
+    TimerWheel timers;
+    // the flag timers of our players whose clock runs, by ConnId
+    TimerWheel clocks;
+    std::vector<uint64_t> expired; // reused
+    int64_t now_ms; // the current loop iteration's
+
+    // permessage-deflate streams of the connections without context
+    // takeover, and what the ones with it hold
+    ws::Deflater shared_deflater{false};
+    ws::Inflater shared_inflater{false};
+    size_t deflate_memory = 0;
+    string inflated; // the current message, when it came compressed
+
+    Games *games;
+    Limiter *limiter;
+    // every reactor of the server, by id, for their mailboxes
+    const std::vector<std::unique_ptr<Reactor>> *peers = nullptr;
+    Mailbox mailbox;
+    std::vector<Mail> mail; // taken from the mailbox, reused
+    std::vector<ConnId> scheduled_flushes;
+
+    // our spectators, by the game they watch
+    std::unordered_map<proto::GameCode, std::vector<ConnId>> spectators;
+    std::vector<int> watchers; // reactors watching a game, reused
+    Catchup catchup;           // reused
+    FanoutStats stats;
+
+    void handle_new_conn();
+    void handle_incoming(Connection &conn);
+    void handle_writable(Connection &conn);
+    bool handle_http(Connection &conn);
+    bool handle_websocket(Connection &conn);
+    bool handle_message(Connection &conn, const ws::Message &msg);
+    string negotiate_deflate(Connection &conn, const http_request &req);
+    void close_websocket(Connection &conn, uint16_t status);
+    void handle_mail();
+
+    PlayerRef player(const Connection &conn) const;
+    // `flag_at`: `to`'s clock runs out then, the message starts it
+    void deliver(PlayerRef to, proto::ServerMessage msg, int64_t flag_at = 0);
+    void reply(Connection &conn, const proto::ServerMessage &msg);
+    void reply_error(Connection &conn, proto::Error error);
+    void leave_game(Connection &conn);
+    int64_t lag(const Connection &conn) const;
+    void start_clock(Connection &conn, int64_t flag_at);
+    void stop_clock(Connection &conn);
+    void on_flag(Connection &conn);
+    void announce_end(Connection &conn, PlayerRef opponent,
+                      proto::ServerMessage msg);
+    void watch(Connection &conn, proto::GameCode game, uint64_t from);
+    void send_catchup(Connection &conn, const Catchup &catchup);
+    void unwatch(Connection &conn);
+    void notify_spectators(const std::vector<int> &reactors,
+                           proto::GameCode game,
+                           const proto::ServerMessage &msg,
+                           bool game_over = false);
+    void fan_out(proto::GameCode game, const proto::ServerMessage &msg,
+                 bool game_over, int64_t posted_us);
+    void catch_up(Connection &conn);
+    string stats_json() const;
+    void schedule_flush(Connection &conn);
+    void flush_scheduled();
+    bool fill(Connection &conn);
+    void flush(Connection &conn);
+    void linger(Connection &conn);
+    void drain(Connection &conn);
+    void update_interest(Connection &conn);
+    void cleanup();
+
+    void touch(Connection &conn);
+    int64_t deadline(const Connection &conn) const;
+    void schedule(Connection &conn);
+    void expire_timers();
+    void on_deadline(Connection &conn);
+    int next_timeout();
+
+    ssize_t recv(int, void *, size_t, int = 0);
+
+  public:
+    // a message to one connection, deflated if it negotiated that and the
+    // message is big enough
+    void send_message(Connection &conn, ws::Opcode opcode, string payload);
+    // the same message to many, every connection without its own compression
+    // context shares one encoded frame
+    void send_message(Connection &conn, ws::Broadcast &msg);
+
+    Reactor(int id, int listenerfd, Trie *router, int max_buf_size,
+            const ServerConfig &config, AssetCache *assets = nullptr,
+            Games *games = nullptr, Limiter *limiter = nullptr);
+    // the other reactors, before any of them runs
+    void set_peers(const std::vector<std::unique_ptr<Reactor>> *peers);
+    void run();
+
+    // from any thread
+    void post(Mail mail);
+};
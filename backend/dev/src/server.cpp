@@ -1,12 +1,18 @@
 #include <algorithm>
+#include <thread>
 #include <cstdlib>
 #include <iostream>
 #include <sys/types.h>
+#include <sys/resource.h>
 #include <sys/socket.h>
 #include <netdb.h>
 #include <unistd.h>
-#include <poll.h>
+#include <signal.h>
 #include <arpa/inet.h>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
 #include "openssl/sha.h"
 #include "server.h"
 #include "http.h"
@@ -18,18 +24,21 @@
 #include <nlohmann/json.hpp>
 using json = nlohmann::json;
 
-Server::Server(char const *port, int max_buf_size, int backlog)
+Server::Server(char const *port, int max_buf_size, int backlog,
+               ServerConfig config)
 {
     this->port = port;
     this->backlog = backlog;
     this->max_buf_size = max_buf_size;
+    this->config = config;
     this->router = new Trie("/");
 }
 
-void Server::run()
+int Server::create_listener(bool reuseport)
 {
     addrinfo hints, *p, *serverinfo;
     int yes = 1;
+    int listenerfd;
 
     memset(&hints, 0, sizeof(hints));
     hints.ai_socktype = SOCK_STREAM;
@@ -45,8 +54,8 @@ void Server::run()
 
     // bind to the first socket that works
     for (p = serverinfo; p != nullptr; p = p->ai_next) {
-        this->listenerfd = socket(p->ai_family, p->ai_socktype, p->ai_protocol);
-        if (this->listenerfd == -1) {
+        listenerfd = socket(p->ai_family, p->ai_socktype, p->ai_protocol);
+        if (listenerfd == -1) {
             continue;
         }
 
@@ -57,7 +66,16 @@ void Server::run()
             exit(1);
         }
 
-        if (bind(this->listenerfd, p->ai_addr, p->ai_addrlen) == -1) {
+        // every reactor binds its own listener to the same port and the
+        // kernel load balances incoming connections between them
+        if (reuseport && setsockopt(listenerfd, SOL_SOCKET, SO_REUSEPORT,
+                                    &yes, sizeof(int)) == -1) {
+            perror("setsockopt SO_REUSEPORT");
+            exit(1);
+        }
+
+        if (bind(listenerfd, p->ai_addr, p->ai_addrlen) == -1) {
+            close(listenerfd);
             continue;
         }
 
@@ -69,224 +87,94 @@ void Server::run()
         exit(EXIT_FAILURE);
     }
 
-    if (listen(this->listenerfd, this->backlog) == -1) {
+    if (listen(listenerfd, this->backlog) == -1) {
         perror("listening error");
         exit(EXIT_FAILURE);
     }
 
     freeaddrinfo(serverinfo);
 
-    pollfd listener = {.fd = this->listenerfd, .events = POLLIN};
-    this->connections.push_back(
-        Connection{.__is_listener = true, .fd = this->listenerfd});
-    this->pfds.push_back(listener);
-
-    std::cout << "listening on port " << this->port << std::endl;
-
-    while (true) {
-        int poll_count = poll(this->pfds.data(), this->pfds.size(), -1);
-
-        if (poll_count == -1) {
-            perror("poll");
-            exit(EXIT_FAILURE);
-        }
-
-        for (size_t i = 0; i < this->pfds.size(); i++) {
-            auto &p = this->pfds[i];
-            auto &conn = this->connections[i];
-            assert(p.fd == conn.fd && "connections and pfds must be in sync");
+    utils::set_nonblocking(listenerfd);
 
-            if (p.revents & POLLIN) {
-                if (p.fd == this->listenerfd) {
-                    spdlog::info("new connection");
-                    this->handle_new_conn();
-                }
-                else {
-                    spdlog::info("existing connection");
-                    this->handle_incoming(conn);
-                }
-            }
-        }
-
-        this->cleanup();
-    }
-
-    close(this->listenerfd);
+    return listenerfd;
 }
 
-void Server::handle_new_conn()
+static void pin_to_cpu(int cpu)
 {
-    sockaddr_storage client_addr;
-    socklen_t client_addrlen = sizeof(client_addr);
-    char ip_addr[INET_ADDRSTRLEN];
-
-    int clientfd =
-        accept(this->listenerfd, reinterpret_cast<sockaddr *>(&client_addr),
-               &client_addrlen);
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
 
-    auto temp = reinterpret_cast<sockaddr *>(&client_addr);
-    auto sin_addr = reinterpret_cast<sockaddr_in *>(temp)->sin_addr;
-
-    inet_ntop(client_addr.ss_family, &sin_addr, ip_addr, sizeof(ip_addr));
-
-    spdlog::info("IP Address: {}", ip_addr);
-
-    if (clientfd == -1) {
-        perror("accept");
-    }
-    else {
-        pollfd p = {.fd = clientfd, .events = POLLIN};
-
-        this->connections.push_back(Connection{
-            .fd = clientfd,
-            .ip_addr = ip_addr,
-            .__is_listener = false,
-            .is_websocket = false,
-            .is_dirty = false,
-        });
-
-        this->pfds.push_back(p);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+        spdlog::warn("unable to pin reactor to cpu {}", cpu);
     }
+#else
+    spdlog::warn("cpu pinning is not supported on this platform");
+#endif
 }
 
-void Server::handle_incoming(Connection &conn)
+// every player is a socket, the default soft limit (often 1024) is far below
+// what one box can host
+static void raise_fd_limit()
 {
-    if (conn.is_websocket) {
-        this->handle_websocket(conn);
-    }
-    else {
-        this->handle_http(conn);
+    rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 &&
+        limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        if (setrlimit(RLIMIT_NOFILE, &limit) != 0) {
+            spdlog::warn("unable to raise the open file limit");
+        }
     }
 }
 
-void Server::handle_http(Connection &conn)
+void Server::run()
 {
-    int fd = conn.fd;
-    char buf[this->max_buf_size];
+    // a peer closing mid-send should be an EPIPE, not kill the process
+    signal(SIGPIPE, SIG_IGN);
 
-    int bytes_received = recv(fd, buf, this->max_buf_size - 1, 0);
-    if (bytes_received == -1) {
-        return;
-    }
-    else if (bytes_received == 0) {
-        conn.mark_dirty();
-        return;
-    }
-    buf[bytes_received] = '\0';
-
-    auto req = this->process_request(buf);
-    HTTP http(fd, req);
+    int cores = std::max(1u, std::thread::hardware_concurrency());
+    int count = this->config.threads > 0 ? this->config.threads : cores;
 
-    if (req.isWebsocketHandshake) {
-        string response = http.websocket_handshake();
-
-        if (send(fd, response.data(), response.size(), 0) == -1) {
-            conn.mark_dirty();
-            return;
-        }
+    raise_fd_limit();
 
-        conn.is_websocket = true;
+    this->games = std::make_unique<Games>(this->config.game_max_games,
+                                          this->config.game_max_clients);
+    if (this->config.limit) {
+        this->limiter = std::make_unique<Limiter>(this->config.limits);
     }
-    else {
-        auto route = this->router->find(req.path);
 
-        if (route) {
-            auto route_handler = route->value;
-
-            if (route_handler) {
-                if (route->isWildcard) {
-                    req.param = route->wildcardContent;
-                }
-                route_handler(req, http);
-            }
-        }
-        else {
-            string response = http.not_found();
-
-            if (send(fd, response.data(), response.size(), 0) == -1) {
-                conn.mark_dirty();
-            }
-        }
+    for (int i = 0; i < count; i++) {
+        int listenerfd = this->create_listener(count > 1);
+        this->reactors.push_back(std::make_unique<Reactor>(
+            i, listenerfd, this->router, this->max_buf_size, this->config,
+            this->assets.get(), this->games.get(), this->limiter.get()));
     }
-}
-
-void Server::handle_websocket(Connection &conn)
-{
-    int fd = conn.fd;
-    unsigned char buf[this->max_buf_size];
-    int bytes_received = recv(fd, buf, this->max_buf_size, 0);
-
-    if (bytes_received == -1) {
-        return;
-    }
-    if (bytes_received == 0) {
-        conn.mark_dirty();
-        return;
+    for (auto &reactor : this->reactors) {
+        reactor->set_peers(&this->reactors);
     }
 
-    auto data = ws::parse_frame(buf);
+    std::cout << "listening on port " << this->port << " (" << count
+              << " reactor" << (count > 1 ? "s" : "") << ")" << std::endl;
 
-    if (data.is_close_frame) {
-        spdlog::info("client disconnect");
-        // client is disconnecting
-        // send back a close frame in response
-        auto buf = ws::create_close_frame();
-        send(fd, buf, 2, 0);
-
-        conn.mark_dirty();
+    if (count == 1) {
+        if (this->config.pin_threads)
+            pin_to_cpu(0);
+        this->reactors[0]->run();
         return;
     }
-    else {
-        spdlog::info("client sending data");
-    }
-}
-
-void Server::cleanup()
-{
-    for (size_t i = 0; i < this->connections.size(); i++) {
-        auto &conn = this->connections[i];
-        auto &p = this->pfds[i];
-
-        assert(p.fd == conn.fd && "connections and pfds must be in sync");
-
-        if (conn.__is_listener)
-            continue;
-
-        if (conn.is_dirty) {
-            close(conn.fd);
-            this->connections.erase(this->connections.begin() + i);
-            this->pfds.erase(this->pfds.begin() + i);
-        }
-    }
-
-    spdlog::info("cleanup: {}", this->pfds.size());
-}
-
-http_request Server::process_request(char *buf)
-{
-    string http_msg(buf);
-    http_request request;
 
-    auto lines = utils::split_str(http_msg, "\r\n");
-    auto tokens =
-        utils::split_str(lines[0], " "); // lines[0] is the http startline
-
-    request.method = tokens[0];
-    request.path = tokens[1];
-    request.param = "";
-
-    for (int i = 1; i < lines.size(); i++) {
-        auto tokens = utils::split_str(lines[i], ": ");
-        request.headers[tokens[0]] = tokens[1];
+    for (int i = 0; i < count; i++) {
+        this->threads.emplace_back([this, i, cores]() {
+            if (this->config.pin_threads)
+                pin_to_cpu(i % cores);
+            this->reactors[i]->run();
+        });
     }
 
-    if (request.headers["Upgrade"] == "websocket" &&
-        request.headers["Connection"] == "Upgrade" &&
-        request.headers.count("Sec-WebSocket-Key") > 0) {
-        request.isWebsocketHandshake = true;
+    for (auto &t : this->threads) {
+        t.join();
     }
-
-    return request;
 }
 
 void Server::route(string path, RouteHandler handler)
@@ -294,25 +182,9 @@ void Server::route(string path, RouteHandler handler)
     this->router->insert(path, handler);
 }
 
-ssize_t Server::send(int fd, const void *buf, size_t buf_len, int flag)
+void Server::cache_static(string dir)
 {
-    auto bytes_sent = ::send(fd, buf, buf_len, flag);
-
-    if (bytes_sent == -1) {
-        // TODO: log error here
-        perror("sent error");
-    }
-
-    return bytes_sent;
+    this->assets =
+        std::make_unique<AssetCache>(dir, this->config.sendfile_threshold);
 }
 
-ssize_t Server::recv(int fd, void *buf, size_t buf_len, int flag)
-{
-    auto bytes_received = ::recv(fd, buf, buf_len - 1, flag);
-
-    if (bytes_received == -1) {
-        perror("recv error");
-    }
-
-    return bytes_received;
-}
@@ -1,26 +1,13 @@
 #pragma once
-#include <poll.h>
-#include <set>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "asset_cache.h"
+#include "games.h"
 #include "http.h"
+#include "limiter.h"
+#include "reactor.h"
 #include "trie/trie.h"
-#include "utils.h"
-#include "websocket.h"
-
-struct Connection {
-    bool __is_listener;
-
-    string ip_addr;
-    int fd;
-
-    bool is_websocket;
-    bool is_dirty;
-
-    void mark_dirty()
-    {
-        assert(__is_listener == false && "can't modify the listener socket");
-        is_dirty = true;
-    }
-};
 
 class Server {
     char const *port;
@@ -28,23 +15,22 @@ class Server {
     int max_buf_size;
     Trie *router;
 
-    int listenerfd;
-
-    std::vector<pollfd> pfds;
-    std::vector<Connection> connections;
+    ServerConfig config;
+    std::unique_ptr<AssetCache> assets;
+    std::unique_ptr<Games> games;
+    std::unique_ptr<Limiter> limiter;
 
-    http_request process_request(char *buf);
-    void handle_new_conn();
-    void handle_incoming(Connection &conn);
-    void handle_http(Connection &conn);
-    void handle_websocket(Connection &conn);
-    void cleanup();
+    std::vector<std::unique_ptr<Reactor>> reactors;
+    std::vector<std::thread> threads;
 
-    ssize_t send(int, const void *, size_t, int = 0);
-    ssize_t recv(int, void *, size_t, int = 0);
+    int create_listener(bool reuseport);
 
   public:
-    Server(char const *port, int max_buf_size, int backlog = 10);
+    Server(char const *port, int max_buf_size, int backlog = 10,
+           ServerConfig config = {});
     void run();
     void route(string path, RouteHandler handler);
+    // keep every file under dir in memory, HTTP::sendAsset / sendFile serve
+    // them from there instead of reading the disk
+    void cache_static(string dir);
 };
@@ -0,0 +1,132 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <vector>
+
+// Handle to an entry of a Slab. The generation is bumped every time a slot is
+// freed, so a handle kept around after its entry was removed (e.g. by a game
+// room holding on to a player that disconnected) simply stops resolving
+// instead of pointing at whoever reused the slot.
+struct SlabId {
+    uint32_t index = 0;
+    uint32_t generation = 0; // 0 is never handed out, SlabId{} is "null"
+
+    uint64_t pack() const
+    {
+        return (uint64_t(generation) << 32) | index;
+    }
+
+    static SlabId unpack(uint64_t v)
+    {
+        return SlabId{.index = uint32_t(v), .generation = uint32_t(v >> 32)};
+    }
+
+    bool is_null() const
+    {
+        return generation == 0;
+    }
+
+    bool operator==(const SlabId &) const = default;
+};
+
+// Object pool with O(1) insert / lookup / remove.
+//
+// Entries live in fixed size pages that are never moved, so a T& stays valid
+// until that entry is removed, even if the slab grows in the meantime. Freed
+// slots are kept in an intrusive free list and reused LIFO.
+template <typename T, size_t PageSize = 1024> class Slab {
+    struct Slot {
+        std::optional<T> value;
+        uint32_t generation = 1;
+        uint32_t next_free = 0;
+    };
+
+    static const uint32_t NONE = UINT32_MAX;
+
+    std::vector<std::unique_ptr<Slot[]>> pages;
+    uint32_t capacity = 0;
+    uint32_t free_head = NONE;
+    size_t count = 0;
+
+    Slot &slot(uint32_t index)
+    {
+        return this->pages[index / PageSize][index % PageSize];
+    }
+
+  public:
+    template <typename... Args> SlabId emplace(Args &&...args)
+    {
+        if (this->free_head == NONE) {
+            // grab a new page and thread it onto the free list
+            this->pages.push_back(std::make_unique<Slot[]>(PageSize));
+            for (size_t i = 0; i < PageSize; i++) {
+                uint32_t index = this->capacity + i;
+                this->slot(index).next_free =
+                    i + 1 < PageSize ? index + 1 : NONE;
+            }
+            this->free_head = this->capacity;
+            this->capacity += PageSize;
+        }
+
+        uint32_t index = this->free_head;
+        Slot &s = this->slot(index);
+        this->free_head = s.next_free;
+
+        s.value.emplace(std::forward<Args>(args)...);
+        this->count++;
+
+        return SlabId{.index = index, .generation = s.generation};
+    }
+
+    SlabId insert(T value)
+    {
+        return this->emplace(std::move(value));
+    }
+
+    // nullptr if the handle is stale or was never valid
+    T *get(SlabId id)
+    {
+        if (id.index >= this->capacity)
+            return nullptr;
+
+        Slot &s = this->slot(id.index);
+        if (s.generation != id.generation || !s.value)
+            return nullptr;
+
+        return &*s.value;
+    }
+
+    bool remove(SlabId id)
+    {
+        if (this->get(id) == nullptr)
+            return false;
+
+        Slot &s = this->slot(id.index);
+        s.value.reset();
+        // skip 0 on wrap around so a null handle never matches
+        if (++s.generation == 0)
+            s.generation = 1;
+        s.next_free = this->free_head;
+        this->free_head = id.index;
+        this->count--;
+
+        return true;
+    }
+
+    size_t size() const
+    {
+        return this->count;
+    }
+
+    // visits every live entry, O(capacity)
+    template <typename F> void for_each(F &&fn)
+    {
+        for (uint32_t i = 0; i < this->capacity; i++) {
+            Slot &s = this->slot(i);
+            if (s.value) {
+                fn(SlabId{.index = i, .generation = s.generation}, *s.value);
+            }
+        }
+    }
+};
@@ -0,0 +1,177 @@
+#include <algorithm>
+#include <bit>
+#include "timer_wheel.h"
+
+static const int TOP_BITS = TimerWheel::SLOT_BITS * TimerWheel::LEVELS;
+
+TimerWheel::TimerWheel(int64_t now)
+{
+    this->now = now;
+    std::fill(std::begin(this->heads), std::end(this->heads), NONE);
+}
+
+void TimerWheel::link(TimerId id)
+{
+    auto &node = this->nodes[id];
+    uint64_t differ = uint64_t(node.deadline ^ this->now);
+
+    if (node.deadline <= this->now) {
+        node.bucket = DUE;
+    }
+    else if (differ >> TOP_BITS) {
+        node.bucket = DISTANT;
+    }
+    else {
+        // the highest bit where the deadline differs from the clock picks
+        // the level, its slot there is always ahead of the clock's
+        int level = (63 - std::countl_zero(differ)) / SLOT_BITS;
+        int slot = (node.deadline >> (level * SLOT_BITS)) & (SLOTS - 1);
+        node.bucket = level * SLOTS + slot;
+        this->occupied[level] |= uint64_t(1) << slot;
+    }
+
+    node.prev = NONE;
+    node.next = this->heads[node.bucket];
+    if (node.next != NONE)
+        this->nodes[node.next].prev = id;
+    this->heads[node.bucket] = id;
+}
+
+void TimerWheel::unlink(TimerId id)
+{
+    auto &node = this->nodes[id];
+
+    if (node.prev != NONE)
+        this->nodes[node.prev].next = node.next;
+    else
+        this->heads[node.bucket] = node.next;
+    if (node.next != NONE)
+        this->nodes[node.next].prev = node.prev;
+
+    if (node.bucket < DISTANT && this->heads[node.bucket] == NONE) {
+        this->occupied[node.bucket / SLOTS] &=
+            ~(uint64_t(1) << (node.bucket % SLOTS));
+    }
+}
+
+TimerWheel::TimerId TimerWheel::arm(int64_t deadline, uint64_t token)
+{
+    TimerId id = this->free_list;
+    if (id != NONE) {
+        this->free_list = this->nodes[id].next;
+    }
+    else {
+        id = this->nodes.size();
+        this->nodes.emplace_back();
+    }
+
+    this->nodes[id].deadline = deadline;
+    this->nodes[id].token = token;
+    this->link(id);
+    this->count++;
+    return id;
+}
+
+void TimerWheel::rearm(TimerId id, int64_t deadline)
+{
+    this->unlink(id);
+    this->nodes[id].deadline = deadline;
+    this->link(id);
+}
+
+void TimerWheel::cancel(TimerId id)
+{
+    this->unlink(id);
+    this->nodes[id].bucket = FREE;
+    this->nodes[id].next = this->free_list;
+    this->free_list = id;
+    this->count--;
+}
+
+void TimerWheel::expire(uint16_t bucket, std::vector<uint64_t> &expired)
+{
+    while (this->heads[bucket] != NONE) {
+        TimerId id = this->heads[bucket];
+        expired.push_back(this->nodes[id].token);
+        this->cancel(id);
+    }
+}
+
+int64_t TimerWheel::next_tick() const
+{
+    for (int level = 0; level < LEVELS; level++) {
+        int shift = level * SLOT_BITS;
+        int current = (this->now >> shift) & (SLOTS - 1);
+        // only the slots after the clock's have anything, the ones before
+        // it belong to the next turn of the level above
+        uint64_t ahead = 0;
+        if (current < SLOTS - 1)
+            ahead = this->occupied[level] & (~uint64_t(0) << (current + 1));
+        if (ahead) {
+            int up = shift + SLOT_BITS;
+            int64_t turn = this->now >> up << up;
+            return turn + (int64_t(std::countr_zero(ahead)) << shift);
+        }
+    }
+
+    if (this->heads[DISTANT] != NONE)
+        return ((this->now >> TOP_BITS) + 1) << TOP_BITS;
+    return INT64_MAX;
+}
+
+void TimerWheel::advance(int64_t now, std::vector<uint64_t> &expired)
+{
+    this->expire(DUE, expired);
+
+    // straight to the ticks where something happens, whatever is in
+    // between is empty
+    while (true) {
+        int64_t tick = this->next_tick();
+        if (tick > now)
+            break;
+        this->now = tick;
+
+        // from the top, a timer can fall through more than one level
+        if ((tick & ((int64_t(1) << TOP_BITS) - 1)) == 0) {
+            TimerId id = this->heads[DISTANT];
+            this->heads[DISTANT] = NONE;
+            while (id != NONE) {
+                TimerId next = this->nodes[id].next;
+                this->link(id);
+                id = next;
+            }
+        }
+        for (int level = LEVELS - 1; level > 0; level--) {
+            int shift = level * SLOT_BITS;
+            if ((tick & ((int64_t(1) << shift) - 1)) != 0)
+                continue;
+
+            uint16_t bucket = level * SLOTS + ((tick >> shift) & (SLOTS - 1));
+            TimerId id = this->heads[bucket];
+            this->heads[bucket] = NONE;
+            this->occupied[level] &= ~(uint64_t(1) << (bucket % SLOTS));
+            while (id != NONE) {
+                TimerId next = this->nodes[id].next;
+                this->link(id);
+                id = next;
+            }
+        }
+
+        this->expire(tick & (SLOTS - 1), expired);
+        // cascaded timers due right at this tick
+        this->expire(DUE, expired);
+    }
+
+    this->now = std::max(this->now, now);
+}
+
+int64_t TimerWheel::next_timeout(int64_t now) const
+{
+    if (this->heads[DUE] != NONE)
+        return 0;
+
+    int64_t tick = this->next_tick();
+    if (tick == INT64_MAX)
+        return -1;
+    return std::max<int64_t>(0, tick - now);
+}
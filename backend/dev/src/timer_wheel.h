@@ -0,0 +1,80 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Timers for a reactor's connections. Arming, cancelling and moving one is
+// O(1) however many there are, and expiring costs O(1) per timer plus the
+// cascades described below, so the cost per connection stays flat.
+//
+// A hierarchical timing wheel (Varghese and Lauck, the Linux kernel has the
+// same): LEVELS levels of SLOTS slots, a level 0 slot is one ms and a level
+// n slot covers SLOTS^n ms. A timer goes in the lowest level whose slot
+// isn't the current one, i.e. where its deadline's bits first differ from
+// the clock's. When the clock gets to a level n slot, its timers are
+// cascaded to the levels below, at most LEVELS - 1 times over a timer's
+// life. Deadlines further away than SLOTS^LEVELS ms (4.6 hours) wait in an
+// overflow list that's looked at every time the top level wraps around.
+//
+// The timers are nodes of one vector linked by index, their owners hold a
+// TimerId. Times are in ms of whatever clock the caller goes by, the
+// reactor's is utils::now_ms().
+class TimerWheel {
+  public:
+    using TimerId = uint32_t;
+    static const TimerId NONE = UINT32_MAX;
+
+    static const int SLOT_BITS = 6;
+    static const int SLOTS = 1 << SLOT_BITS;
+    static const int LEVELS = 4;
+
+  private:
+    // the LEVELS * SLOTS slots, then these
+    static const uint16_t DISTANT = LEVELS * SLOTS; // the overflow list
+    static const uint16_t DUE = DISTANT + 1; // deadline passed when armed
+    static const uint16_t FREE = UINT16_MAX;
+
+    struct Node {
+        int64_t deadline;
+        uint64_t token;
+        TimerId prev;
+        TimerId next;
+        uint16_t bucket;
+    };
+
+    std::vector<Node> nodes;
+    TimerId free_list = NONE;
+    TimerId heads[DUE + 1];
+    // a bit per level slot with timers in it
+    uint64_t occupied[LEVELS] = {};
+    int64_t now;
+    size_t count = 0;
+
+    void link(TimerId id);
+    void unlink(TimerId id);
+    void expire(uint16_t bucket, std::vector<uint64_t> &expired);
+    // when the next slot with timers comes up, INT64_MAX if none does
+    int64_t next_tick() const;
+
+  public:
+    explicit TimerWheel(int64_t now);
+
+    // `token` is handed back by advance() once `deadline` has passed
+    TimerId arm(int64_t deadline, uint64_t token);
+    // a new deadline for an armed timer, it keeps its id
+    void rearm(TimerId id, int64_t deadline);
+    void cancel(TimerId id);
+
+    // Moves the clock forward to `now`, appending the tokens of the timers
+    // that expired to `expired`. Those timers are gone, their ids may be
+    // handed out again by the next arm()
+    void advance(int64_t now, std::vector<uint64_t> &expired);
+    // ms from `now` until advance() has something to do, -1 if nothing is
+    // armed. It can be early (a cascade), never late
+    int64_t next_timeout(int64_t now) const;
+
+    size_t size() const
+    {
+        return this->count;
+    }
+};
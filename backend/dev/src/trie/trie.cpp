@@ -47,7 +47,7 @@ void Trie::insert(string path, RouteHandler value)
     currentNode->setValue(value);
 }
 
-Node *Trie::find(string path)
+Node *Trie::find(std::string_view path, std::string_view *wildcardContent)
 {
     if (path == "/") {
         if (!this->root->isTerminal()) {
@@ -56,17 +56,25 @@ Node *Trie::find(string path)
         return this->root;
     }
 
-    auto path_segments = utils::split_str(path, "/");
-
+    // walk the path one segment at a time, without copying it
     Node *currentNode = this->root;
-    for (auto p : path_segments) {
+    size_t pos = path.find_first_not_of('/');
+
+    while (pos != std::string_view::npos) {
+        size_t end = path.find('/', pos);
+        size_t len = end == std::string_view::npos ? path.size() - pos
+                                                   : end - pos;
+        auto p = path.substr(pos, len);
+        pos = path.find_first_not_of('/', pos + len);
+        bool isLast = pos == std::string_view::npos;
+
         bool found = false;
 
         for (auto c : currentNode->getChildren()) {
             // wildcards only work for the ending path for now
-            if (c->path == p || (c->isWildcard && p == path_segments.back())) {
-                if (c->isWildcard) {
-                    c->wildcardContent = p; 
+            if (c->path == p || (c->isWildcard && isLast)) {
+                if (c->isWildcard && wildcardContent) {
+                    *wildcardContent = p;
                 }
                 currentNode = c;
                 found = true;
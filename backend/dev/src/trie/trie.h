@@ -1,4 +1,5 @@
 #pragma once
+#include <string_view>
 #include <vector>
 #include "src/http.h"
 
@@ -17,8 +18,7 @@ class Node {
     // delete a function pointer
     RouteHandler value;
 
-    bool isWildcard;
-    string wildcardContent;
+    bool isWildcard = false;
 
     Node(string path = "/", RouteHandler value = nullptr);
     void addChild(Node *);
@@ -33,7 +33,10 @@ class Trie {
 
   public:
     Trie(string root);
-    Node *find(string path);
+    // the segment matched by a wildcard is written to *wildcardContent, the
+    // trie itself is never modified so it can be shared between threads
+    Node *find(std::string_view path,
+               std::string_view *wildcardContent = nullptr);
     void insert(string path, RouteHandler handler);
     void remove(string path);
     void display(Node *n = nullptr);
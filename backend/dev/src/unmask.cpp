@@ -0,0 +1,150 @@
+#include <cstdint>
+#include <cstring>
+#include "unmask.h"
+
+#if defined(__x86_64__)
+#define UNMASK_X86
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#define UNMASK_NEON
+#include <arm_neon.h>
+#endif
+
+// the key as it applies from byte 0 of `data`
+static uint32_t rotated_key(const unsigned char key[4], size_t key_offset)
+{
+    unsigned char k[4];
+    for (int i = 0; i < 4; i++) {
+        k[i] = key[(i + key_offset) % 4];
+    }
+
+    uint32_t k32;
+    memcpy(&k32, k, 4);
+    return k32;
+}
+
+static void unmask_bytes(unsigned char *data, size_t len,
+                         const unsigned char key[4], size_t key_offset)
+{
+    for (size_t i = 0; i < len; i++) {
+        data[i] ^= key[(i + key_offset) % 4];
+    }
+}
+
+// 8 bytes at a time in a general purpose register. `k32` repeats every 4
+// bytes, so every block starts at the same point of the key and whatever is
+// left at the end continues from key byte 0
+static void unmask_words(unsigned char *data, size_t len, uint32_t k32)
+{
+    uint64_t k64 = (uint64_t(k32) << 32) | k32;
+    size_t i = 0;
+
+    for (; i + 8 <= len; i += 8) {
+        uint64_t v;
+        memcpy(&v, data + i, 8);
+        v ^= k64;
+        memcpy(data + i, &v, 8);
+    }
+
+    unsigned char k[4];
+    memcpy(k, &k32, 4);
+    unmask_bytes(data + i, len - i, k, 0);
+}
+
+static void unmask_scalar(unsigned char *data, size_t len,
+                          const unsigned char key[4], size_t key_offset)
+{
+    unmask_words(data, len, rotated_key(key, key_offset));
+}
+
+#ifdef UNMASK_X86
+static void unmask_sse2(unsigned char *data, size_t len,
+                        const unsigned char key[4], size_t key_offset)
+{
+    uint32_t k32 = rotated_key(key, key_offset);
+    __m128i k = _mm_set1_epi32(k32);
+    size_t i = 0;
+
+    for (; i + 16 <= len; i += 16) {
+        auto p = reinterpret_cast<__m128i *>(data + i);
+        _mm_storeu_si128(p, _mm_xor_si128(_mm_loadu_si128(p), k));
+    }
+
+    unmask_words(data + i, len - i, k32);
+}
+
+__attribute__((target("avx2"))) static void
+unmask_avx2(unsigned char *data, size_t len, const unsigned char key[4],
+            size_t key_offset)
+{
+    uint32_t k32 = rotated_key(key, key_offset);
+    __m256i k = _mm256_set1_epi32(k32);
+    size_t i = 0;
+
+    // two vectors per iteration, the loads of one overlap the xor of the
+    // other
+    for (; i + 64 <= len; i += 64) {
+        auto p = reinterpret_cast<__m256i *>(data + i);
+        __m256i a = _mm256_loadu_si256(p);
+        __m256i b = _mm256_loadu_si256(p + 1);
+        _mm256_storeu_si256(p, _mm256_xor_si256(a, k));
+        _mm256_storeu_si256(p + 1, _mm256_xor_si256(b, k));
+    }
+    for (; i + 32 <= len; i += 32) {
+        auto p = reinterpret_cast<__m256i *>(data + i);
+        _mm256_storeu_si256(p, _mm256_xor_si256(_mm256_loadu_si256(p), k));
+    }
+
+    unmask_words(data + i, len - i, k32);
+}
+#endif
+
+#ifdef UNMASK_NEON
+static void unmask_neon(unsigned char *data, size_t len,
+                        const unsigned char key[4], size_t key_offset)
+{
+    uint32_t k32 = rotated_key(key, key_offset);
+    uint8x16_t k = vreinterpretq_u8_u32(vdupq_n_u32(k32));
+    size_t i = 0;
+
+    for (; i + 16 <= len; i += 16) {
+        vst1q_u8(data + i, veorq_u8(vld1q_u8(data + i), k));
+    }
+
+    unmask_words(data + i, len - i, k32);
+}
+#endif
+
+std::vector<ws::UnmaskImpl> ws::unmask_impls()
+{
+    std::vector<UnmaskImpl> impls = {
+        {"bytes", unmask_bytes},
+        {"scalar", unmask_scalar},
+    };
+
+#ifdef UNMASK_X86
+    // SSE2 is part of x86-64, AVX2 has to be asked for
+    impls.push_back({"sse2", unmask_sse2});
+    if (__builtin_cpu_supports("avx2")) {
+        impls.push_back({"avx2", unmask_avx2});
+    }
+#endif
+#ifdef UNMASK_NEON
+    impls.push_back({"neon", unmask_neon});
+#endif
+
+    return impls;
+}
+
+void ws::unmask(unsigned char *data, size_t len, const unsigned char key[4],
+                size_t key_offset)
+{
+    // messages this small don't make up for the setup of the vector loop
+    if (len < 8) {
+        unmask_bytes(data, len, key, key_offset);
+        return;
+    }
+
+    static const UnmaskFn best = ws::unmask_impls().back().fn;
+    best(data, len, key, key_offset);
+}
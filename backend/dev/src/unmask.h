@@ -0,0 +1,24 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+
+namespace ws {
+
+// XORs `len` bytes in place with the 4 byte masking key, `key_offset` is
+// where in the key the first byte falls (for a payload unmasked in pieces).
+// Uses the widest vector unit the CPU has, picked once at startup.
+void unmask(unsigned char *data, size_t len, const unsigned char key[4],
+            size_t key_offset = 0);
+
+using UnmaskFn = void (*)(unsigned char *data, size_t len,
+                          const unsigned char key[4], size_t key_offset);
+
+struct UnmaskImpl {
+    const char *name;
+    UnmaskFn fn;
+};
+
+// every implementation this CPU can run, from the plain byte loop (the
+// reference) to the one unmask() uses. For the benchmark
+std::vector<UnmaskImpl> unmask_impls();
+} // namespace ws
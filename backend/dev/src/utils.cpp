@@ -1,7 +1,27 @@
+#include <algorithm>
+#include <chrono>
 #include <random>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <zlib.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+#ifdef __APPLE__
+#include <sys/uio.h>
+#endif
 #include "utils.h"
 #include "assert.h"
 
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0 // macOS, SIGPIPE is ignored by the server instead
+#endif
+
 std::vector<string> utils::split_str(string &str, string delimiters)
 {
     std::vector<string> tokens;
@@ -147,3 +167,201 @@ uint64_t utils::_ntohll(uint64_t src)
 {
     return _htonll(src);
 }
+
+bool utils::iequals(std::string_view a, std::string_view b)
+{
+    if (a.size() != b.size())
+        return false;
+
+    for (size_t i = 0; i < a.size(); i++) {
+        if (tolower((unsigned char)a[i]) != tolower((unsigned char)b[i]))
+            return false;
+    }
+    return true;
+}
+
+/// look for `token` in a comma separated header value such as
+/// "keep-alive, Upgrade", ignoring case and surrounding whitespace
+bool utils::has_token(std::string_view list, std::string_view token)
+{
+    while (!list.empty()) {
+        size_t comma = list.find(',');
+        auto item = list.substr(0, comma);
+
+        size_t first = item.find_first_not_of(" \t");
+        size_t last = item.find_last_not_of(" \t");
+        if (first != std::string_view::npos &&
+            utils::iequals(item.substr(first, last - first + 1), token))
+            return true;
+
+        if (comma == std::string_view::npos)
+            break;
+        list.remove_prefix(comma + 1);
+    }
+    return false;
+}
+
+/// whether an Accept-Encoding header allows `coding`: it has to be listed
+/// (or covered by "*") without q=0. An explicit entry wins over "*"
+bool utils::accepts_encoding(std::string_view list, std::string_view coding)
+{
+    int exact = -1, wildcard = -1; // -1 = not mentioned, else 0 / 1
+
+    while (!list.empty()) {
+        size_t comma = list.find(',');
+        auto item = list.substr(0, comma);
+        list.remove_prefix(comma == std::string_view::npos ? list.size()
+                                                           : comma + 1);
+
+        auto params = item.find(';');
+        auto name = item.substr(0, params);
+        size_t first = name.find_first_not_of(" \t");
+        if (first == std::string_view::npos)
+            continue;
+        name = name.substr(first, name.find_last_not_of(" \t") - first + 1);
+
+        // only the weight matters, and only whether it's zero
+        bool allowed = true;
+        if (params != std::string_view::npos) {
+            auto q = item.substr(params + 1);
+            q.remove_prefix(std::min(q.find_first_not_of(" \t"), q.size()));
+            if (q.size() > 2 && (q[0] == 'q' || q[0] == 'Q') && q[1] == '=') {
+                allowed = strtod(string(q.substr(2)).c_str(), nullptr) > 0;
+            }
+        }
+
+        if (utils::iequals(name, coding))
+            exact = allowed;
+        else if (name == "*")
+            wildcard = allowed;
+    }
+
+    return exact != -1 ? exact : wildcard == 1;
+}
+
+/// gzip (not raw deflate / zlib) stream of `in` at the given level, false
+/// if zlib fails
+bool utils::gzip(std::string_view in, string &out, int level)
+{
+    z_stream zs = {};
+    // 15 + 16: max window, gzip header and trailer
+    if (deflateInit2(&zs, level, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY) !=
+        Z_OK)
+        return false;
+
+    out.resize(deflateBound(&zs, in.size()));
+    zs.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(in.data()));
+    zs.avail_in = in.size();
+    zs.next_out = reinterpret_cast<Bytef *>(out.data());
+    zs.avail_out = out.size();
+
+    int status = deflate(&zs, Z_FINISH);
+    out.resize(zs.total_out);
+    deflateEnd(&zs);
+
+    return status == Z_STREAM_END;
+}
+
+/// If-None-Match check: `list` is "*" or a list of (possibly weak) entity
+/// tags, compared weakly against our strong `etag` as RFC 9110 asks for
+bool utils::etag_matches(std::string_view list, std::string_view etag)
+{
+    while (!list.empty()) {
+        size_t comma = list.find(',');
+        auto item = list.substr(0, comma);
+        list.remove_prefix(comma == std::string_view::npos ? list.size()
+                                                           : comma + 1);
+
+        size_t first = item.find_first_not_of(" \t");
+        if (first == std::string_view::npos)
+            continue;
+        item = item.substr(first, item.find_last_not_of(" \t") - first + 1);
+
+        if (item == "*")
+            return true;
+        if (item.starts_with("W/"))
+            item.remove_prefix(2);
+        if (item == etag)
+            return true;
+    }
+    return false;
+}
+
+/// IMF-fixdate, "Sun, 06 Nov 1994 08:49:37 GMT"
+string utils::http_date(time_t t)
+{
+    tm gmt;
+    char buf[64];
+    gmtime_r(&t, &gmt);
+    strftime(buf, sizeof(buf), "%a, %d %b %Y %H:%M:%S GMT", &gmt);
+    return buf;
+}
+
+/// only the IMF-fixdate format, which is what browsers send back
+bool utils::parse_http_date(std::string_view s, time_t &out)
+{
+    tm gmt = {};
+    string str(s);
+    const char *end = strptime(str.c_str(), "%a, %d %b %Y %H:%M:%S GMT", &gmt);
+    if (end == nullptr || *end != '\0')
+        return false;
+
+    out = timegm(&gmt);
+    return true;
+}
+
+/// monotonic clock in milliseconds, for timeouts
+int64_t utils::now_ms()
+{
+    using namespace std::chrono;
+    return duration_cast<milliseconds>(steady_clock::now().time_since_epoch())
+        .count();
+}
+
+/// the same clock in microseconds, for measuring
+int64_t utils::now_us()
+{
+    using namespace std::chrono;
+    return duration_cast<microseconds>(steady_clock::now().time_since_epoch())
+        .count();
+}
+
+void utils::set_nonblocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+
+    if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+        perror("fcntl");
+    }
+}
+
+/// copy up to count bytes of filefd, starting at *offset, to the socket
+/// without going through user space where the platform allows it
+/**
+ * @param offset is advanced by the number of bytes sent
+ * @return bytes sent, 0 at the end of the file, -1 on error (errno is set,
+ * EAGAIN when the socket buffer is full)
+ */
+ssize_t utils::send_file(int sockfd, int filefd, off_t *offset, size_t count)
+{
+#if defined(__linux__)
+    return sendfile(sockfd, filefd, offset, count);
+#elif defined(__APPLE__)
+    off_t len = count;
+    int res = sendfile(filefd, sockfd, *offset, &len, nullptr, 0);
+    *offset += len;
+    // a partial write reports EAGAIN but still moved `len` bytes
+    if (res == -1 && len > 0)
+        return len;
+    return res == -1 ? -1 : len;
+#else
+    char buf[64 * 1024];
+    ssize_t n = pread(filefd, buf, std::min(count, sizeof(buf)), *offset);
+    if (n <= 0)
+        return n;
+    n = ::send(sockfd, buf, n, MSG_NOSIGNAL);
+    if (n > 0)
+        *offset += n;
+    return n;
+#endif
+}
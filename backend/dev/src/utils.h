@@ -2,6 +2,8 @@
 
 #include <vector>
 #include <string>
+#include <string_view>
+#include <sys/types.h>
 #include "http.h"
 
 union uint16_t_converter {
@@ -21,4 +23,15 @@ string create_uuid(int len = 10);
 string base64_encode(unsigned char const *bytes_to_encode, unsigned int in_len);
 uint64_t _htonll(uint64_t src);
 uint64_t _ntohll(uint64_t src);
+bool iequals(std::string_view a, std::string_view b);
+bool has_token(std::string_view list, std::string_view token);
+bool accepts_encoding(std::string_view list, std::string_view coding);
+bool gzip(std::string_view in, string &out, int level = 9);
+bool etag_matches(std::string_view list, std::string_view etag);
+string http_date(time_t t);
+bool parse_http_date(std::string_view s, time_t &out);
+void set_nonblocking(int fd);
+int64_t now_ms();
+int64_t now_us();
+ssize_t send_file(int sockfd, int filefd, off_t *offset, size_t count);
 } // namespace utils
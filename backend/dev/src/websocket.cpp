@@ -1,137 +1,231 @@
 #include <string>
 #include "websocket.h"
 #include "network.h"
+#include "unmask.h"
 #include "utils.h"
 
-ws::Data ws::parse_frame(unsigned char *buf)
+ws::Decoder::Decoder(size_t max_message_size, bool deflate)
 {
-    ws::Data data;
-    data.is_close_frame = false;
-
-    auto fin_and_opcode = buf[0];
-    auto mask_and_length = buf[1];
-
-    // clang-format off
-    uint8_t opcode      = fin_and_opcode  & 0b00001111;
-    uint8_t mask_code   = mask_and_length & 0b10000000; // mask is in the first bit
-    uint8_t length      = mask_and_length & 0b01111111; // length is the rest of the bits after the first
-    // clang-format on
-
-    if (mask_code == 0) {
-        // TODO: error, all frames coming from client should be masked
-    }
-
-    // check for Close frame
-    if (opcode == 0x8) {
-        data.is_close_frame = true;
-        return data;
-    }
+    this->max_message_size = max_message_size;
+    this->deflate = deflate;
+}
 
-    int mask_offset = 2;
+ws::Decoder::Status ws::Decoder::fail(uint16_t code)
+{
+    this->close_code = code;
+    return Status::Error;
+}
 
-    if (length == network::payload_size_code_16bit) {
-        uint16_t_converter temp;
-        std::copy(buf + 2, buf + 5, temp.c);
-        length = ntohs(temp.i);
-        mask_offset = 4;
-    }
-    else if (length == network::payload_size_code_64bit) {
-        uint64_t_converter temp;
-        std::copy(buf + 2, buf + 10, temp.c);
-        length = utils::_ntohll(temp.i);
-        mask_offset = 10;
+ws::Decoder::Status ws::Decoder::next(Buffer &in, Message &msg)
+{
+    if (this->drop_len > 0) {
+        in.erase(this->drop_offset, this->drop_len);
+        this->drop_len = 0;
     }
 
-    unsigned char mask[4] = {buf[mask_offset], buf[mask_offset + 1],
-                             buf[mask_offset + 2], buf[mask_offset + 3]};
-    int payload_offset = mask_offset + 4;
-
-    char msgbuf[length];
-    for (int i = 0; i < length; i++) {
-        // unmask the payload
-        msgbuf[i] = buf[payload_offset + i] ^ mask[i % 4];
+    while (true) {
+        // the next frame starts right after the fragments collected so far
+        auto p =
+            reinterpret_cast<unsigned char *>(in.data()) + this->assembled;
+        size_t avail = in.size() - this->assembled;
+
+        if (avail < 2)
+            return Status::Incomplete;
+
+        bool fin = p[0] & 0x80;
+        auto opcode = static_cast<Opcode>(p[0] & 0x0F);
+        bool rsv1 = p[0] & 0x40;
+        bool masked = p[1] & 0x80;
+        uint64_t len = p[1] & 0x7F;
+        size_t header = 2;
+
+        // RSV1 is permessage-deflate's, the only extension there is. Every
+        // client frame has to be masked
+        if ((p[0] & 0x30) || (rsv1 && !this->deflate) || !masked) {
+            return this->fail(CLOSE_PROTOCOL_ERROR);
+        }
+
+        if (len == network::payload_size_code_16bit) {
+            if (avail < 4)
+                return Status::Incomplete;
+            len = (uint64_t(p[2]) << 8) | p[3];
+            header = 4;
+        }
+        else if (len == network::payload_size_code_64bit) {
+            if (avail < 10)
+                return Status::Incomplete;
+            len = 0;
+            for (int i = 2; i < 10; i++) {
+                len = (len << 8) | p[i];
+            }
+            header = 10;
+        }
+
+        const unsigned char *key = p + header;
+        header += 4;
+
+        bool control = static_cast<uint8_t>(opcode) & 0x8;
+        if (control) {
+            if (!fin || rsv1 || len > network::SMALL_PAYLOAD_SIZE ||
+                (opcode != Opcode::Close && opcode != Opcode::Ping &&
+                 opcode != Opcode::Pong)) {
+                return this->fail(CLOSE_PROTOCOL_ERROR);
+            }
+        }
+        else {
+            // a continuation has to continue something, and a new message
+            // can't start in the middle of another one. RSV1 only goes on the
+            // first frame of a compressed message
+            bool continuation = opcode == Opcode::Continuation;
+            if (continuation != this->fragmented || (continuation && rsv1) ||
+                (!continuation && opcode != Opcode::Text &&
+                 opcode != Opcode::Binary)) {
+                return this->fail(CLOSE_PROTOCOL_ERROR);
+            }
+
+            // checked before waiting for the payload, so a client can't make
+            // us buffer more than this
+            if (len > this->max_message_size - this->assembled) {
+                return this->fail(CLOSE_TOO_BIG);
+            }
+        }
+
+        if (avail < header + len)
+            return Status::Incomplete;
+
+        auto payload = p + header;
+        ws::unmask(payload, len, key);
+
+        if (control) {
+            msg = Message{.opcode = opcode,
+                          .payload = {reinterpret_cast<char *>(payload), len}};
+            this->drop_offset = this->assembled;
+            this->drop_len = header + len;
+            return Status::Message;
+        }
+
+        if (fin && !this->fragmented) {
+            msg = Message{.opcode = opcode,
+                          .payload = {reinterpret_cast<char *>(payload), len},
+                          .compressed = rsv1};
+            this->drop_offset = 0;
+            this->drop_len = header + len;
+            return Status::Message;
+        }
+
+        // a fragment: squeeze out its header so the payload directly follows
+        // the ones before it
+        if (!this->fragmented) {
+            this->fragmented = true;
+            this->fragmented_opcode = opcode;
+            this->fragmented_compressed = rsv1;
+        }
+        in.erase(this->assembled, header);
+        this->assembled += len;
+
+        if (fin) {
+            msg = Message{.opcode = this->fragmented_opcode,
+                          .payload = {in.data(), this->assembled},
+                          .compressed = this->fragmented_compressed};
+            this->drop_offset = 0;
+            this->drop_len = this->assembled;
+            this->assembled = 0;
+            this->fragmented = false;
+            return Status::Message;
+        }
     }
-    msgbuf[length] = '\0';
-
-    data.payload = json::parse(msgbuf, msgbuf + length);
-
-    return data;
 }
 
-char *ws::create_frame(string payload)
+ws::FrameHeader ws::frame_header(Opcode opcode, size_t payload_len, bool fin,
+                                 bool compressed)
 {
-    char *response_buf = new char[4096];
-
-    uint8_t fin = 128;
-    uint8_t opcode = 1;
-    uint8_t fin_and_opcode = fin | opcode;
+    FrameHeader h;
+    h.bytes[0] = (fin ? 0x80 : 0) | (compressed ? 0x40 : 0) |
+                 static_cast<uint8_t>(opcode);
 
-    uint8_t mask = 0;
-    uint64_t payload_len = payload.size();
-    uint8_t pl;
-    // we doing the same thing we did when we process the
-    // websocket frame, just backwards this time
+    // server frames are never masked, the mask bit stays 0
     if (payload_len <= network::SMALL_PAYLOAD_SIZE) {
-        pl = static_cast<uint8_t>(payload_len);
+        h.bytes[1] = payload_len;
+        h.size = 2;
     }
     else if (payload_len <= network::MEDIUM_PAYLOAD_SIZE) {
-        pl = network::payload_size_code_16bit;
+        h.bytes[1] = network::payload_size_code_16bit;
+        h.bytes[2] = payload_len >> 8;
+        h.bytes[3] = payload_len;
+        h.size = 4;
     }
     else {
-        pl = network::payload_size_code_64bit;
+        h.bytes[1] = network::payload_size_code_64bit;
+        for (int i = 0; i < 8; i++) {
+            h.bytes[2 + i] = uint64_t(payload_len) >> (56 - 8 * i);
+        }
+        h.size = 10;
     }
-    uint8_t mask_and_payloadlen = mask | pl;
 
-    response_buf[0] = fin_and_opcode;
-    response_buf[1] = mask_and_payloadlen;
+    return h;
+}
 
-    int bytes_written = 2;
-    int payload_len_offset = 2;
+void ws::send(OutQueue &out, Opcode opcode, string payload, bool compressed)
+{
+    auto header = ws::frame_header(opcode, payload.size(), true, compressed);
+    out.push(string(header.view()));
+    out.push(std::move(payload));
+}
 
-    if (payload_len <= network::SMALL_PAYLOAD_SIZE) {
-        // do nothing
-    }
-    else if (payload_len <= network::MEDIUM_PAYLOAD_SIZE) {
-        uint16_t_converter temp;
-        temp.i = htons(payload_len);
-        response_buf[2] = temp.c[0];
-        response_buf[3] = temp.c[1];
-        bytes_written += 2;
-        payload_len_offset = 4;
-    }
-    else { // MUST be <= 2^63 (the most sig. bit is 0)
-        uint64_t_converter temp;
-        temp.i = utils::_htonll(payload_len);
-        response_buf[2] = temp.c[0];
-        response_buf[3] = temp.c[1];
-        response_buf[4] = temp.c[2];
-        response_buf[5] = temp.c[3];
-        response_buf[6] = temp.c[4];
-        response_buf[7] = temp.c[5];
-        response_buf[8] = temp.c[6];
-        response_buf[9] = temp.c[7];
-        bytes_written += 8;
-        payload_len_offset = 10;
-    }
+ws::Frame ws::make_frame(Opcode opcode, std::string_view payload,
+                         bool compressed)
+{
+    auto header = ws::frame_header(opcode, payload.size(), true, compressed);
 
-    std::copy(payload.begin(), payload.end(),
-              response_buf + payload_len_offset);
+    string frame;
+    frame.reserve(header.size + payload.size());
+    frame += header.view();
+    frame += payload;
 
-    return response_buf;
+    return std::make_shared<const string>(std::move(frame));
 }
 
-char *ws::create_close_frame()
+void ws::send(OutQueue &out, const Frame &frame)
 {
-    char *response_buf = new char[2];
+    out.push(frame, *frame);
+}
 
-    uint8_t fin = 128;
-    uint8_t opcode = 8;
-    uint8_t fin_and_opcode = fin | opcode;
+ws::Broadcast::Broadcast(Opcode opcode, string payload)
+{
+    this->opcode = opcode;
+    this->payload = std::move(payload);
+}
 
-    uint8_t mask_and_payloadlen = 0;
+const ws::Frame &ws::Broadcast::plain()
+{
+    if (!this->plain_frame) {
+        this->plain_frame = ws::make_frame(this->opcode, this->payload);
+    }
+    return this->plain_frame;
+}
 
-    response_buf[0] = fin_and_opcode;
-    response_buf[1] = mask_and_payloadlen;
+const ws::Frame &ws::Broadcast::deflated(Deflater &deflater)
+{
+    if (!this->deflated_frame) {
+        string compressed = deflater.compress(this->payload);
+        this->deflated_frame =
+            compressed.size() < this->payload.size()
+                ? ws::make_frame(this->opcode, compressed, true)
+                : this->plain();
+    }
+    return this->deflated_frame;
+}
 
-    return response_buf;
-}
\ No newline at end of file
+string ws::control_frame(Opcode opcode, std::string_view payload)
+{
+    string frame(ws::frame_header(opcode, payload.size()).view());
+    frame += payload;
+    return frame;
+}
+
+string ws::close_frame(uint16_t status)
+{
+    char payload[2] = {static_cast<char>(status >> 8),
+                       static_cast<char>(status & 0xFF)};
+    return ws::control_frame(Opcode::Close, {payload, 2});
+}
@@ -1,19 +1,152 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
+#include <memory>
 #include <string>
+#include <string_view>
 #include <nlohmann/json.hpp>
+#include "buffer.h"
+#include "out_queue.h"
+#include "ws_deflate.h"
 
 using std::string;
 using json = nlohmann::json;
 
 namespace ws {
 
-struct Data {
-    bool is_close_frame;
-    json payload;
+enum class Opcode : uint8_t {
+    Continuation = 0x0,
+    Text = 0x1,
+    Binary = 0x2,
+    Close = 0x8,
+    Ping = 0x9,
+    Pong = 0xA,
 };
 
-Data parse_frame(unsigned char *buf);
-char *create_frame(string payload);
-char *create_close_frame();
+// close status codes (RFC 6455, 7.4.1)
+static const uint16_t CLOSE_NORMAL = 1000;
+static const uint16_t CLOSE_PROTOCOL_ERROR = 1002;
+static const uint16_t CLOSE_UNSUPPORTED_DATA = 1003;
+static const uint16_t CLOSE_INVALID_PAYLOAD = 1007;
+static const uint16_t CLOSE_POLICY_VIOLATION = 1008;
+static const uint16_t CLOSE_TOO_BIG = 1009;
+
+// A whole message (all of its fragments) or a control frame, unmasked.
+// `payload` points into the connection's receive buffer and is only valid
+// until the next call to Decoder::next() or until the buffer is written to.
+struct Message {
+    Opcode opcode; // never Continuation
+    std::string_view payload;
+    // RSV1 was set: the payload still has to be inflated (permessage-deflate)
+    bool compressed = false;
+};
+
+// Incremental frame decoder working directly on a connection's receive
+// buffer: feed it whatever recv() returned and it hands back messages as
+// they complete, however the frames were split across reads.
+//
+// Payloads are unmasked in place. The fragments of a message are collected
+// at the front of the buffer as they arrive, erasing the frame header in
+// between, so a message is always one contiguous range and never copied into
+// a separate buffer. Control frames can come in between fragments and are
+// returned right away.
+class Decoder {
+  public:
+    enum class Status { Incomplete, Message, Error };
+
+  private:
+    size_t max_message_size;
+    bool deflate; // permessage-deflate was negotiated, RSV1 is allowed
+
+    // payload bytes of an unfinished fragmented message, they're at the
+    // start of the buffer
+    size_t assembled = 0;
+    bool fragmented = false;
+    Opcode fragmented_opcode = Opcode::Text;
+    bool fragmented_compressed = false;
+
+    // what was returned last time, dropped from the buffer on the next call
+    size_t drop_offset = 0;
+    size_t drop_len = 0;
+
+    uint16_t close_code = 0;
+
+    Status fail(uint16_t code);
+
+  public:
+    Decoder(size_t max_message_size = 64 * 1024, bool deflate = false);
+
+    Status next(Buffer &in, Message &msg);
+
+    // close status to send back after an Error
+    uint16_t error() const
+    {
+        return this->close_code;
+    }
+};
+
+// header of an (unmasked) server frame, built on the stack
+struct FrameHeader {
+    unsigned char bytes[10];
+    uint8_t size;
+
+    std::string_view view() const
+    {
+        return {reinterpret_cast<const char *>(this->bytes), this->size};
+    }
+};
+
+// `compressed` sets RSV1, for the first frame of a deflated message
+FrameHeader frame_header(Opcode opcode, size_t payload_len, bool fin = true,
+                         bool compressed = false);
+
+// Queues a message to one connection: the header (small enough for the
+// string's inline storage, so nothing is allocated for it) and the payload
+// go out together in the queue's writev, the payload is never copied.
+void send(OutQueue &out, Opcode opcode, string payload,
+          bool compressed = false);
+
+// A whole encoded frame, immutable and reference counted. It's encoded once
+// and can be queued to any number of connections, each of them only holds a
+// reference until its copy is written. Broadcasts (a move to everyone in a
+// game) are built on this.
+using Frame = std::shared_ptr<const string>;
+
+Frame make_frame(Opcode opcode, std::string_view payload,
+                 bool compressed = false);
+void send(OutQueue &out, const Frame &frame);
+
+// One message for many connections. Each form of it is encoded the first
+// time a connection needs it and shared with all the others: the plain frame,
+// and the deflated one for connections where we don't keep a compression
+// context (server_no_context_takeover), whose compressed bytes don't depend
+// on anything sent before.
+class Broadcast {
+    Opcode opcode;
+    string payload;
+    Frame plain_frame;
+    Frame deflated_frame;
+
+  public:
+    Broadcast(Opcode opcode, string payload);
+
+    const Frame &plain();
+    // `deflater` has to be one without context takeover. Falls back to the
+    // plain frame if deflating doesn't make it smaller
+    const Frame &deflated(Deflater &deflater);
+
+    Opcode type() const
+    {
+        return this->opcode;
+    }
+    std::string_view data() const
+    {
+        return this->payload;
+    }
+};
+
+// control frames are at most 125 bytes of payload
+string control_frame(Opcode opcode, std::string_view payload = {});
+string close_frame(uint16_t status);
 } // namespace ws
@@ -0,0 +1,266 @@
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "ws_deflate.h"
+#include "utils.h"
+
+static const int WINDOW_BITS = 15;
+static const int MEM_LEVEL = 8;
+
+// the empty stored block a sync flush ends with, dropped by the sender
+static const unsigned char FLUSH_TAIL[4] = {0x00, 0x00, 0xff, 0xff};
+
+static std::string_view trim(std::string_view s)
+{
+    size_t first = s.find_first_not_of(" \t");
+    if (first == std::string_view::npos)
+        return {};
+    return s.substr(first, s.find_last_not_of(" \t") - first + 1);
+}
+
+// "8".."15", quoted or not
+static bool parse_window_bits(std::string_view value, int &bits)
+{
+    if (value.size() >= 2 && value.front() == '"' && value.back() == '"') {
+        value = value.substr(1, value.size() - 2);
+    }
+    if (value.empty() || value.size() > 2 ||
+        !std::all_of(value.begin(), value.end(), ::isdigit)) {
+        return false;
+    }
+
+    bits = atoi(string(value).c_str());
+    return bits >= 8 && bits <= 15;
+}
+
+// one "permessage-deflate; a; b=1" offer, false if it has to be declined
+static bool parse_offer(std::string_view offer, bool &server_no_takeover,
+                        bool &client_no_takeover, bool &server_bits)
+{
+    bool seen_client_bits = false;
+
+    while (!offer.empty()) {
+        size_t semi = offer.find(';');
+        auto param = trim(offer.substr(0, semi));
+        offer.remove_prefix(semi == std::string_view::npos ? offer.size()
+                                                           : semi + 1);
+
+        size_t eq = param.find('=');
+        auto name = trim(param.substr(0, eq));
+        auto value = eq == std::string_view::npos ? std::string_view{}
+                                                  : trim(param.substr(eq + 1));
+        bool has_value = eq != std::string_view::npos;
+        int bits;
+
+        // every parameter at most once (RFC 7692 7.1)
+        if (name == "server_no_context_takeover") {
+            if (has_value || server_no_takeover)
+                return false;
+            server_no_takeover = true;
+        }
+        else if (name == "client_no_context_takeover") {
+            if (has_value || client_no_takeover)
+                return false;
+            client_no_takeover = true;
+        }
+        else if (name == "server_max_window_bits") {
+            if (server_bits || !parse_window_bits(value, bits) ||
+                bits != WINDOW_BITS)
+                return false;
+            server_bits = true;
+        }
+        else if (name == "client_max_window_bits") {
+            // the client saying it could use a smaller window, ours inflates
+            // whatever it picks
+            if (seen_client_bits ||
+                (has_value && !parse_window_bits(value, bits)))
+                return false;
+            seen_client_bits = true;
+        }
+        else {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+string ws::negotiate_deflate(std::string_view offers, bool server_no_takeover,
+                             bool client_no_takeover, DeflateParams &params)
+{
+    params = DeflateParams{};
+
+    while (!offers.empty()) {
+        size_t comma = offers.find(',');
+        auto offer = offers.substr(0, comma);
+        offers.remove_prefix(comma == std::string_view::npos ? offers.size()
+                                                             : comma + 1);
+
+        size_t semi = offer.find(';');
+        if (!utils::iequals(trim(offer.substr(0, semi)), "permessage-deflate"))
+            continue;
+
+        bool server_nct = false, client_nct = false, server_bits = false;
+        if (semi != std::string_view::npos &&
+            !parse_offer(offer.substr(semi + 1), server_nct, client_nct,
+                         server_bits)) {
+            continue;
+        }
+
+        params = DeflateParams{
+            .enabled = true,
+            .server_no_context_takeover = server_nct || server_no_takeover,
+            .client_no_context_takeover = client_nct || client_no_takeover,
+        };
+
+        string response = "permessage-deflate";
+        if (params.server_no_context_takeover)
+            response += "; server_no_context_takeover";
+        if (params.client_no_context_takeover)
+            response += "; client_no_context_takeover";
+        if (server_bits)
+            response += "; server_max_window_bits=15";
+        return response;
+    }
+
+    return "";
+}
+
+ws::Deflater::Deflater(bool takeover, int level)
+{
+    this->takeover = takeover;
+    this->zs = {};
+
+    // negative window bits: raw deflate, no zlib header or checksum
+    if (deflateInit2(&this->zs, level, Z_DEFLATED, -WINDOW_BITS, MEM_LEVEL,
+                     Z_DEFAULT_STRATEGY) != Z_OK) {
+        perror("deflateInit2");
+        exit(EXIT_FAILURE);
+    }
+}
+
+ws::Deflater::~Deflater()
+{
+    deflateEnd(&this->zs);
+}
+
+string ws::Deflater::compress(std::string_view in)
+{
+    string out;
+    size_t have = 0;
+
+    this->zs.next_in =
+        reinterpret_cast<Bytef *>(const_cast<char *>(in.data()));
+    this->zs.avail_in = in.size();
+
+    // the bound is enough in one go, the loop is for the flush marker
+    size_t room = deflateBound(&this->zs, in.size()) + 16;
+    do {
+        out.resize(have + room);
+        this->zs.next_out = reinterpret_cast<Bytef *>(out.data() + have);
+        this->zs.avail_out = room;
+
+        deflate(&this->zs, Z_SYNC_FLUSH);
+
+        have += room - this->zs.avail_out;
+        room = 64;
+    } while (this->zs.avail_out == 0);
+
+    out.resize(have);
+    if (out.size() >= 4 &&
+        memcmp(out.data() + out.size() - 4, FLUSH_TAIL, 4) == 0) {
+        out.resize(out.size() - 4);
+    }
+
+    if (!this->takeover)
+        deflateReset(&this->zs);
+
+    return out;
+}
+
+size_t ws::Deflater::memory()
+{
+    return (1 << (WINDOW_BITS + 2)) + (1 << (MEM_LEVEL + 9));
+}
+
+ws::Inflater::Inflater(bool takeover)
+{
+    this->takeover = takeover;
+    this->zs = {};
+
+    if (inflateInit2(&this->zs, -WINDOW_BITS) != Z_OK) {
+        perror("inflateInit2");
+        exit(EXIT_FAILURE);
+    }
+}
+
+ws::Inflater::~Inflater()
+{
+    inflateEnd(&this->zs);
+}
+
+ws::Inflater::Status ws::Inflater::decompress(std::string_view in, string &out,
+                                              size_t max_size)
+{
+    auto status = Status::Ok;
+    bool tail = false;
+
+    out.clear();
+    this->zs.next_in =
+        reinterpret_cast<Bytef *>(const_cast<char *>(in.data()));
+    this->zs.avail_in = in.size();
+
+    while (true) {
+        // the sender left off the end of the flush, it goes in after the
+        // message
+        if (this->zs.avail_in == 0 && !tail) {
+            this->zs.next_in = const_cast<Bytef *>(FLUSH_TAIL);
+            this->zs.avail_in = 4;
+            tail = true;
+        }
+
+        // one byte over the limit is enough to know it's too big
+        size_t have = out.size();
+        size_t room = std::min(std::max<size_t>(in.size() * 4, 1024),
+                               max_size + 1 - have);
+        out.resize(have + room);
+        this->zs.next_out = reinterpret_cast<Bytef *>(out.data() + have);
+        this->zs.avail_out = room;
+
+        int ret = inflate(&this->zs, Z_SYNC_FLUSH);
+        out.resize(have + room - this->zs.avail_out);
+
+        if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) {
+            status = Status::Error;
+            break;
+        }
+        if (out.size() > max_size) {
+            status = Status::TooBig;
+            break;
+        }
+        // a final block ends the stream, nothing after it can be inflated
+        if (ret == Z_STREAM_END) {
+            if (this->zs.avail_in > 0 && !tail)
+                status = Status::Error;
+            inflateReset(&this->zs);
+            return status;
+        }
+        if (tail && this->zs.avail_in == 0 && this->zs.avail_out > 0)
+            break;
+    }
+
+    // a failed message leaves the stream in an unknown state, the connection
+    // is closed anyway but a shared inflater goes on with the next one
+    if (!this->takeover || status != Status::Ok)
+        inflateReset(&this->zs);
+
+    return status;
+}
+
+size_t ws::Inflater::memory()
+{
+    // the window plus the inflate state itself
+    return (1 << WINDOW_BITS) + 7 * 1024;
+}
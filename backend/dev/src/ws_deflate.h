@@ -0,0 +1,71 @@
+#pragma once
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <zlib.h>
+
+using std::string;
+
+namespace ws {
+
+// what a connection agreed on for permessage-deflate (RFC 7692)
+struct DeflateParams {
+    bool enabled = false;
+    // the compression context is reset after every message, by us / by the
+    // client
+    bool server_no_context_takeover = false;
+    bool client_no_context_takeover = false;
+};
+
+// Picks the first permessage-deflate offer of a Sec-WebSocket-Extensions
+// header that can be accepted and returns the value to answer with ("" when
+// none). `server_no_takeover` / `client_no_takeover` are put in the answer
+// even if the client didn't ask for them: they only take the context away,
+// which every client has to support. Offers limiting our window below 15 bits
+// are declined, every message is compressed with the full window.
+string negotiate_deflate(std::string_view offers, bool server_no_takeover,
+                         bool client_no_takeover, DeflateParams &params);
+
+// Raw deflate of whole messages: the output ends on a byte boundary and the
+// trailing 00 00 ff ff of the flush is left off (RFC 7692 7.2.1). Without
+// context takeover the stream is reset after every message, the output then
+// doesn't depend on what was sent before and one Deflater can serve every
+// connection.
+class Deflater {
+    z_stream zs;
+    bool takeover;
+
+  public:
+    Deflater(bool takeover, int level = Z_DEFAULT_COMPRESSION);
+    ~Deflater();
+
+    // zlib keeps pointers back into the z_stream, it can't move
+    Deflater(const Deflater &) = delete;
+    Deflater &operator=(const Deflater &) = delete;
+
+    string compress(std::string_view in);
+
+    // roughly what zlib allocates for one, see zconf.h
+    static size_t memory();
+};
+
+class Inflater {
+    z_stream zs;
+    bool takeover;
+
+  public:
+    enum class Status { Ok, TooBig, Error };
+
+    Inflater(bool takeover);
+    ~Inflater();
+
+    Inflater(const Inflater &) = delete;
+    Inflater &operator=(const Inflater &) = delete;
+
+    // inflates a whole message into `out`, giving up as soon as it grows past
+    // `max_size` (a few KB can inflate to gigabytes)
+    Status decompress(std::string_view in, string &out, size_t max_size);
+
+    static size_t memory();
+};
+} // namespace ws